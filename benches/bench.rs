@@ -81,6 +81,22 @@ fn bench_long_blake2b_portable(b: &mut Bencher) {
     b.iter(|| params.hash(input.get()));
 }
 
+#[bench]
+fn bench_oneblock_blake2b_sse41(b: &mut Bencher) {
+    let mut input = RandomInput::new(b, blake2b_simd::BLOCKBYTES);
+    let mut params = blake2b_simd::Params::new();
+    blake2b_simd::benchmarks::force_sse41(&mut params);
+    b.iter(|| params.hash(input.get()));
+}
+
+#[bench]
+fn bench_long_blake2b_sse41(b: &mut Bencher) {
+    let mut input = RandomInput::new(b, LONG);
+    let mut params = blake2b_simd::Params::new();
+    blake2b_simd::benchmarks::force_sse41(&mut params);
+    b.iter(|| params.hash(input.get()));
+}
+
 #[bench]
 fn bench_oneblock_blake2s_sse41(b: &mut Bencher) {
     let mut input = RandomInput::new(b, blake2s_simd::BLOCKBYTES);
@@ -225,6 +241,186 @@ fn bench_long_blake2s_many_8x(b: &mut Bencher) {
     });
 }
 
+// The SWAR implementation is for 64-bit targets without SIMD, so compare it
+// to portable rather than to whatever the host supports.
+fn bench_blake2s_many_2x(b: &mut Bencher, len: usize, force: fn(&mut blake2s_simd::Params)) {
+    let mut input0 = RandomInput::new(b, len);
+    let mut input1 = RandomInput::new(b, len);
+    let mut params = blake2s_simd::Params::new();
+    force(&mut params);
+    b.iter(|| {
+        let mut jobs = [
+            blake2s_simd::many::HashManyJob::new(&params, input0.get()),
+            blake2s_simd::many::HashManyJob::new(&params, input1.get()),
+        ];
+        blake2s_simd::many::hash_many(jobs.iter_mut());
+        [jobs[0].to_hash(), jobs[1].to_hash()]
+    });
+}
+
+#[bench]
+fn bench_long_blake2s_many_2x_portable(b: &mut Bencher) {
+    bench_blake2s_many_2x(b, LONG, blake2s_simd::benchmarks::force_portable);
+}
+
+#[bench]
+fn bench_long_blake2s_many_2x_swar(b: &mut Bencher) {
+    bench_blake2s_many_2x(b, LONG, blake2s_simd::benchmarks::force_swar);
+}
+
+#[bench]
+fn bench_oneblock_blake2s_many_2x_portable(b: &mut Bencher) {
+    bench_blake2s_many_2x(
+        b,
+        blake2s_simd::BLOCKBYTES,
+        blake2s_simd::benchmarks::force_portable,
+    );
+}
+
+#[bench]
+fn bench_oneblock_blake2s_many_2x_swar(b: &mut Bencher) {
+    bench_blake2s_many_2x(
+        b,
+        blake2s_simd::BLOCKBYTES,
+        blake2s_simd::benchmarks::force_swar,
+    );
+}
+
+// Portable2 is for targets without SIMD, so compare it to portable rather than
+// to whatever the host supports.
+fn bench_blake2b_many_2x(b: &mut Bencher, len: usize, force: fn(&mut blake2b_simd::Params)) {
+    let mut input0 = RandomInput::new(b, len);
+    let mut input1 = RandomInput::new(b, len);
+    let mut params = blake2b_simd::Params::new();
+    force(&mut params);
+    b.iter(|| {
+        let mut jobs = [
+            blake2b_simd::many::HashManyJob::new(&params, input0.get()),
+            blake2b_simd::many::HashManyJob::new(&params, input1.get()),
+        ];
+        blake2b_simd::many::hash_many(jobs.iter_mut());
+        [jobs[0].to_hash(), jobs[1].to_hash()]
+    });
+}
+
+#[bench]
+fn bench_long_blake2b_many_2x_portable(b: &mut Bencher) {
+    bench_blake2b_many_2x(b, LONG, blake2b_simd::benchmarks::force_portable);
+}
+
+#[bench]
+fn bench_long_blake2b_many_2x_portable2(b: &mut Bencher) {
+    bench_blake2b_many_2x(b, LONG, blake2b_simd::benchmarks::force_portable2);
+}
+
+#[bench]
+fn bench_oneblock_blake2b_many_2x_portable(b: &mut Bencher) {
+    bench_blake2b_many_2x(
+        b,
+        blake2b_simd::BLOCKBYTES,
+        blake2b_simd::benchmarks::force_portable,
+    );
+}
+
+#[bench]
+fn bench_oneblock_blake2b_many_2x_portable2(b: &mut Bencher) {
+    bench_blake2b_many_2x(
+        b,
+        blake2b_simd::BLOCKBYTES,
+        blake2b_simd::benchmarks::force_portable2,
+    );
+}
+
+// Interleaved AVX2 is never detected, so benchmarks have to ask for it. Run it
+// at its own degree, against the detected implementation at the same degree.
+fn bench_blake2b_many_8x(b: &mut Bencher, len: usize, force: fn(&mut blake2b_simd::Params)) {
+    let mut inputs: Vec<RandomInput> = (0..8).map(|_| RandomInput::new(b, len)).collect();
+    let mut params = blake2b_simd::Params::new();
+    force(&mut params);
+    b.iter(|| {
+        let mut jobs: Vec<_> = inputs
+            .iter_mut()
+            .map(|input| blake2b_simd::many::HashManyJob::new(&params, input.get()))
+            .collect();
+        blake2b_simd::many::hash_many(jobs.iter_mut());
+        jobs.iter().map(|job| job.to_hash()).collect::<Vec<_>>()
+    });
+}
+
+#[bench]
+fn bench_long_blake2b_many_8x(b: &mut Bencher) {
+    bench_blake2b_many_8x(b, LONG, |_| {});
+}
+
+#[bench]
+fn bench_long_blake2b_many_8x_avx2_interleaved(b: &mut Bencher) {
+    bench_blake2b_many_8x(b, LONG, blake2b_simd::benchmarks::force_avx2_interleaved);
+}
+
+// Hybrid AVX2 is for batches with one job more than AVX2's degree, which
+// would otherwise finish with a serial straggler.
+fn bench_blake2b_many_5x(b: &mut Bencher, len: usize, force: fn(&mut blake2b_simd::Params)) {
+    let mut inputs: Vec<RandomInput> = (0..5).map(|_| RandomInput::new(b, len)).collect();
+    let mut params = blake2b_simd::Params::new();
+    force(&mut params);
+    b.iter(|| {
+        let mut jobs: Vec<_> = inputs
+            .iter_mut()
+            .map(|input| blake2b_simd::many::HashManyJob::new(&params, input.get()))
+            .collect();
+        blake2b_simd::many::hash_many(jobs.iter_mut());
+        jobs.iter().map(|job| job.to_hash()).collect::<Vec<_>>()
+    });
+}
+
+#[bench]
+fn bench_long_blake2b_many_5x(b: &mut Bencher) {
+    bench_blake2b_many_5x(b, LONG, |_| {});
+}
+
+#[bench]
+fn bench_long_blake2b_many_5x_avx2_hybrid(b: &mut Bencher) {
+    bench_blake2b_many_5x(b, LONG, blake2b_simd::benchmarks::force_avx2_hybrid);
+}
+
+#[bench]
+fn bench_oneblock_blake2b_many_5x(b: &mut Bencher) {
+    bench_blake2b_many_5x(b, blake2b_simd::BLOCKBYTES, |_| {});
+}
+
+#[bench]
+fn bench_oneblock_blake2b_many_5x_avx2_hybrid(b: &mut Bencher) {
+    bench_blake2b_many_5x(
+        b,
+        blake2b_simd::BLOCKBYTES,
+        blake2b_simd::benchmarks::force_avx2_hybrid,
+    );
+}
+
+fn bench_blake2s_many_16x(b: &mut Bencher, len: usize, force: fn(&mut blake2s_simd::Params)) {
+    let mut inputs: Vec<RandomInput> = (0..16).map(|_| RandomInput::new(b, len)).collect();
+    let mut params = blake2s_simd::Params::new();
+    force(&mut params);
+    b.iter(|| {
+        let mut jobs: Vec<_> = inputs
+            .iter_mut()
+            .map(|input| blake2s_simd::many::HashManyJob::new(&params, input.get()))
+            .collect();
+        blake2s_simd::many::hash_many(jobs.iter_mut());
+        jobs.iter().map(|job| job.to_hash()).collect::<Vec<_>>()
+    });
+}
+
+#[bench]
+fn bench_long_blake2s_many_16x(b: &mut Bencher) {
+    bench_blake2s_many_16x(b, LONG, |_| {});
+}
+
+#[bench]
+fn bench_long_blake2s_many_16x_avx2_interleaved(b: &mut Bencher) {
+    bench_blake2s_many_16x(b, LONG, blake2s_simd::benchmarks::force_avx2_interleaved);
+}
+
 #[bench]
 fn bench_oneblock_blake2b_many_2x(b: &mut Bencher) {
     let mut input0 = RandomInput::new(b, blake2b_simd::BLOCKBYTES);
@@ -288,6 +484,83 @@ fn bench_oneblock_blake2s_many_4x(b: &mut Bencher) {
     });
 }
 
+// Many short inputs with a short output, the case hash_many_truncated is for.
+// Compare it to hash_many followed by to_hash on the same inputs.
+const TRUNCATED_INPUTS: usize = 64;
+const TRUNCATED_LEN: usize = 32;
+const TRUNCATED_OUT: usize = 8;
+
+fn truncated_inputs(b: &mut Bencher) -> Vec<Vec<u8>> {
+    let mut inputs = vec![vec![0; TRUNCATED_LEN]; TRUNCATED_INPUTS];
+    for input in &mut inputs {
+        rand::thread_rng().fill_bytes(input);
+    }
+    b.bytes = (TRUNCATED_INPUTS * TRUNCATED_LEN) as u64;
+    inputs
+}
+
+#[bench]
+fn bench_short_blake2b_hash_many_to_hash(b: &mut Bencher) {
+    let inputs = truncated_inputs(b);
+    let mut params = blake2b_simd::Params::new();
+    params.hash_length(TRUNCATED_OUT);
+    let mut outputs = [[0; TRUNCATED_OUT]; TRUNCATED_INPUTS];
+    b.iter(|| {
+        let mut jobs: Vec<_> = inputs
+            .iter()
+            .map(|input| blake2b_simd::many::HashManyJob::new(&params, input))
+            .collect();
+        blake2b_simd::many::hash_many(jobs.iter_mut());
+        for (job, output) in jobs.iter().zip(outputs.iter_mut()) {
+            output.copy_from_slice(job.to_hash().as_bytes());
+        }
+        test::black_box(&outputs);
+    });
+}
+
+#[bench]
+fn bench_short_blake2b_hash_many_truncated(b: &mut Bencher) {
+    let inputs = truncated_inputs(b);
+    let mut params = blake2b_simd::Params::new();
+    params.hash_length(TRUNCATED_OUT);
+    let mut outputs = [[0; TRUNCATED_OUT]; TRUNCATED_INPUTS];
+    b.iter(|| {
+        blake2b_simd::many::hash_many_truncated(&params, &inputs, &mut outputs);
+        test::black_box(&outputs);
+    });
+}
+
+#[bench]
+fn bench_short_blake2s_hash_many_to_hash(b: &mut Bencher) {
+    let inputs = truncated_inputs(b);
+    let mut params = blake2s_simd::Params::new();
+    params.hash_length(TRUNCATED_OUT);
+    let mut outputs = [[0; TRUNCATED_OUT]; TRUNCATED_INPUTS];
+    b.iter(|| {
+        let mut jobs: Vec<_> = inputs
+            .iter()
+            .map(|input| blake2s_simd::many::HashManyJob::new(&params, input))
+            .collect();
+        blake2s_simd::many::hash_many(jobs.iter_mut());
+        for (job, output) in jobs.iter().zip(outputs.iter_mut()) {
+            output.copy_from_slice(job.to_hash().as_bytes());
+        }
+        test::black_box(&outputs);
+    });
+}
+
+#[bench]
+fn bench_short_blake2s_hash_many_truncated(b: &mut Bencher) {
+    let inputs = truncated_inputs(b);
+    let mut params = blake2s_simd::Params::new();
+    params.hash_length(TRUNCATED_OUT);
+    let mut outputs = [[0; TRUNCATED_OUT]; TRUNCATED_INPUTS];
+    b.iter(|| {
+        blake2s_simd::many::hash_many_truncated(&params, &inputs, &mut outputs);
+        test::black_box(&outputs);
+    });
+}
+
 #[bench]
 fn bench_oneblock_blake2s_many_8x(b: &mut Bencher) {
     let mut input0 = RandomInput::new(b, blake2s_simd::BLOCKBYTES);
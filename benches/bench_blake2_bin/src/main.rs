@@ -0,0 +1,345 @@
+//! Benchmarks for the `blake2` command line utility, compared against
+//! coreutils. This replaces the old `bench_blake2_bin.py` script, which only
+//! hashed a single warm 1 GB file and reported a mean.
+//!
+//! Reading files is a big part of what the command line utility does, so the
+//! state of the page cache matters as much as the hash function does. Each
+//! workload here runs in two modes:
+//!
+//! - warm: every input file is read once before each run, so the run hashes
+//!   from memory.
+//! - cold: every input file is dropped from the page cache with
+//!   `posix_fadvise(POSIX_FADV_DONTNEED)` before each run, so the run has to
+//!   go to the disk. This is only supported on Linux, and only on a real
+//!   disk: tmpfs pages have nowhere else to live, so the advice does nothing
+//!   there. The inputs go in a temporary directory under `--dir` (by default
+//!   the system temporary directory, which is often tmpfs), and cold runs are
+//!   skipped with a warning when that directory is on tmpfs.
+//!
+//! The workloads cover both a few large files, where throughput dominates,
+//! and many small files, where the per-file overhead dominates. Results are
+//! reported as the median over all runs, followed by the first to third
+//! quartile range in parentheses, both in bytes per second and in files per
+//! second. Runs that fail to spawn (for
+//! example because `b2sum` isn't installed) are skipped.
+//!
+//! Usage: `cargo run --release -- [--runs N] [--quick] [--warm-only] [--dir DIR]`
+
+use rand::RngCore;
+use std::env;
+use std::fs::File;
+use std::io::{self, prelude::*};
+use std::path::{Path, PathBuf};
+use std::process::{self, Command, Stdio};
+use std::time::Instant;
+
+const DEFAULT_RUNS: usize = 10;
+
+struct Workload {
+    name: &'static str,
+    file_size: usize,
+    file_count: usize,
+}
+
+static WORKLOADS: &[Workload] = &[
+    Workload {
+        name: "1 GB x 1",
+        file_size: 1_000_000_000,
+        file_count: 1,
+    },
+    Workload {
+        name: "100 MB x 10",
+        file_size: 100_000_000,
+        file_count: 10,
+    },
+    Workload {
+        name: "1 MB x 1000",
+        file_size: 1_000_000,
+        file_count: 1000,
+    },
+    Workload {
+        name: "4 KiB x 10000",
+        file_size: 4096,
+        file_count: 10_000,
+    },
+];
+
+// Much smaller workloads, for checking that the driver works.
+static QUICK_WORKLOADS: &[Workload] = &[
+    Workload {
+        name: "10 MB x 1",
+        file_size: 10_000_000,
+        file_count: 1,
+    },
+    Workload {
+        name: "4 KiB x 100",
+        file_size: 4096,
+        file_count: 100,
+    },
+];
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Cache {
+    Warm,
+    Cold,
+}
+
+impl Cache {
+    fn name(self) -> &'static str {
+        match self {
+            Cache::Warm => "warm",
+            Cache::Cold => "cold",
+        }
+    }
+}
+
+fn bin_root() -> PathBuf {
+    Path::new(env!("CARGO_MANIFEST_DIR")).join("../../blake2_bin")
+}
+
+fn build_blake2() -> PathBuf {
+    let status = Command::new(env!("CARGO"))
+        .args(&["build", "--release"])
+        .current_dir(bin_root())
+        .status()
+        .expect("spawn failed");
+    if !status.success() {
+        eprintln!("building blake2_bin failed");
+        process::exit(1);
+    }
+    // Respect CARGO_TARGET_DIR if the caller set it, like `cargo build` does.
+    let target_dir = env::var_os("CARGO_TARGET_DIR")
+        .map(PathBuf::from)
+        .unwrap_or_else(|| bin_root().join("target"));
+    target_dir.join("release/blake2")
+}
+
+struct Target {
+    name: String,
+    command: Vec<String>,
+}
+
+fn targets(blake2: &Path) -> Vec<Target> {
+    let mut targets = Vec::new();
+    for &program in &["b2sum", "sha256sum"] {
+        targets.push(Target {
+            name: program.to_string(),
+            command: vec![program.to_string()],
+        });
+    }
+    let modes: &[&[&str]] = &[
+        &["-b"],
+        &["-s"],
+        &["-bp"],
+        &["-sp"],
+        &["-b", "--mmap"],
+        &["-bp", "--mmap"],
+        &["-b", "--direct"],
+        &["-bp", "--direct"],
+    ];
+    for mode in modes {
+        let mut command = vec![blake2.to_string_lossy().into_owned()];
+        command.extend(mode.iter().map(|s| s.to_string()));
+        targets.push(Target {
+            name: format!("blake2 {}", mode.join(" ")),
+            command,
+        });
+    }
+    targets
+}
+
+fn generate_files(dir: &Path, workload: &Workload) -> io::Result<Vec<PathBuf>> {
+    let mut rng = rand::thread_rng();
+    let mut buf = vec![0; std::cmp::min(workload.file_size, 1 << 20)];
+    let mut paths = Vec::with_capacity(workload.file_count);
+    for i in 0..workload.file_count {
+        let path = dir.join(format!("input{}", i));
+        let mut file = File::create(&path)?;
+        let mut remaining = workload.file_size;
+        while remaining > 0 {
+            let n = std::cmp::min(remaining, buf.len());
+            rng.fill_bytes(&mut buf[..n]);
+            file.write_all(&buf[..n])?;
+            remaining -= n;
+        }
+        // Dirty pages can't be dropped from the cache, so get them written out
+        // now rather than in the middle of a cold run.
+        file.sync_all()?;
+        paths.push(path);
+    }
+    Ok(paths)
+}
+
+fn warm_cache(paths: &[PathBuf]) -> io::Result<()> {
+    let mut buf = vec![0; 1 << 20];
+    for path in paths {
+        let mut file = File::open(path)?;
+        while file.read(&mut buf)? > 0 {}
+    }
+    Ok(())
+}
+
+#[cfg(target_os = "linux")]
+fn drop_cache(paths: &[PathBuf]) -> io::Result<()> {
+    use std::os::unix::io::AsRawFd;
+    for path in paths {
+        let file = File::open(path)?;
+        let ret = unsafe { libc::posix_fadvise(file.as_raw_fd(), 0, 0, libc::POSIX_FADV_DONTNEED) };
+        if ret != 0 {
+            return Err(io::Error::from_raw_os_error(ret));
+        }
+    }
+    Ok(())
+}
+
+// Dropping tmpfs pages from the page cache is a no-op, so cold runs there
+// would really be warm.
+#[cfg(target_os = "linux")]
+fn is_tmpfs(dir: &Path) -> io::Result<bool> {
+    use std::ffi::CString;
+    use std::os::unix::ffi::OsStrExt;
+    let path = CString::new(dir.as_os_str().as_bytes())?;
+    let mut stat: libc::statfs = unsafe { std::mem::zeroed() };
+    if unsafe { libc::statfs(path.as_ptr(), &mut stat) } != 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(stat.f_type == libc::TMPFS_MAGIC)
+}
+
+#[cfg(not(target_os = "linux"))]
+fn is_tmpfs(_dir: &Path) -> io::Result<bool> {
+    Ok(false)
+}
+
+#[cfg(not(target_os = "linux"))]
+fn drop_cache(_paths: &[PathBuf]) -> io::Result<()> {
+    Err(io::Error::new(
+        io::ErrorKind::Other,
+        "dropping the page cache is only supported on Linux",
+    ))
+}
+
+// Time one run of the target over all the files, or None if it can't run.
+fn run_once(target: &Target, paths: &[PathBuf]) -> Option<f64> {
+    let start = Instant::now();
+    let status = Command::new(&target.command[0])
+        .args(&target.command[1..])
+        .args(paths)
+        .stdin(Stdio::null())
+        .stdout(Stdio::null())
+        .status()
+        .ok()?;
+    let elapsed = start.elapsed().as_secs_f64();
+    if status.success() {
+        Some(elapsed)
+    } else {
+        None
+    }
+}
+
+// Linear interpolation between the closest ranks. `sorted` must be non-empty.
+fn percentile(sorted: &[f64], p: f64) -> f64 {
+    let rank = p * (sorted.len() - 1) as f64;
+    let low = rank.floor() as usize;
+    let high = rank.ceil() as usize;
+    sorted[low] + (sorted[high] - sorted[low]) * (rank - low as f64)
+}
+
+struct Summary {
+    median: f64,
+    q1: f64,
+    q3: f64,
+}
+
+fn summarize(mut samples: Vec<f64>) -> Summary {
+    samples.sort_by(|a, b| a.partial_cmp(b).unwrap());
+    Summary {
+        median: percentile(&samples, 0.5),
+        q1: percentile(&samples, 0.25),
+        q3: percentile(&samples, 0.75),
+    }
+}
+
+fn bench_target(
+    target: &Target,
+    workload: &Workload,
+    paths: &[PathBuf],
+    cache: Cache,
+    runs: usize,
+) -> Option<(Summary, Summary)> {
+    let total_bytes = (workload.file_size * workload.file_count) as f64;
+    let mut bytes_per_sec = Vec::with_capacity(runs);
+    let mut files_per_sec = Vec::with_capacity(runs);
+    for _ in 0..runs {
+        match cache {
+            Cache::Warm => warm_cache(paths).expect("warming the cache failed"),
+            Cache::Cold => drop_cache(paths).expect("dropping the cache failed"),
+        }
+        let secs = run_once(target, paths)?;
+        bytes_per_sec.push(total_bytes / secs);
+        files_per_sec.push(workload.file_count as f64 / secs);
+    }
+    Some((summarize(bytes_per_sec), summarize(files_per_sec)))
+}
+
+fn main() {
+    let mut runs = DEFAULT_RUNS;
+    let mut workloads = WORKLOADS;
+    let mut dir = env::temp_dir();
+    let mut caches = vec![Cache::Warm];
+    if cfg!(target_os = "linux") {
+        caches.push(Cache::Cold);
+    }
+    let mut args = env::args().skip(1);
+    while let Some(arg) = args.next() {
+        match &*arg {
+            "--runs" => {
+                runs = args
+                    .next()
+                    .and_then(|n| n.parse().ok())
+                    .filter(|&n| n > 0)
+                    .expect("--runs needs a positive number");
+            }
+            "--quick" => workloads = QUICK_WORKLOADS,
+            "--warm-only" => caches = vec![Cache::Warm],
+            "--dir" => dir = args.next().expect("--dir needs a directory").into(),
+            _ => {
+                eprintln!("usage: bench_blake2_bin [--runs N] [--quick] [--warm-only] [--dir DIR]");
+                process::exit(1);
+            }
+        }
+    }
+    if caches.contains(&Cache::Cold) && is_tmpfs(&dir).expect("statfs failed") {
+        eprintln!(
+            "warning: {} is on tmpfs, where the page cache can't be dropped; \
+             skipping cold runs (use --dir to pick a directory on a real disk)",
+            dir.display(),
+        );
+        caches.retain(|&cache| cache != Cache::Cold);
+    }
+
+    let blake2 = build_blake2();
+    let targets = targets(&blake2);
+    for workload in workloads {
+        let tempdir = tempfile::tempdir_in(&dir).expect("tempdir failed");
+        let paths = generate_files(tempdir.path(), workload).expect("generating inputs failed");
+        for &cache in &caches {
+            println!("--- {} ({}) ---", workload.name, cache.name());
+            for target in &targets {
+                match bench_target(target, workload, &paths, cache, runs) {
+                    Some((bytes, files)) => println!(
+                        "{:<22} {:>9.1} MB/s ({:.1}-{:.1})  {:>10.1} files/s ({:.1}-{:.1})",
+                        target.name,
+                        bytes.median / 1e6,
+                        bytes.q1 / 1e6,
+                        bytes.q3 / 1e6,
+                        files.median,
+                        files.q1,
+                        files.q3,
+                    ),
+                    None => println!("{:<22} (failed to run, skipped)", target.name),
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,453 @@
+//! Searches for performance cliffs: combinations of input length, buffer
+//! offset, and `update` chunk size where hashing is unexpectedly slow. These
+//! have bitten us before:
+//!
+//! - lengths just past a block boundary, or for BLAKE2bp/BLAKE2sp, just past
+//!   the point where every leaf gets another block;
+//! - the offset of the input in memory, which has a 512-byte period for
+//!   BLAKE2bp (see https://github.com/oconnor663/blake2b_simd/issues/8);
+//! - `update` chunk sizes that don't line up with blocks, which send input
+//!   through the `fill_buf` copy and the `compress_buffer_if_possible` path.
+//!
+//! For each State type (BLAKE2b, BLAKE2bp, BLAKE2s, BLAKE2sp) and each
+//! implementation (portable, SSE4.1, and whatever gets detected), this
+//! measures a grid of configurations around the block boundaries, plus a
+//! seeded random sample of the whole space. Each measurement is the fastest
+//! of several samples.
+//!
+//! Longer inputs naturally take longer, so configurations are compared by
+//! their time per compression, where the number of compressions comes from
+//! the input length (counting every leaf and the root for the parallel
+//! variants). The report lists the configurations with the highest cost
+//! relative to the median for each target. The "vs aligned" column compares
+//! each one to the same length hashed at offset 0 with a single `update`
+//! call, which shows whether the offset and the chunk size are to blame, or
+//! the length itself.
+//!
+//! Usage: `cargo run --release -- [--seed N] [--random N] [--max-len N]
+//! [--top N] [--samples N] [filter]`, where `filter` is a substring of the
+//! target names to run, like "BLAKE2bp".
+
+use std::env;
+use std::process;
+use std::time::Instant;
+
+// 512 is the measured period of the offset effect in BLAKE2bp.
+const OFFSET_PERIOD: usize = 512;
+
+// Each sample does about this many compressions, so that short inputs are
+// repeated enough to be measurable and long ones don't take forever.
+const COMPRESSIONS_PER_SAMPLE: usize = 2000;
+
+const DEFAULT_SAMPLES: usize = 5;
+const DEFAULT_RANDOM: usize = 200;
+const DEFAULT_MAX_LEN: usize = 16 * 1024;
+const DEFAULT_TOP: usize = 10;
+
+#[derive(Clone, Copy)]
+enum Kind {
+    Blake2b,
+    Blake2bp,
+    Blake2s,
+    Blake2sp,
+}
+
+impl Kind {
+    fn block_len(self) -> usize {
+        match self {
+            Kind::Blake2b | Kind::Blake2bp => blake2b_simd::BLOCKBYTES,
+            Kind::Blake2s | Kind::Blake2sp => blake2s_simd::BLOCKBYTES,
+        }
+    }
+
+    fn degree(self) -> usize {
+        match self {
+            Kind::Blake2b | Kind::Blake2s => 1,
+            Kind::Blake2bp => 4,
+            Kind::Blake2sp => 8,
+        }
+    }
+
+    // The input that gives every leaf one more block.
+    fn unit(self) -> usize {
+        self.degree() * self.block_len()
+    }
+
+    fn compressions(self, len: usize) -> usize {
+        let blocks = |n: usize| std::cmp::max(1, (n + self.block_len() - 1) / self.block_len());
+        match self {
+            Kind::Blake2b | Kind::Blake2s => blocks(len),
+            Kind::Blake2bp | Kind::Blake2sp => {
+                let rounds = len / self.unit();
+                let rem = len % self.unit();
+                let leaves: usize = (0..self.degree())
+                    .map(|i| {
+                        let extra = rem.saturating_sub(i * self.block_len());
+                        blocks(rounds * self.block_len() + std::cmp::min(extra, self.block_len()))
+                    })
+                    .sum();
+                // The root hashes one full-length output from each leaf.
+                let out_len = match self {
+                    Kind::Blake2bp => blake2b_simd::OUTBYTES,
+                    _ => blake2s_simd::OUTBYTES,
+                };
+                leaves + blocks(self.degree() * out_len)
+            }
+        }
+    }
+}
+
+enum Hasher {
+    Blake2b(blake2b_simd::Params),
+    Blake2bp(blake2b_simd::blake2bp::Params),
+    Blake2s(blake2s_simd::Params),
+    Blake2sp(blake2s_simd::blake2sp::Params),
+}
+
+// Hash the input with one `update` call, or in chunks of `split` bytes.
+macro_rules! hash_split {
+    ($params:expr, $input:expr, $split:expr) => {{
+        let mut state = $params.to_state();
+        if $split == 0 {
+            state.update($input);
+        } else {
+            for chunk in $input.chunks($split) {
+                state.update(chunk);
+            }
+        }
+        state.finalize().as_bytes()[0]
+    }};
+}
+
+impl Hasher {
+    fn hash(&self, input: &[u8], split: usize) -> u8 {
+        match self {
+            Hasher::Blake2b(p) => hash_split!(p, input, split),
+            Hasher::Blake2bp(p) => hash_split!(p, input, split),
+            Hasher::Blake2s(p) => hash_split!(p, input, split),
+            Hasher::Blake2sp(p) => hash_split!(p, input, split),
+        }
+    }
+}
+
+struct Target {
+    name: String,
+    kind: Kind,
+    hasher: Hasher,
+}
+
+fn targets() -> Vec<Target> {
+    let mut impls = vec!["portable"];
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    {
+        if is_x86_feature_detected!("sse4.1") {
+            impls.push("sse41");
+        }
+    }
+    impls.push("detected");
+
+    let mut targets = Vec::new();
+    for &imp in &impls {
+        let mut b = blake2b_simd::Params::new();
+        let mut bp = blake2b_simd::blake2bp::Params::new();
+        let mut s = blake2s_simd::Params::new();
+        let mut sp = blake2s_simd::blake2sp::Params::new();
+        match imp {
+            "portable" => {
+                blake2b_simd::benchmarks::force_portable(&mut b);
+                blake2b_simd::benchmarks::force_portable_blake2bp(&mut bp);
+                blake2s_simd::benchmarks::force_portable(&mut s);
+                blake2s_simd::benchmarks::force_portable_blake2sp(&mut sp);
+            }
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            "sse41" => {
+                blake2b_simd::benchmarks::force_sse41(&mut b);
+                blake2b_simd::benchmarks::force_sse41_blake2bp(&mut bp);
+                blake2s_simd::benchmarks::force_sse41(&mut s);
+                blake2s_simd::benchmarks::force_sse41_blake2sp(&mut sp);
+            }
+            _ => {}
+        }
+        let mut push = |name: &str, kind, hasher| {
+            targets.push(Target {
+                name: format!("{} {}", name, imp),
+                kind,
+                hasher,
+            })
+        };
+        push("BLAKE2b", Kind::Blake2b, Hasher::Blake2b(b));
+        push("BLAKE2bp", Kind::Blake2bp, Hasher::Blake2bp(bp));
+        push("BLAKE2s", Kind::Blake2s, Hasher::Blake2s(s));
+        push("BLAKE2sp", Kind::Blake2sp, Hasher::Blake2sp(sp));
+    }
+    targets
+}
+
+// xorshift64*, so that a seed always gives the same configurations.
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_f491_4f6c_dd1d)
+    }
+
+    // Uniform enough in [low, high] for our purposes.
+    fn range(&mut self, low: usize, high: usize) -> usize {
+        low + (self.next() % (high - low + 1) as u64) as usize
+    }
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+struct Config {
+    len: usize,
+    offset: usize,
+    // Zero means a single update call.
+    split: usize,
+}
+
+fn grid(kind: Kind, max_len: usize) -> Vec<Config> {
+    let block = kind.block_len();
+    let unit = kind.unit();
+    let mut lens = vec![0, 1];
+    for &m in &[1, 2, 3, 4, 5, 8, 16, 32, 64, 128] {
+        let base = m * unit;
+        lens.extend_from_slice(&[base - 1, base, base + 1]);
+        if kind.degree() > 1 {
+            // The last leaf's block in each round.
+            let tail = base + (kind.degree() - 1) * block;
+            lens.extend_from_slice(&[tail, tail + 1]);
+        }
+    }
+    lens.retain(|&len| len <= max_len);
+    let offsets = [0, 1, 8, 63, 64, 256, 511];
+    let splits = [
+        0,
+        33,
+        block - 1,
+        block + 1,
+        2 * block + 1,
+        unit + 1,
+        1000,
+        4096,
+        4097,
+    ];
+    let mut configs = Vec::new();
+    for &len in &lens {
+        for &offset in &offsets {
+            for &split in &splits {
+                if split < len {
+                    configs.push(Config { len, offset, split });
+                }
+            }
+        }
+    }
+    configs
+}
+
+fn random_configs(kind: Kind, max_len: usize, count: usize, rng: &mut Rng) -> Vec<Config> {
+    let block = kind.block_len();
+    let max_bits = (usize::BITS - max_len.leading_zeros()) as usize;
+    (0..count)
+        .map(|_| {
+            // Log-uniform lengths, half of them snapped next to a block boundary.
+            let bits = rng.range(0, max_bits);
+            let mut len = rng.range(0, (1 << bits) - 1);
+            if rng.next() % 2 == 0 {
+                len = (len / block * block + rng.range(0, 2)).saturating_sub(1);
+            }
+            let len = std::cmp::min(len, max_len);
+            let offset = rng.range(0, OFFSET_PERIOD - 1);
+            let split = if rng.next() % 4 == 0 || len <= 16 {
+                0
+            } else {
+                rng.range(16, std::cmp::min(len - 1, 2 * kind.unit() + 2))
+            };
+            Config { len, offset, split }
+        })
+        .collect()
+}
+
+// Input with room for every offset. Offset 0 is aligned to OFFSET_PERIOD in
+// the address space.
+struct Input {
+    buf: Vec<u8>,
+    base: usize,
+}
+
+impl Input {
+    fn new(max_len: usize, rng: &mut Rng) -> Self {
+        let buf: Vec<u8> = (0..max_len + 2 * OFFSET_PERIOD)
+            .map(|_| rng.next() as u8)
+            .collect();
+        let base = OFFSET_PERIOD - (buf.as_ptr() as usize % OFFSET_PERIOD);
+        Self { buf, base }
+    }
+
+    fn get(&self, config: Config) -> &[u8] {
+        &self.buf[self.base + config.offset..][..config.len]
+    }
+}
+
+// The fastest of `samples` runs, in nanoseconds per hash.
+fn measure(target: &Target, input: &Input, config: Config, samples: usize) -> f64 {
+    let iterations = std::cmp::max(
+        1,
+        COMPRESSIONS_PER_SAMPLE / target.kind.compressions(config.len),
+    );
+    let input = input.get(config);
+    let mut sink = 0;
+    let mut best = f64::INFINITY;
+    // One untimed run to warm up.
+    for sample in 0..=samples {
+        let start = Instant::now();
+        for _ in 0..iterations {
+            sink ^= target
+                .hasher
+                .hash(std::hint::black_box(input), config.split);
+        }
+        let ns = start.elapsed().as_nanos() as f64 / iterations as f64;
+        if sample > 0 && ns < best {
+            best = ns;
+        }
+    }
+    std::hint::black_box(sink);
+    best
+}
+
+fn median(values: &mut [f64]) -> f64 {
+    values.sort_by(|a, b| a.partial_cmp(b).unwrap());
+    values[values.len() / 2]
+}
+
+struct Options {
+    seed: u64,
+    random: usize,
+    max_len: usize,
+    top: usize,
+    samples: usize,
+    filter: Option<String>,
+}
+
+fn usage() -> ! {
+    eprintln!(
+        "usage: bench_cliffs [--seed N] [--random N] [--max-len N] [--top N] [--samples N] [filter]"
+    );
+    process::exit(1);
+}
+
+fn parse_args() -> Options {
+    let mut options = Options {
+        seed: 1,
+        random: DEFAULT_RANDOM,
+        max_len: DEFAULT_MAX_LEN,
+        top: DEFAULT_TOP,
+        samples: DEFAULT_SAMPLES,
+        filter: None,
+    };
+    let mut args = env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut number = || -> u64 {
+            args.next()
+                .and_then(|n| n.parse().ok())
+                .unwrap_or_else(|| usage())
+        };
+        match &*arg {
+            "--seed" => options.seed = number(),
+            "--random" => options.random = number() as usize,
+            "--max-len" => options.max_len = number() as usize,
+            "--top" => options.top = number() as usize,
+            "--samples" => options.samples = std::cmp::max(1, number() as usize),
+            _ if !arg.starts_with('-') && options.filter.is_none() => options.filter = Some(arg),
+            _ => usage(),
+        }
+    }
+    if options.max_len == 0 || options.seed == 0 {
+        usage();
+    }
+    options
+}
+
+fn main() {
+    let options = parse_args();
+    let mut rng = Rng(options.seed);
+    let input = Input::new(options.max_len, &mut rng);
+
+    for target in targets() {
+        if let Some(filter) = &options.filter {
+            if !target.name.contains(&**filter) {
+                continue;
+            }
+        }
+        let kind = target.kind;
+        let mut configs = grid(kind, options.max_len);
+        configs.extend(random_configs(
+            kind,
+            options.max_len,
+            options.random,
+            &mut rng,
+        ));
+        // Every length also gets the aligned, single-update baseline.
+        let baselines: Vec<Config> = configs
+            .iter()
+            .map(|c| Config {
+                len: c.len,
+                offset: 0,
+                split: 0,
+            })
+            .collect();
+        configs.extend(baselines);
+        configs.sort();
+        configs.dedup();
+
+        let results: Vec<(Config, f64)> = configs
+            .iter()
+            .map(|&config| (config, measure(&target, &input, config, options.samples)))
+            .collect();
+        let per_compression =
+            |&(config, ns): &(Config, f64)| ns / kind.compressions(config.len) as f64;
+        let mut costs: Vec<f64> = results.iter().map(per_compression).collect();
+        let median_cost = median(&mut costs);
+        let baseline = |len| {
+            results
+                .iter()
+                .find(|(c, _)| c.len == len && c.offset == 0 && c.split == 0)
+                .unwrap()
+                .1
+        };
+
+        let mut ranked: Vec<&(Config, f64)> = results.iter().collect();
+        ranked.sort_by(|a, b| per_compression(b).partial_cmp(&per_compression(a)).unwrap());
+        println!(
+            "--- {} (median {:.1} ns/compression over {} configurations) ---",
+            target.name,
+            median_cost,
+            results.len(),
+        );
+        println!(
+            "{:>7} {:>7} {:>7} {:>11} {:>9} {:>10} {:>11}",
+            "len", "offset", "split", "ns/hash", "ns/comp", "vs median", "vs aligned",
+        );
+        for result in ranked.iter().take(options.top) {
+            let (config, ns) = **result;
+            let split = if config.split == 0 {
+                "-".to_string()
+            } else {
+                config.split.to_string()
+            };
+            println!(
+                "{:>7} {:>7} {:>7} {:>11.1} {:>9.1} {:>9.2}x {:>10.2}x",
+                config.len,
+                config.offset,
+                split,
+                ns,
+                per_compression(result),
+                per_compression(result) / median_cost,
+                ns / baseline(config.len),
+            );
+        }
+        println!();
+    }
+}
@@ -0,0 +1,425 @@
+//! Deterministic benchmarks that count instructions and cache accesses under
+//! Cachegrind, in the style of the `iai` crate. Wall-clock benchmarks on
+//! shared VMs vary by several percent from run to run, which hides small
+//! regressions. Instruction counts from a simulated cache don't depend on
+//! noisy neighbors, so a 1% change in a compression function shows up as a
+//! 1% change here on any machine.
+//!
+//! Each benchmark runs once in a child process under
+//! `valgrind --tool=cachegrind`, with a fixed cache geometry so that results
+//! don't depend on the host's caches either. A second child does the same
+//! setup without hashing, and its counts are subtracted, so the numbers cover
+//! only the hashing itself. Estimated cycles use the same model as `iai`:
+//! one cycle per L1 hit, 5 per last-level hit, and 35 per RAM access.
+//!
+//! The results of each run are saved under `target/bench_iai`, and the next
+//! run reports the change from them.
+//!
+//! Usage: `cargo run --release -- [filter]`, where `filter` is a substring of
+//! the benchmark names to run, like "blake2bp". Valgrind must be installed.
+//! Benchmarks for SSE4.1 and AVX2 are skipped on machines without them.
+
+use std::collections::HashMap;
+use std::env;
+use std::fs;
+use std::hint::black_box;
+use std::path::PathBuf;
+use std::process::{self, Command};
+
+const LONG: usize = 16 * 1024;
+
+// Roughly a current x86 core. What matters is that it's the same everywhere.
+const CACHE_ARGS: &[&str] = &["--I1=32768,8,64", "--D1=32768,8,64", "--LL=8388608,16,64"];
+
+#[derive(Clone, Copy, PartialEq)]
+enum Imp {
+    Portable,
+    Sse41,
+    Avx2,
+}
+
+impl Imp {
+    fn name(self) -> &'static str {
+        match self {
+            Imp::Portable => "portable",
+            Imp::Sse41 => "sse41",
+            Imp::Avx2 => "avx2",
+        }
+    }
+
+    fn supported(self) -> bool {
+        match self {
+            Imp::Portable => true,
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Sse41 => is_x86_feature_detected!("sse4.1"),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Avx2 => is_x86_feature_detected!("avx2"),
+            #[cfg(not(any(target_arch = "x86", target_arch = "x86_64")))]
+            _ => false,
+        }
+    }
+
+    fn blake2b(self) -> blake2b_simd::Params {
+        let mut params = blake2b_simd::Params::new();
+        match self {
+            Imp::Portable => blake2b_simd::benchmarks::force_portable(&mut params),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Sse41 => blake2b_simd::benchmarks::force_sse41(&mut params),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Avx2 => blake2b_simd::benchmarks::force_avx2(&mut params),
+            #[cfg(not(any(target_arch = "x86", target_arch = "x86_64")))]
+            _ => unreachable!(),
+        }
+        params
+    }
+
+    fn blake2bp(self) -> blake2b_simd::blake2bp::Params {
+        let mut params = blake2b_simd::blake2bp::Params::new();
+        match self {
+            Imp::Portable => blake2b_simd::benchmarks::force_portable_blake2bp(&mut params),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Sse41 => blake2b_simd::benchmarks::force_sse41_blake2bp(&mut params),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Avx2 => blake2b_simd::benchmarks::force_avx2_blake2bp(&mut params),
+            #[cfg(not(any(target_arch = "x86", target_arch = "x86_64")))]
+            _ => unreachable!(),
+        }
+        params
+    }
+
+    fn blake2s(self) -> blake2s_simd::Params {
+        let mut params = blake2s_simd::Params::new();
+        match self {
+            Imp::Portable => blake2s_simd::benchmarks::force_portable(&mut params),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Sse41 => blake2s_simd::benchmarks::force_sse41(&mut params),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Avx2 => blake2s_simd::benchmarks::force_avx2(&mut params),
+            #[cfg(not(any(target_arch = "x86", target_arch = "x86_64")))]
+            _ => unreachable!(),
+        }
+        params
+    }
+
+    fn blake2sp(self) -> blake2s_simd::blake2sp::Params {
+        let mut params = blake2s_simd::blake2sp::Params::new();
+        match self {
+            Imp::Portable => blake2s_simd::benchmarks::force_portable_blake2sp(&mut params),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Sse41 => blake2s_simd::benchmarks::force_sse41_blake2sp(&mut params),
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Imp::Avx2 => blake2s_simd::benchmarks::force_avx2_blake2sp(&mut params),
+            #[cfg(not(any(target_arch = "x86", target_arch = "x86_64")))]
+            _ => unreachable!(),
+        }
+        params
+    }
+}
+
+const IMPS: &[Imp] = &[Imp::Portable, Imp::Sse41, Imp::Avx2];
+
+#[derive(Clone, Copy)]
+enum Algo {
+    // One hash of this many bytes.
+    Blake2b(usize),
+    Blake2bp(usize),
+    Blake2s(usize),
+    Blake2sp(usize),
+    // hash_many over this many inputs of LONG bytes each, which exercises the
+    // compress4_loop and compress8_loop kernels.
+    Blake2bMany(usize),
+    Blake2sMany(usize),
+}
+
+const ALGOS: &[(&str, Algo)] = &[
+    ("blake2b_block", Algo::Blake2b(blake2b_simd::BLOCKBYTES)),
+    ("blake2b_16k", Algo::Blake2b(LONG)),
+    ("blake2bp_16k", Algo::Blake2bp(LONG)),
+    ("blake2b_many4_16k", Algo::Blake2bMany(4)),
+    ("blake2s_block", Algo::Blake2s(blake2s_simd::BLOCKBYTES)),
+    ("blake2s_16k", Algo::Blake2s(LONG)),
+    ("blake2sp_16k", Algo::Blake2sp(LONG)),
+    ("blake2s_many8_16k", Algo::Blake2sMany(8)),
+];
+
+struct Bench {
+    name: String,
+    algo: Algo,
+    imp: Imp,
+}
+
+fn benches() -> Vec<Bench> {
+    let mut benches = Vec::new();
+    for &(algo_name, algo) in ALGOS {
+        for &imp in IMPS {
+            benches.push(Bench {
+                name: format!("{}_{}", algo_name, imp.name()),
+                algo,
+                imp,
+            });
+        }
+    }
+    benches
+}
+
+fn input(len: usize) -> Vec<u8> {
+    (0..len).map(|i| (i % 251) as u8).collect()
+}
+
+// Do the setup for a benchmark, and then the hashing unless this is the
+// calibration run. This runs in the child process, under Cachegrind.
+fn run(bench: &Bench, calibrate: bool) {
+    match bench.algo {
+        Algo::Blake2b(len) => {
+            let params = bench.imp.blake2b();
+            let input = input(len);
+            if !calibrate {
+                black_box(params.hash(black_box(&input)));
+            }
+            black_box((&params, &input));
+        }
+        Algo::Blake2bp(len) => {
+            let params = bench.imp.blake2bp();
+            let input = input(len);
+            if !calibrate {
+                black_box(params.hash(black_box(&input)));
+            }
+            black_box((&params, &input));
+        }
+        Algo::Blake2s(len) => {
+            let params = bench.imp.blake2s();
+            let input = input(len);
+            if !calibrate {
+                black_box(params.hash(black_box(&input)));
+            }
+            black_box((&params, &input));
+        }
+        Algo::Blake2sp(len) => {
+            let params = bench.imp.blake2sp();
+            let input = input(len);
+            if !calibrate {
+                black_box(params.hash(black_box(&input)));
+            }
+            black_box((&params, &input));
+        }
+        Algo::Blake2bMany(count) => {
+            let params = bench.imp.blake2b();
+            let inputs: Vec<Vec<u8>> = (0..count).map(|_| input(LONG)).collect();
+            let mut jobs: Vec<_> = inputs
+                .iter()
+                .map(|input| blake2b_simd::many::HashManyJob::new(&params, black_box(input)))
+                .collect();
+            if !calibrate {
+                blake2b_simd::many::hash_many(jobs.iter_mut());
+            }
+            black_box(&jobs);
+        }
+        Algo::Blake2sMany(count) => {
+            let params = bench.imp.blake2s();
+            let inputs: Vec<Vec<u8>> = (0..count).map(|_| input(LONG)).collect();
+            let mut jobs: Vec<_> = inputs
+                .iter()
+                .map(|input| blake2s_simd::many::HashManyJob::new(&params, black_box(input)))
+                .collect();
+            if !calibrate {
+                blake2s_simd::many::hash_many(jobs.iter_mut());
+            }
+            black_box(&jobs);
+        }
+    }
+}
+
+#[derive(Clone, Copy, Default)]
+struct Stats {
+    instructions: u64,
+    l1_accesses: u64,
+    ll_accesses: u64,
+    ram_accesses: u64,
+}
+
+impl Stats {
+    fn cycles(&self) -> u64 {
+        self.l1_accesses + 5 * self.ll_accesses + 35 * self.ram_accesses
+    }
+
+    fn minus(&self, other: &Stats) -> Stats {
+        Stats {
+            instructions: self.instructions.saturating_sub(other.instructions),
+            l1_accesses: self.l1_accesses.saturating_sub(other.l1_accesses),
+            ll_accesses: self.ll_accesses.saturating_sub(other.ll_accesses),
+            ram_accesses: self.ram_accesses.saturating_sub(other.ram_accesses),
+        }
+    }
+
+    fn fields(&self) -> [(&'static str, u64); 5] {
+        [
+            ("Instructions", self.instructions),
+            ("L1 Accesses", self.l1_accesses),
+            ("L2 Accesses", self.ll_accesses),
+            ("RAM Accesses", self.ram_accesses),
+            ("Estimated Cycles", self.cycles()),
+        ]
+    }
+}
+
+// Read the summary line of a Cachegrind output file. The event names come
+// from its "events:" line, and the L1 hits, LL hits, and RAM accesses are
+// worked out from the miss counts.
+fn parse_cachegrind(contents: &str) -> Result<Stats, String> {
+    let mut events = None;
+    let mut summary = None;
+    for line in contents.lines() {
+        if let Some(rest) = line.strip_prefix("events:") {
+            events = Some(rest.split_whitespace().collect::<Vec<_>>());
+        } else if let Some(rest) = line.strip_prefix("summary:") {
+            summary = Some(rest.split_whitespace().collect::<Vec<_>>());
+        }
+    }
+    let (events, summary) = match (events, summary) {
+        (Some(events), Some(summary)) => (events, summary),
+        _ => return Err("no events or summary in Cachegrind output".to_string()),
+    };
+    let mut counts = HashMap::new();
+    for (event, count) in events.iter().zip(&summary) {
+        let count: u64 = count
+            .parse()
+            .map_err(|_| format!("bad count {:?}", count))?;
+        counts.insert(*event, count);
+    }
+    let get = |event| {
+        counts
+            .get(event)
+            .copied()
+            .ok_or_else(|| format!("no {} in Cachegrind output; is --cache-sim on?", event))
+    };
+    let instructions = get("Ir")?;
+    let accesses = instructions + get("Dr")? + get("Dw")?;
+    let l1_misses = get("I1mr")? + get("D1mr")? + get("D1mw")?;
+    let ll_misses = get("ILmr")? + get("DLmr")? + get("DLmw")?;
+    Ok(Stats {
+        instructions,
+        l1_accesses: accesses - l1_misses,
+        ll_accesses: l1_misses - ll_misses,
+        ram_accesses: ll_misses,
+    })
+}
+
+fn results_dir() -> PathBuf {
+    let target = env::var_os("CARGO_TARGET_DIR").unwrap_or_else(|| "target".into());
+    PathBuf::from(target).join("bench_iai")
+}
+
+fn cachegrind(bench: &Bench, calibrate: bool) -> Result<Stats, String> {
+    let out_file = results_dir().join(format!(
+        "cachegrind.out.{}{}",
+        bench.name,
+        if calibrate { ".calibrate" } else { "" }
+    ));
+    let exe = env::current_exe().map_err(|e| e.to_string())?;
+    let status = Command::new("valgrind")
+        .arg("--tool=cachegrind")
+        .arg("--cache-sim=yes")
+        .args(CACHE_ARGS)
+        .arg(format!("--cachegrind-out-file={}", out_file.display()))
+        .arg(exe)
+        .arg(if calibrate { "--calibrate" } else { "--run" })
+        .arg(&bench.name)
+        .stderr(process::Stdio::null())
+        .status()
+        .map_err(|e| format!("failed to run valgrind: {}", e))?;
+    if !status.success() {
+        return Err(format!("valgrind failed: {}", status));
+    }
+    let contents = fs::read_to_string(&out_file).map_err(|e| e.to_string())?;
+    parse_cachegrind(&contents)
+}
+
+// Saved results are one line per benchmark: the name, then the counts.
+fn load_results(path: &PathBuf) -> HashMap<String, Stats> {
+    let mut results = HashMap::new();
+    let contents = fs::read_to_string(path).unwrap_or_default();
+    for line in contents.lines() {
+        let words: Vec<&str> = line.split_whitespace().collect();
+        let numbers: Vec<u64> = words
+            .iter()
+            .skip(1)
+            .filter_map(|w| w.parse().ok())
+            .collect();
+        if numbers.len() == 4 {
+            let stats = Stats {
+                instructions: numbers[0],
+                l1_accesses: numbers[1],
+                ll_accesses: numbers[2],
+                ram_accesses: numbers[3],
+            };
+            results.insert(words[0].to_string(), stats);
+        }
+    }
+    results
+}
+
+fn main() {
+    let args: Vec<String> = env::args().skip(1).collect();
+    let benches = benches();
+
+    // The child processes under Cachegrind.
+    if args.len() == 2 && (args[0] == "--run" || args[0] == "--calibrate") {
+        let bench = benches
+            .iter()
+            .find(|b| b.name == args[1])
+            .expect("no such benchmark");
+        run(bench, args[0] == "--calibrate");
+        return;
+    }
+    if args.len() > 1 || args.iter().any(|a| a.starts_with('-')) {
+        eprintln!("usage: bench_iai [filter]");
+        process::exit(1);
+    }
+    let filter = args.get(0).map(String::as_str).unwrap_or("");
+
+    fs::create_dir_all(results_dir()).expect("creating the results directory failed");
+    let results_path = results_dir().join("results");
+    let old_results = load_results(&results_path);
+    let mut new_results = old_results.clone();
+    for bench in benches.iter().filter(|b| b.name.contains(filter)) {
+        println!("{}", bench.name);
+        if !bench.imp.supported() {
+            println!("  (not supported on this machine, skipped)");
+            continue;
+        }
+        let stats = match (cachegrind(bench, false), cachegrind(bench, true)) {
+            (Ok(full), Ok(calibration)) => full.minus(&calibration),
+            (Err(e), _) | (_, Err(e)) => {
+                eprintln!("bench_iai: {}", e);
+                process::exit(1);
+            }
+        };
+        let old = old_results.get(&bench.name);
+        for (i, &(label, count)) in stats.fields().iter().enumerate() {
+            match old {
+                Some(old) if old.fields()[i].1 == count => {
+                    println!("  {:<18}{:>12} (no change)", label, count);
+                }
+                Some(old) => {
+                    let old_count = old.fields()[i].1;
+                    let change = (count as f64 - old_count as f64) / old_count as f64 * 100.0;
+                    println!("  {:<18}{:>12} ({:+.3}%)", label, count, change);
+                }
+                None => println!("  {:<18}{:>12}", label, count),
+            }
+        }
+        new_results.insert(bench.name.clone(), stats);
+    }
+
+    let mut lines: Vec<String> = new_results
+        .iter()
+        .map(|(name, s)| {
+            format!(
+                "{} {} {} {} {}\n",
+                name, s.instructions, s.l1_accesses, s.ll_accesses, s.ram_accesses
+            )
+        })
+        .collect();
+    lines.sort();
+    fs::write(&results_path, lines.concat()).expect("saving results failed");
+}
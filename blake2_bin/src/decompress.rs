@@ -0,0 +1,127 @@
+//! The --decompress mode, which hashes the decompressed contents of a gzip or
+//! zstd stream. This replaces something like `zstd -dc | blake2`, without the
+//! pipe, the second process, and the copies into and out of the kernel.
+//!
+//! A background thread runs the decoder, which writes straight into a ring of
+//! large buffers, and the main thread hashes each buffer in place as it
+//! arrives. The buffers cycle between the two threads over a pair of
+//! channels, like in direct.rs, so decompression and hashing overlap, and
+//! nothing is allocated or copied after startup.
+
+use std::cmp;
+use std::io;
+use std::io::prelude::*;
+use std::str::FromStr;
+use std::sync::mpsc;
+use std::thread;
+
+const BUFFER_SIZE: usize = 1 << 20; // 1 MiB
+const BUFFERS: usize = 4;
+
+#[derive(Clone, Copy, Debug, Eq, PartialEq)]
+pub enum Format {
+    Gzip,
+    Zstd,
+}
+
+impl FromStr for Format {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, String> {
+        match s {
+            "gzip" | "gz" => Ok(Format::Gzip),
+            "zstd" | "zst" => Ok(Format::Zstd),
+            _ => Err(format!("unknown format {:?}, expected gzip or zstd", s)),
+        }
+    }
+}
+
+fn decoder<'a>(
+    format: Format,
+    input: impl Read + Send + 'a,
+) -> io::Result<Box<dyn Read + Send + 'a>> {
+    Ok(match format {
+        // Concatenated gzip members are common, e.g. from appending to a log,
+        // and `gzip -dc` decodes all of them.
+        Format::Gzip => Box::new(flate2::read::MultiGzDecoder::new(input)),
+        Format::Zstd => Box::new(zstd::stream::read::Decoder::new(input)?),
+    })
+}
+
+// Fill as much of the buffer as possible. Decoders return short reads all the
+// time, so a short count here means EOF.
+fn read_full(reader: &mut dyn Read, buf: &mut [u8]) -> io::Result<usize> {
+    let mut filled = 0;
+    while filled < buf.len() {
+        match reader.read(&mut buf[filled..]) {
+            Ok(0) => break,
+            Ok(n) => filled += n,
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+            Err(e) => return Err(e),
+        }
+    }
+    Ok(filled)
+}
+
+fn decoder_loop(
+    reader: &mut dyn Read,
+    free: mpsc::Receiver<Vec<u8>>,
+    full: mpsc::SyncSender<io::Result<(Vec<u8>, usize)>>,
+) {
+    // If the main thread hangs up, recv fails and the loop ends.
+    for mut buf in free.iter() {
+        let result = read_full(reader, &mut buf);
+        let done = match result {
+            Ok(n) => n < BUFFER_SIZE,
+            Err(_) => true,
+        };
+        if full.send(result.map(|n| (buf, n))).is_err() || done {
+            return;
+        }
+    }
+}
+
+/// Decompress `input` and pass the decompressed bytes from `offset` up to
+/// `offset + len` (or to the end) to `f`, in order.
+pub fn read_range(
+    format: Format,
+    input: impl Read + Send,
+    offset: u64,
+    len: Option<u64>,
+    mut f: impl FnMut(&[u8]),
+) -> io::Result<()> {
+    let mut reader = decoder(format, input)?;
+    let mut skip = offset;
+    let mut remaining = len.unwrap_or(u64::MAX);
+
+    // Bounding the full channel by the number of buffers means the decoder
+    // never blocks on a send, so it always notices when we hang up.
+    let (free_sender, free_receiver) = mpsc::channel();
+    let (full_sender, full_receiver) = mpsc::sync_channel(BUFFERS);
+    for _ in 0..BUFFERS {
+        free_sender.send(vec![0; BUFFER_SIZE]).unwrap();
+    }
+
+    // Both closures move their channel ends, so returning from this one,
+    // including with an error, hangs up on the decoder if it's still going.
+    thread::scope(move |scope| {
+        scope.spawn(move || decoder_loop(&mut *reader, free_receiver, full_sender));
+        while remaining > 0 {
+            let (buf, n) = match full_receiver.recv() {
+                Ok(result) => result?,
+                // The decoder hit EOF and exited.
+                Err(_) => break,
+            };
+            let start = cmp::min(skip, n as u64) as usize;
+            skip -= start as u64;
+            let take = cmp::min((n - start) as u64, remaining) as usize;
+            f(&buf[start..][..take]);
+            remaining -= take as u64;
+            if n < BUFFER_SIZE {
+                break;
+            }
+            let _ = free_sender.send(buf);
+        }
+        Ok(())
+    })
+}
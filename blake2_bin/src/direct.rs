@@ -0,0 +1,162 @@
+//! Reading with O_DIRECT, which bypasses the page cache. This is for hashing
+//! block devices and very large files without evicting everything else that's
+//! cached. O_DIRECT requires the buffer address, the file offset, and the read
+//! length to all be aligned to the logical block size of the device, so reads
+//! here always start at an aligned offset, and the caller's range is trimmed
+//! out of the aligned buffers afterwards.
+//!
+//! A background thread keeps reads in flight while the main thread hashes.
+//! A fixed set of buffers cycles between the two threads over a pair of
+//! channels, so nothing is allocated or copied after startup.
+
+use std::alloc::{self, Layout};
+use std::cmp;
+use std::fs::{File, OpenOptions};
+use std::io;
+use std::ops::{Deref, DerefMut};
+use std::os::unix::fs::{FileExt, OpenOptionsExt};
+use std::path::Path;
+use std::ptr::NonNull;
+use std::slice;
+use std::sync::mpsc;
+use std::thread;
+
+// 4096 is a multiple of the logical block size of any common device.
+const ALIGNMENT: usize = 4096;
+const BUFFER_SIZE: usize = 1 << 20; // 1 MiB
+const BUFFERS: usize = 2;
+
+struct AlignedBuf {
+    ptr: NonNull<u8>,
+}
+
+// The buffer is uniquely owned, just like a Box<[u8]>.
+unsafe impl Send for AlignedBuf {}
+
+impl AlignedBuf {
+    fn layout() -> Layout {
+        Layout::from_size_align(BUFFER_SIZE, ALIGNMENT).unwrap()
+    }
+
+    fn new() -> Self {
+        let ptr = unsafe { alloc::alloc_zeroed(Self::layout()) };
+        match NonNull::new(ptr) {
+            Some(ptr) => Self { ptr },
+            None => alloc::handle_alloc_error(Self::layout()),
+        }
+    }
+}
+
+impl Drop for AlignedBuf {
+    fn drop(&mut self) {
+        unsafe { alloc::dealloc(self.ptr.as_ptr(), Self::layout()) }
+    }
+}
+
+impl Deref for AlignedBuf {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.ptr.as_ptr(), BUFFER_SIZE) }
+    }
+}
+
+impl DerefMut for AlignedBuf {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        unsafe { slice::from_raw_parts_mut(self.ptr.as_ptr(), BUFFER_SIZE) }
+    }
+}
+
+pub fn open(path: &Path) -> io::Result<File> {
+    OpenOptions::new()
+        .read(true)
+        .custom_flags(libc::O_DIRECT)
+        .open(path)
+}
+
+fn read_at_retrying(file: &File, buf: &mut [u8], position: u64) -> io::Result<usize> {
+    loop {
+        match file.read_at(buf, position) {
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+            result => return result,
+        }
+    }
+}
+
+// Read full buffers starting at the aligned position `start`, until EOF or
+// until `end` (if any) is covered. A short read means EOF, because O_DIRECT
+// reads can't resume from an unaligned position anyway.
+fn reader_loop(
+    file: &File,
+    start: u64,
+    end: Option<u64>,
+    free: mpsc::Receiver<AlignedBuf>,
+    full: mpsc::SyncSender<io::Result<(AlignedBuf, usize)>>,
+) {
+    let mut position = start;
+    // If the main thread hangs up, recv fails and the loop ends.
+    for mut buf in free.iter() {
+        if let Some(end) = end {
+            if position >= end {
+                return;
+            }
+        }
+        let result = read_at_retrying(file, &mut buf, position);
+        let done = match result {
+            Ok(n) => n < BUFFER_SIZE,
+            Err(_) => true,
+        };
+        if full.send(result.map(|n| (buf, n))).is_err() || done {
+            return;
+        }
+        position += BUFFER_SIZE as u64;
+    }
+}
+
+/// Pass the bytes of `file` from `offset` up to `offset + len` (or to EOF) to
+/// `f`, in order, reading them with O_DIRECT. The file must have been opened
+/// with [`open`].
+pub fn read_range(
+    file: &File,
+    offset: u64,
+    len: Option<u64>,
+    mut f: impl FnMut(&[u8]),
+) -> io::Result<()> {
+    let start = offset - offset % ALIGNMENT as u64;
+    let mut skip = (offset - start) as usize;
+    let mut remaining = len.unwrap_or(u64::MAX);
+    let end = len.map(|len| offset.saturating_add(len));
+
+    // Bounding the full channel by the number of buffers means the reader
+    // never blocks on a send, so it always notices when we hang up.
+    let (free_sender, free_receiver) = mpsc::channel();
+    let (full_sender, full_receiver) = mpsc::sync_channel(BUFFERS);
+    for _ in 0..BUFFERS {
+        free_sender.send(AlignedBuf::new()).unwrap();
+    }
+
+    // Both closures move their channel ends, so returning from this one,
+    // including with an error, hangs up on the reader if it's still going.
+    thread::scope(move |scope| {
+        scope.spawn(move || reader_loop(file, start, end, free_receiver, full_sender));
+        while remaining > 0 {
+            let (buf, n) = match full_receiver.recv() {
+                Ok(result) => result?,
+                // The reader hit EOF and exited.
+                Err(_) => break,
+            };
+            if skip < n {
+                let take = cmp::min((n - skip) as u64, remaining) as usize;
+                f(&buf[skip..][..take]);
+                remaining -= take as u64;
+            }
+            skip = 0;
+            if n < BUFFER_SIZE {
+                break;
+            }
+            // The reader might have stopped at the end of the range.
+            let _ = free_sender.send(buf);
+        }
+        Ok(())
+    })
+}
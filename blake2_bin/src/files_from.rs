@@ -0,0 +1,181 @@
+//! The --files-from mode, which reads a list of paths instead of taking them
+//! as arguments. This is for hashing huge numbers of files from scripts,
+//! where starting one process per file (with `find -exec` or `xargs`) would
+//! cost much more than the hashing itself. One process can read an unbounded
+//! stream of paths, and it writes its output through a single buffered
+//! writer.
+//!
+//! Small files are read whole and collected into batches, so that BLAKE2b and
+//! BLAKE2s can hash them in parallel with `hash_many`. Output order always
+//! matches input order.
+
+use crate::{hash_file, input_range, Opt, Params};
+use failure::Error;
+use std::fs::File;
+use std::io;
+use std::io::prelude::*;
+use std::path::{Path, PathBuf};
+
+// Files up to this size get batched. Larger files go through hash_file, which
+// does its own buffering.
+const MAX_BATCH_FILE_LEN: u64 = 64 * 1024;
+
+// Enough to keep the widest hash_many implementation busy. Output for small
+// files is written when their batch fills up, so a slow producer on the other
+// end of the list sees results in groups of this size.
+pub const MAX_BATCH_FILES: usize = 64;
+
+#[cfg(unix)]
+fn path_from_bytes(bytes: Vec<u8>) -> PathBuf {
+    use std::ffi::OsString;
+    use std::os::unix::ffi::OsStringExt;
+    OsString::from_vec(bytes).into()
+}
+
+#[cfg(not(unix))]
+fn path_from_bytes(bytes: Vec<u8>) -> PathBuf {
+    String::from_utf8_lossy(&bytes).into_owned().into()
+}
+
+// Read the whole file if it's small enough to batch, or return None.
+pub fn read_small_file(opt: &Opt, path: &Path) -> io::Result<Option<Vec<u8>>> {
+    let mut file = File::open(path)?;
+    let metadata = file.metadata()?;
+    if !metadata.is_file() || metadata.len() > MAX_BATCH_FILE_LEN {
+        return Ok(None);
+    }
+    let mut contents = Vec::with_capacity(metadata.len() as usize);
+    file.read_to_end(&mut contents)?;
+    let (start, end) = input_range(opt, contents.len() as u64);
+    contents.truncate(end as usize);
+    contents.drain(..start as usize);
+    Ok(Some(contents))
+}
+
+pub fn hash_batch(params: &Params, inputs: &[Vec<u8>]) -> Vec<String> {
+    match params {
+        Params::Blake2b(p) => {
+            let mut jobs: Vec<_> = inputs
+                .iter()
+                .map(|input| blake2b_simd::many::HashManyJob::new(p, input))
+                .collect();
+            blake2b_simd::many::hash_many(jobs.iter_mut());
+            jobs.iter()
+                .map(|j| j.to_hash().to_hex().to_string())
+                .collect()
+        }
+        Params::Blake2s(p) => {
+            let mut jobs: Vec<_> = inputs
+                .iter()
+                .map(|input| blake2s_simd::many::HashManyJob::new(p, input))
+                .collect();
+            blake2s_simd::many::hash_many(jobs.iter_mut());
+            jobs.iter()
+                .map(|j| j.to_hash().to_hex().to_string())
+                .collect()
+        }
+        // BLAKE2bp and BLAKE2sp are already parallel within each input.
+        _ => inputs
+            .iter()
+            .map(|input| {
+                let mut state = params.to_state();
+                state.update(input);
+                state.finalize()
+            })
+            .collect(),
+    }
+}
+
+struct Batcher<'a, W: Write> {
+    opt: &'a Opt,
+    params: &'a Params,
+    output: W,
+    paths: Vec<PathBuf>,
+    inputs: Vec<Vec<u8>>,
+    failed: bool,
+}
+
+impl<'a, W: Write> Batcher<'a, W> {
+    fn push(&mut self, path: PathBuf) -> io::Result<()> {
+        // O_DIRECT reads are the caller's explicit choice, so don't batch them.
+        let small_file = if self.opt.direct {
+            Ok(None)
+        } else {
+            read_small_file(self.opt, &path)
+        };
+        match small_file {
+            Ok(Some(contents)) => {
+                self.paths.push(path);
+                self.inputs.push(contents);
+                if self.paths.len() >= MAX_BATCH_FILES {
+                    self.flush()?;
+                }
+            }
+            Ok(None) => {
+                // Everything before this file has to be printed first.
+                self.flush()?;
+                let result = hash_file(self.opt, self.params, &path);
+                self.write_result(&path, result)?;
+            }
+            Err(e) => {
+                self.flush()?;
+                self.write_result(&path, Err(e.into()))?;
+            }
+        }
+        Ok(())
+    }
+
+    fn write_result(&mut self, path: &Path, result: Result<String, Error>) -> io::Result<()> {
+        match result {
+            Ok(hash) => writeln!(self.output, "{}  {}", hash, path.to_string_lossy()),
+            Err(e) => {
+                // Keep stdout and stderr in order, for anyone watching both.
+                self.output.flush()?;
+                eprintln!("blake2: {}: {}", path.to_string_lossy(), e);
+                self.failed = true;
+                Ok(())
+            }
+        }
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        let hashes = hash_batch(self.params, &self.inputs);
+        for (path, hash) in self.paths.iter().zip(hashes) {
+            writeln!(self.output, "{}  {}", hash, path.to_string_lossy())?;
+        }
+        self.paths.clear();
+        self.inputs.clear();
+        self.output.flush()
+    }
+}
+
+/// Hash every path listed in `list`, separated by `delimiter`, and write the
+/// results to `output`. Errors on individual files are reported to stderr, and
+/// the return value is true if there were any. Errors reading the list itself
+/// or writing the output are returned.
+pub fn hash_files_from(
+    opt: &Opt,
+    params: &Params,
+    list: impl BufRead,
+    delimiter: u8,
+    output: impl Write,
+) -> io::Result<bool> {
+    let mut batcher = Batcher {
+        opt,
+        params,
+        output,
+        paths: Vec::new(),
+        inputs: Vec::new(),
+        failed: false,
+    };
+    for entry in list.split(delimiter) {
+        let entry = entry?;
+        // Skip empty entries, like a blank line in the list.
+        if entry.is_empty() {
+            continue;
+        }
+        batcher.push(path_from_bytes(entry))?;
+    }
+    batcher.flush()?;
+    Ok(batcher.failed)
+}
@@ -0,0 +1,5 @@
+//! Library interfaces behind some of the modes of the `blake2` command line
+//! utility, for callers who want the same results without spawning it.
+
+pub mod tree;
+pub mod verity;
@@ -1,21 +1,84 @@
+use blake2_bin::tree::{DigestCache, TreeDigest};
+use blake2_bin::verity::Verity;
 use failure::{bail, Error};
+use std::cmp;
 use std::fs::File;
 use std::io;
 use std::io::prelude::*;
+use std::io::SeekFrom;
 use std::isize;
 use std::path::{Path, PathBuf};
 use std::process::exit;
 use structopt::StructOpt;
 
+mod decompress;
+#[cfg(target_os = "linux")]
+mod direct;
+mod files_from;
+#[cfg(target_os = "linux")]
+mod watch;
+
 #[derive(Debug, StructOpt)]
 struct Opt {
     /// Any number of filepaths, or empty for standard input.
     inputs: Vec<PathBuf>,
 
+    #[structopt(long = "files-from")]
+    /// Read the list of input paths from this file, or from standard input if it's "-".
+    files_from: Option<PathBuf>,
+
+    #[structopt(short = "0", long = "null")]
+    /// With --files-from, paths are separated by NUL bytes instead of newlines.
+    null: bool,
+
     #[structopt(long = "mmap")]
     /// Read input with memory mapping.
     mmap: bool,
 
+    #[structopt(long = "direct")]
+    /// Read input with O_DIRECT, bypassing the page cache (Linux only).
+    direct: bool,
+
+    #[structopt(long = "decompress")]
+    /// Hash the decompressed contents of each input, which is "gzip" or "zstd" compressed.
+    decompress: Option<decompress::Format>,
+
+    #[structopt(long = "offset")]
+    /// Start hashing each input at this byte offset.
+    offset: Option<u64>,
+
+    #[structopt(long = "range-length")]
+    /// Hash at most this many bytes of each input, instead of reading to the end.
+    range_length: Option<u64>,
+
+    #[structopt(long = "watch")]
+    /// Hash every file under the input directory, then keep watching it and print a record for each change (Linux only).
+    watch: bool,
+
+    #[structopt(long = "watch-manifest")]
+    /// With --watch, keep the current digests in this file.
+    watch_manifest: Option<PathBuf>,
+
+    #[structopt(long = "tree-digest")]
+    /// Hash each input directory tree, with names, modes, and contents, into a single digest.
+    tree_digest: bool,
+
+    #[structopt(long = "tree-cache")]
+    /// With --tree-digest, reuse and update the file digests saved in this file.
+    tree_cache: Option<PathBuf>,
+
+    #[structopt(long = "verity-build")]
+    /// Build a hash tree of 4096-byte blocks over the input, write it to this file, and print the root hash.
+    verity_build: Option<PathBuf>,
+
+    #[structopt(long = "verity-verify")]
+    /// Verify the input, or the blocks covering --offset and --range-length, against this hash tree.
+    verity_verify: Option<PathBuf>,
+
+    #[structopt(long = "verity-root")]
+    /// With --verity-verify, the trusted root hash as a hex string.
+    verity_root: Option<String>,
+
     #[structopt(short = "b")]
     /// Use the BLAKE2b hash function (default).
     big: bool,
@@ -172,10 +235,49 @@ fn read_write_all<R: Read>(mut reader: R, state: &mut State) -> io::Result<()> {
     }
 }
 
+// Clamp the --offset/--range-length range to an input of the given length.
+fn input_range(opt: &Opt, input_len: u64) -> (u64, u64) {
+    let start = cmp::min(opt.offset.unwrap_or(0), input_len);
+    let len = cmp::min(opt.range_length.unwrap_or(u64::MAX), input_len - start);
+    (start, start + len)
+}
+
 fn make_params(opt: &Opt) -> Result<Params, Error> {
     if opt.big && opt.small {
         bail!("-b and -s can't be used together");
     }
+    if opt.mmap && opt.direct {
+        bail!("--mmap and --direct can't be used together");
+    }
+    if opt.files_from.is_some() && !opt.inputs.is_empty() {
+        bail!("--files-from can't be used with input arguments");
+    }
+    if opt.null && opt.files_from.is_none() {
+        bail!("-0 requires --files-from");
+    }
+    if opt.decompress.is_some() && (opt.mmap || opt.direct || opt.files_from.is_some()) {
+        bail!("--decompress can't be used with --mmap, --direct, or --files-from");
+    }
+    if opt.watch_manifest.is_some() && !opt.watch {
+        bail!("--watch-manifest requires --watch");
+    }
+    if opt.watch
+        && (opt.decompress.is_some()
+            || opt.files_from.is_some()
+            || opt.tree_digest
+            || opt.verity_build.is_some()
+            || opt.verity_verify.is_some())
+    {
+        bail!(
+            "--watch can't be used with --decompress, --files-from, --tree-digest, or --verity-*"
+        );
+    }
+    if opt.tree_cache.is_some() && !opt.tree_digest {
+        bail!("--tree-cache requires --tree-digest");
+    }
+    if opt.verity_root.is_some() && opt.verity_verify.is_none() {
+        bail!("--verity-root requires --verity-verify");
+    }
     let mut params = if opt.small {
         if opt.parallel {
             Params::Blake2sp(blake2s_simd::blake2sp::Params::new())
@@ -328,12 +430,36 @@ fn make_params(opt: &Opt) -> Result<Params, Error> {
 
 fn hash_file(opt: &Opt, params: &Params, path: &Path) -> Result<String, Error> {
     let mut state = params.to_state();
+    if opt.direct {
+        #[cfg(target_os = "linux")]
+        {
+            let file = direct::open(path)?;
+            let offset = opt.offset.unwrap_or(0);
+            direct::read_range(&file, offset, opt.range_length, |buf| state.update(buf))?;
+            return Ok(state.finalize());
+        }
+        #[cfg(not(target_os = "linux"))]
+        bail!("--direct is only supported on Linux");
+    }
+    if let Some(format) = opt.decompress {
+        let file = File::open(path)?;
+        let offset = opt.offset.unwrap_or(0);
+        decompress::read_range(format, file, offset, opt.range_length, |buf| {
+            state.update(buf)
+        })?;
+        return Ok(state.finalize());
+    }
     let mut file = File::open(path)?;
     if opt.mmap {
         let map = mmap_file(&file)?;
-        state.update(&map);
+        let (start, end) = input_range(opt, map.len() as u64);
+        state.update(&map[start as usize..end as usize]);
     } else {
-        read_write_all(&mut file, &mut state)?;
+        if let Some(offset) = opt.offset {
+            file.seek(SeekFrom::Start(offset))?;
+        }
+        let range_length = opt.range_length.unwrap_or(u64::MAX);
+        read_write_all(file.take(range_length), &mut state)?;
     }
     Ok(state.finalize())
 }
@@ -342,11 +468,214 @@ fn hash_stdin(opt: &Opt, params: &Params) -> Result<String, Error> {
     if opt.mmap {
         bail!("--mmap not supported for stdin");
     }
+    if opt.direct {
+        bail!("--direct not supported for stdin");
+    }
     let mut state = params.to_state();
-    read_write_all(std::io::stdin().lock(), &mut state)?;
+    if let Some(format) = opt.decompress {
+        let offset = opt.offset.unwrap_or(0);
+        decompress::read_range(format, io::stdin(), offset, opt.range_length, |buf| {
+            state.update(buf)
+        })?;
+        return Ok(state.finalize());
+    }
+    let stdin = std::io::stdin();
+    let mut reader = stdin.lock();
+    if let Some(offset) = opt.offset {
+        // Stdin might not be seekable, so read and discard the prefix.
+        io::copy(&mut (&mut reader).take(offset), &mut io::sink())?;
+    }
+    let range_length = opt.range_length.unwrap_or(u64::MAX);
+    read_write_all(reader.take(range_length), &mut state)?;
     Ok(state.finalize())
 }
 
+// The tree digest has its own fixed parameters, so most flags don't apply.
+fn check_tree_digest_flags(opt: &Opt) -> Result<(), Error> {
+    let unsupported = [
+        ("-s", opt.small),
+        ("-p", opt.parallel),
+        ("--mmap", opt.mmap),
+        ("--direct", opt.direct),
+        ("--decompress", opt.decompress.is_some()),
+        ("--files-from", opt.files_from.is_some()),
+        ("--offset", opt.offset.is_some()),
+        ("--range-length", opt.range_length.is_some()),
+        ("--key", opt.key.is_some()),
+        ("--salt", opt.salt.is_some()),
+        ("--personal", opt.personal.is_some()),
+        ("--fanout", opt.fanout.is_some()),
+        ("--max-depth", opt.max_depth.is_some()),
+        ("--max-leaf-length", opt.max_leaf_length.is_some()),
+        ("--node-offset", opt.node_offset.is_some()),
+        ("--node-depth", opt.node_depth.is_some()),
+        ("--inner-hash-length", opt.inner_hash_length.is_some()),
+        ("--last-node", opt.last_node),
+    ];
+    for &(flag, set) in &unsupported {
+        if set {
+            bail!("{} can't be used with --tree-digest", flag);
+        }
+    }
+    if opt.inputs.is_empty() {
+        bail!("--tree-digest requires at least one input");
+    }
+    Ok(())
+}
+
+fn run_tree_digest(opt: &Opt) -> Result<bool, Error> {
+    check_tree_digest_flags(opt)?;
+    let mut tree_digest = TreeDigest::new();
+    let hash_length = opt.length.unwrap_or(blake2b_simd::OUTBYTES);
+    tree_digest.hash_length(hash_length);
+    let num_threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+    tree_digest.num_threads(num_threads);
+    let mut cache = match &opt.tree_cache {
+        Some(path) => Some(DigestCache::load(path, hash_length)?),
+        None => None,
+    };
+
+    let mut failed = false;
+    for input in &opt.inputs {
+        match tree_digest.digest(input, cache.as_mut()) {
+            Ok(hash) => {
+                if opt.inputs.len() > 1 {
+                    println!("{}  {}", hash.to_hex(), input.to_string_lossy());
+                } else {
+                    println!("{}", hash.to_hex());
+                }
+            }
+            Err(e) => {
+                eprintln!("blake2: {}: {}", input.to_string_lossy(), e);
+                failed = true;
+            }
+        }
+    }
+    if let (Some(cache), Some(path)) = (&cache, &opt.tree_cache) {
+        cache.save(path)?;
+    }
+    Ok(failed)
+}
+
+fn make_verity(opt: &Opt) -> Result<Verity, Error> {
+    let unsupported = [
+        ("-p", opt.parallel),
+        ("--mmap", opt.mmap),
+        ("--direct", opt.direct),
+        ("--decompress", opt.decompress.is_some()),
+        ("--files-from", opt.files_from.is_some()),
+        ("--tree-digest", opt.tree_digest),
+        ("--key", opt.key.is_some()),
+        ("--personal", opt.personal.is_some()),
+        ("--fanout", opt.fanout.is_some()),
+        ("--max-depth", opt.max_depth.is_some()),
+        ("--max-leaf-length", opt.max_leaf_length.is_some()),
+        ("--node-offset", opt.node_offset.is_some()),
+        ("--node-depth", opt.node_depth.is_some()),
+        ("--inner-hash-length", opt.inner_hash_length.is_some()),
+        ("--last-node", opt.last_node),
+    ];
+    for &(flag, set) in &unsupported {
+        if set {
+            bail!(
+                "{} can't be used with --verity-build or --verity-verify",
+                flag
+            );
+        }
+    }
+    if opt.verity_build.is_some() && opt.verity_verify.is_some() {
+        bail!("--verity-build and --verity-verify can't be used together");
+    }
+    if opt.inputs.len() != 1 {
+        bail!("--verity-build and --verity-verify require exactly one input");
+    }
+    // make_params has already validated the length and the salt.
+    let mut verity = if opt.small {
+        Verity::blake2s()
+    } else {
+        Verity::blake2b()
+    };
+    if let Some(length) = opt.length {
+        verity.hash_length(length);
+    }
+    if let Some(ref salt) = opt.salt {
+        verity.salt(&hex::decode(salt)?);
+    }
+    verity.num_threads(std::thread::available_parallelism().map_or(1, |n| n.get()));
+    Ok(verity)
+}
+
+fn run_verity_build(opt: &Opt, tree_path: &Path) -> Result<(), Error> {
+    if opt.offset.is_some() || opt.range_length.is_some() {
+        bail!("--offset and --range-length can't be used with --verity-build");
+    }
+    let verity = make_verity(opt)?;
+    let file = File::open(&opt.inputs[0])?;
+    let (tree, root) = verity.build(io::BufReader::new(file))?;
+    std::fs::write(tree_path, tree)?;
+    println!("{}", hex::encode(root));
+    Ok(())
+}
+
+fn run_verity_verify(opt: &Opt, tree_path: &Path) -> Result<(), Error> {
+    let verity = make_verity(opt)?;
+    let root = match &opt.verity_root {
+        Some(root) => hex::decode(root)?,
+        None => bail!("--verity-verify requires --verity-root"),
+    };
+    let tree = std::fs::read(tree_path)?;
+    let mut file = File::open(&opt.inputs[0])?;
+    // Block devices report a zero length in their metadata, but they can seek.
+    let data_len = file.seek(SeekFrom::End(0))?;
+    // Round the requested range out to whole blocks.
+    let block_size = 4096;
+    let (start, end) = input_range(opt, data_len);
+    let first_block = start / block_size;
+    let end_block = (end + block_size - 1) / block_size;
+    let read_end = cmp::min(end_block * block_size, data_len);
+    let read_start = first_block * block_size;
+    file.seek(SeekFrom::Start(read_start))?;
+    verity.verify_read(
+        &tree,
+        &root,
+        data_len,
+        first_block,
+        read_end - read_start,
+        file,
+    )?;
+    println!("{}: OK", opt.inputs[0].to_string_lossy());
+    Ok(())
+}
+
+fn run_files_from(opt: &Opt, params: &Params, list_path: &Path) -> io::Result<bool> {
+    let delimiter = if opt.null { b'\0' } else { b'\n' };
+    let stdout = io::stdout();
+    let output = io::BufWriter::new(stdout.lock());
+    if list_path == Path::new("-") {
+        let stdin = io::stdin();
+        files_from::hash_files_from(opt, params, stdin.lock(), delimiter, output)
+    } else {
+        let list = io::BufReader::new(File::open(list_path)?);
+        files_from::hash_files_from(opt, params, list, delimiter, output)
+    }
+}
+
+fn run_watch(opt: &Opt, params: &Params) -> Result<(), Error> {
+    if opt.inputs.len() != 1 {
+        bail!("--watch requires exactly one input directory");
+    }
+    #[cfg(target_os = "linux")]
+    {
+        let stdout = io::stdout();
+        let output = io::BufWriter::new(stdout.lock());
+        let manifest = opt.watch_manifest.as_deref();
+        watch::watch(opt, params, &opt.inputs[0], manifest, output)?;
+        return Ok(());
+    }
+    #[cfg(not(target_os = "linux"))]
+    bail!("--watch is only supported on Linux");
+}
+
 fn main() {
     let opt = Opt::from_args();
 
@@ -359,7 +688,38 @@ fn main() {
     };
 
     let mut failed = false;
-    if opt.inputs.is_empty() {
+    if opt.verity_build.is_some() || opt.verity_verify.is_some() {
+        let result = match (&opt.verity_build, &opt.verity_verify) {
+            (Some(tree_path), None) => run_verity_build(&opt, tree_path),
+            (_, Some(tree_path)) => run_verity_verify(&opt, tree_path),
+            (None, None) => unreachable!(),
+        };
+        if let Err(e) = result {
+            eprintln!("blake2: {}", e);
+            failed = true;
+        }
+    } else if opt.watch {
+        if let Err(e) = run_watch(&opt, &params) {
+            eprintln!("blake2: {}", e);
+            failed = true;
+        }
+    } else if opt.tree_digest {
+        match run_tree_digest(&opt) {
+            Ok(any_failed) => failed = any_failed,
+            Err(e) => {
+                eprintln!("blake2: {}", e);
+                failed = true;
+            }
+        }
+    } else if let Some(list_path) = &opt.files_from {
+        match run_files_from(&opt, &params, list_path) {
+            Ok(any_failed) => failed = any_failed,
+            Err(e) => {
+                eprintln!("blake2: {}: {}", list_path.to_string_lossy(), e);
+                failed = true;
+            }
+        }
+    } else if opt.inputs.is_empty() {
         match hash_stdin(&opt, &params) {
             Ok(hash) => println!("{}", hash),
             Err(e) => {
@@ -0,0 +1,709 @@
+//! A single digest of a whole directory tree, covering the names, permission
+//! bits, and contents of everything in it. This is for comparing build outputs
+//! and other large trees across machines, without shipping a manifest around.
+//!
+//! The digest is a Merkle tree built with BLAKE2b's tree parameters. Every
+//! node uses an unlimited fanout and max depth, and sets the inner hash length
+//! to the digest length. Files and symlinks are leaves at node depth 0, where
+//! the content of a symlink is its target path. A directory is an interior
+//! node, one level above its tallest child, whose input is its entries in
+//! sorted order by name bytes. Each entry is encoded as:
+//!
+//! ```text
+//! kind       1 byte: 0 for a file, 1 for a directory, 2 for a symlink
+//! mode       4 bytes, little-endian: the permission bits, mode & 0o7777
+//! name_len   8 bytes, little-endian
+//! name       name_len bytes
+//! digest     the child's digest
+//! ```
+//!
+//! The digest of a subdirectory is the same whether it's the root of the
+//! walk or not, so subtrees can be compared directly. Other file types, like
+//! sockets and device files, are an error.
+//!
+//! File digests can be cached between runs with a [`DigestCache`]. A file
+//! whose size, modification time, and (on Unix) inode and change time are
+//! unchanged isn't read again. A subtree where every file hits the cache is
+//! never read at all, and directory nodes are cheap to recompute from their
+//! children.
+//!
+//! # Example
+//!
+//! ```no_run
+//! use blake2_bin::tree::TreeDigest;
+//! use std::path::Path;
+//!
+//! let hash = TreeDigest::new().num_threads(8).digest(Path::new("target"), None)?;
+//! println!("{}", hash.to_hex());
+//! # Ok::<(), std::io::Error>(())
+//! ```
+
+use blake2b_simd::{Params, State, OUTBYTES};
+use std::borrow::Cow;
+use std::cmp;
+use std::collections::HashMap;
+use std::ffi::OsStr;
+use std::fmt;
+use std::fs::{self, File, Metadata};
+use std::io;
+use std::io::prelude::*;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::thread;
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+const KIND_FILE: u8 = 0;
+const KIND_DIR: u8 = 1;
+const KIND_SYMLINK: u8 = 2;
+
+const CACHE_HEADER: &str = "blake2-tree-cache 1";
+
+// Files modified this recently when a walk starts might still change again
+// within the same timestamp tick, so their digests aren't cached.
+const RACY_WINDOW: Duration = Duration::from_secs(2);
+
+/// The digest of a file or a tree. Unlike `blake2b_simd::Hash`, this can be
+/// loaded back from a [`DigestCache`], and its equality isn't constant-time.
+///
+/// [`DigestCache`]: struct.DigestCache.html
+#[derive(Clone, Copy, PartialEq, Eq)]
+pub struct Digest {
+    bytes: [u8; OUTBYTES],
+    len: u8,
+}
+
+impl Digest {
+    fn from_state(state: &State) -> Self {
+        Self::from_bytes(state.finalize().as_bytes()).unwrap()
+    }
+
+    fn from_bytes(bytes: &[u8]) -> Option<Self> {
+        if bytes.is_empty() || bytes.len() > OUTBYTES {
+            return None;
+        }
+        let mut digest = Self {
+            bytes: [0; OUTBYTES],
+            len: bytes.len() as u8,
+        };
+        digest.bytes[..bytes.len()].copy_from_slice(bytes);
+        Some(digest)
+    }
+
+    /// The digest bytes.
+    pub fn as_bytes(&self) -> &[u8] {
+        &self.bytes[..self.len as usize]
+    }
+
+    /// The digest bytes as lowercase hex.
+    pub fn to_hex(&self) -> String {
+        hex::encode(self.as_bytes())
+    }
+}
+
+impl fmt::Debug for Digest {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "Digest({})", self.to_hex())
+    }
+}
+
+/// Configuration for computing a directory tree digest.
+#[derive(Clone, Debug)]
+pub struct TreeDigest {
+    hash_length: usize,
+    num_threads: usize,
+}
+
+impl TreeDigest {
+    /// A digest of the full 64 bytes, hashing files on one thread.
+    pub fn new() -> Self {
+        Self {
+            hash_length: OUTBYTES,
+            num_threads: 1,
+        }
+    }
+
+    /// Set the length of the final digest and of every node in the tree, from
+    /// 1 to 64 bytes. Panics if the length is out of range.
+    pub fn hash_length(&mut self, length: usize) -> &mut Self {
+        assert!(
+            1 <= length && length <= OUTBYTES,
+            "Bad hash length: {}",
+            length
+        );
+        self.hash_length = length;
+        self
+    }
+
+    /// Hash files on up to this many threads.
+    pub fn num_threads(&mut self, num_threads: usize) -> &mut Self {
+        self.num_threads = cmp::max(1, num_threads);
+        self
+    }
+
+    fn node_params(&self, node_depth: u8) -> Params {
+        let mut params = Params::new();
+        params
+            .hash_length(self.hash_length)
+            .fanout(0)
+            .max_depth(255)
+            .inner_hash_length(self.hash_length)
+            .node_depth(node_depth);
+        params
+    }
+
+    /// Compute the digest of the tree at `root`. If `root` is a file, this is
+    /// the leaf digest of its contents. If `cache` is given, it's used to skip
+    /// reading unchanged files, and it's updated with the digests of all the
+    /// files that were read.
+    pub fn digest(&self, root: &Path, mut cache: Option<&mut DigestCache>) -> io::Result<Digest> {
+        if let Some(cache) = &cache {
+            if cache.hash_length != self.hash_length {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidInput,
+                    "the digest cache is for a different hash length",
+                ));
+            }
+        }
+        let walk_start = SystemTime::now();
+        let mut jobs = Vec::new();
+        // Follow a symlink at the root, but nowhere else.
+        let (_, node) = self.walk(root, &fs::metadata(root)?, cache.as_deref(), &mut jobs)?;
+        let hashes = self.hash_files(&jobs)?;
+        if let Some(cache) = &mut cache {
+            for (job, hash) in jobs.iter().zip(hashes.iter()) {
+                if job.stamp.cacheable(walk_start) {
+                    cache.insert(job.path.clone(), job.stamp, *hash);
+                }
+            }
+        }
+        Ok(self.node_hash(&node, &hashes).1)
+    }
+
+    fn walk(
+        &self,
+        path: &Path,
+        metadata: &Metadata,
+        cache: Option<&DigestCache>,
+        jobs: &mut Vec<FileJob>,
+    ) -> io::Result<(u8, Node)> {
+        let file_type = metadata.file_type();
+        if file_type.is_dir() {
+            let mut entries = Vec::new();
+            for dir_entry in fs::read_dir(path)? {
+                let dir_entry = dir_entry?;
+                let child_metadata = dir_entry.metadata()?;
+                let (kind, node) = self.walk(&dir_entry.path(), &child_metadata, cache, jobs)?;
+                entries.push(Entry {
+                    name: dir_entry.file_name().into_boxed_os_str(),
+                    kind,
+                    mode: mode_bits(&child_metadata),
+                    node,
+                });
+            }
+            entries.sort_by(|a, b| name_bytes(&a.name).cmp(&name_bytes(&b.name)));
+            Ok((KIND_DIR, Node::Dir(entries)))
+        } else if file_type.is_symlink() {
+            let target = fs::read_link(path)?;
+            let mut state = self.node_params(0).to_state();
+            state.update(&name_bytes(target.as_os_str()));
+            Ok((KIND_SYMLINK, Node::Leaf(Digest::from_state(&state))))
+        } else if file_type.is_file() {
+            let stamp = Stamp::new(metadata);
+            if let Some(cache) = cache {
+                if let Some(hash) = cache.get(path, &stamp) {
+                    return Ok((KIND_FILE, Node::Leaf(hash)));
+                }
+            }
+            jobs.push(FileJob {
+                path: path.to_owned(),
+                stamp,
+            });
+            Ok((KIND_FILE, Node::File(jobs.len() - 1)))
+        } else {
+            Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                format!("unsupported file type: {}", path.to_string_lossy()),
+            ))
+        }
+    }
+
+    fn hash_files(&self, jobs: &[FileJob]) -> io::Result<Vec<Digest>> {
+        let params = self.node_params(0);
+        let next = AtomicUsize::new(0);
+        let results = Mutex::new(Vec::with_capacity(jobs.len()));
+        let num_threads = cmp::min(self.num_threads, jobs.len());
+        thread::scope(|scope| {
+            for _ in 0..num_threads {
+                scope.spawn(|| loop {
+                    let i = next.fetch_add(1, Ordering::Relaxed);
+                    if i >= jobs.len() {
+                        return;
+                    }
+                    let result = hash_file(&params, &jobs[i].path);
+                    let failed = result.is_err();
+                    results.lock().unwrap().push((i, result));
+                    if failed {
+                        // Make the other threads stop early too.
+                        next.store(jobs.len(), Ordering::Relaxed);
+                        return;
+                    }
+                });
+            }
+        });
+        let mut results = results.into_inner().unwrap();
+        results.sort_by_key(|&(i, _)| i);
+        results.into_iter().map(|(_, result)| result).collect()
+    }
+
+    // Returns the node depth and the digest.
+    fn node_hash(&self, node: &Node, file_hashes: &[Digest]) -> (u8, Digest) {
+        match node {
+            Node::File(i) => (0, file_hashes[*i]),
+            Node::Leaf(hash) => (0, *hash),
+            Node::Dir(entries) => {
+                let mut children = Vec::with_capacity(entries.len());
+                let mut depth = 1;
+                for entry in entries {
+                    let (child_depth, hash) = self.node_hash(&entry.node, file_hashes);
+                    depth = cmp::max(depth, child_depth.saturating_add(1));
+                    children.push(hash);
+                }
+                let mut state = self.node_params(cmp::min(depth, 254)).to_state();
+                for (entry, hash) in entries.iter().zip(children.iter()) {
+                    let name = name_bytes(&entry.name);
+                    state.update(&[entry.kind]);
+                    state.update(&entry.mode.to_le_bytes());
+                    state.update(&(name.len() as u64).to_le_bytes());
+                    state.update(&name);
+                    state.update(hash.as_bytes());
+                }
+                (depth, Digest::from_state(&state))
+            }
+        }
+    }
+}
+
+impl Default for TreeDigest {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+enum Node {
+    // An index into the list of files that need to be read.
+    File(usize),
+    // A leaf whose digest is already known, from the cache or a symlink.
+    Leaf(Digest),
+    Dir(Vec<Entry>),
+}
+
+struct Entry {
+    name: Box<OsStr>,
+    kind: u8,
+    mode: u32,
+    node: Node,
+}
+
+struct FileJob {
+    path: PathBuf,
+    stamp: Stamp,
+}
+
+#[cfg(unix)]
+fn name_bytes(name: &OsStr) -> Cow<'_, [u8]> {
+    use std::os::unix::ffi::OsStrExt;
+    Cow::Borrowed(name.as_bytes())
+}
+
+#[cfg(not(unix))]
+fn name_bytes(name: &OsStr) -> Cow<'_, [u8]> {
+    match name.to_string_lossy() {
+        Cow::Borrowed(s) => Cow::Borrowed(s.as_bytes()),
+        Cow::Owned(s) => Cow::Owned(s.into_bytes()),
+    }
+}
+
+#[cfg(unix)]
+fn mode_bits(metadata: &Metadata) -> u32 {
+    use std::os::unix::fs::PermissionsExt;
+    metadata.permissions().mode() & 0o7777
+}
+
+// Without Unix permissions, the best we can do is the read-only flag.
+#[cfg(not(unix))]
+fn mode_bits(metadata: &Metadata) -> u32 {
+    if metadata.permissions().readonly() {
+        0o444
+    } else {
+        0o644
+    }
+}
+
+#[cfg(unix)]
+fn path_from_bytes(bytes: Vec<u8>) -> PathBuf {
+    use std::ffi::OsString;
+    use std::os::unix::ffi::OsStringExt;
+    OsString::from_vec(bytes).into()
+}
+
+#[cfg(not(unix))]
+fn path_from_bytes(bytes: Vec<u8>) -> PathBuf {
+    String::from_utf8_lossy(&bytes).into_owned().into()
+}
+
+fn hash_file(params: &Params, path: &Path) -> io::Result<Digest> {
+    let mut file = File::open(path)?;
+    let mut state = params.to_state();
+    // The same buffer size as the main hashing loop in the binary.
+    let mut buf = [0; 32768];
+    loop {
+        match file.read(&mut buf) {
+            Ok(0) => return Ok(Digest::from_state(&state)),
+            Ok(n) => {
+                state.update(&buf[..n]);
+            }
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => {}
+            Err(e) => return Err(e),
+        }
+    }
+}
+
+// The metadata that has to match for a cached digest to be reused.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+struct Stamp {
+    len: u64,
+    mtime_nanos: u64,
+    ctime_nanos: u64,
+    inode: u64,
+}
+
+fn nanos_since_epoch(time: io::Result<SystemTime>) -> u64 {
+    time.ok()
+        .and_then(|t| t.duration_since(UNIX_EPOCH).ok())
+        .map_or(0, |d| d.as_nanos() as u64)
+}
+
+impl Stamp {
+    #[cfg(unix)]
+    fn new(metadata: &Metadata) -> Self {
+        use std::os::unix::fs::MetadataExt;
+        let ctime_nanos = (metadata.ctime() as u64)
+            .wrapping_mul(1_000_000_000)
+            .wrapping_add(metadata.ctime_nsec() as u64);
+        Self {
+            len: metadata.len(),
+            mtime_nanos: nanos_since_epoch(metadata.modified()),
+            ctime_nanos,
+            inode: metadata.ino(),
+        }
+    }
+
+    #[cfg(not(unix))]
+    fn new(metadata: &Metadata) -> Self {
+        Self {
+            len: metadata.len(),
+            mtime_nanos: nanos_since_epoch(metadata.modified()),
+            ctime_nanos: 0,
+            inode: 0,
+        }
+    }
+
+    // Without a modification time, or with one too close to the start of the
+    // walk, a change to the file might not change its stamp.
+    fn cacheable(&self, walk_start: SystemTime) -> bool {
+        let cutoff = nanos_since_epoch(Ok(walk_start - RACY_WINDOW));
+        self.mtime_nanos != 0 && self.mtime_nanos < cutoff
+    }
+}
+
+/// File digests saved between runs of [`TreeDigest::digest`], keyed by path.
+/// Paths are stored as they were walked, so a cache is only useful for walks
+/// that spell the root path the same way.
+///
+/// [`TreeDigest::digest`]: struct.TreeDigest.html#method.digest
+#[derive(Clone, Debug)]
+pub struct DigestCache {
+    hash_length: usize,
+    entries: HashMap<PathBuf, (Stamp, Digest)>,
+}
+
+impl DigestCache {
+    /// An empty cache for digests of the given length.
+    pub fn new(hash_length: usize) -> Self {
+        Self {
+            hash_length,
+            entries: HashMap::new(),
+        }
+    }
+
+    /// Load a cache saved with [`save`]. If the file doesn't exist, or if it
+    /// was saved for a different hash length, return an empty cache.
+    ///
+    /// [`save`]: #method.save
+    pub fn load(path: &Path, hash_length: usize) -> io::Result<Self> {
+        let mut cache = Self::new(hash_length);
+        let file = match File::open(path) {
+            Ok(file) => file,
+            Err(e) if e.kind() == io::ErrorKind::NotFound => return Ok(cache),
+            Err(e) => return Err(e),
+        };
+        let mut lines = io::BufReader::new(file).lines();
+        let header = lines.next().transpose()?;
+        if header != Some(format!("{} {}", CACHE_HEADER, hash_length)) {
+            return Ok(cache);
+        }
+        for line in lines {
+            let line = line?;
+            let (path, stamp, hash) = parse_cache_line(&line, hash_length).ok_or_else(|| {
+                io::Error::new(io::ErrorKind::InvalidData, "malformed digest cache")
+            })?;
+            cache.entries.insert(path, (stamp, hash));
+        }
+        Ok(cache)
+    }
+
+    /// Write the cache to `path`, replacing the file atomically.
+    pub fn save(&self, path: &Path) -> io::Result<()> {
+        let mut temp_name = path.as_os_str().to_owned();
+        temp_name.push(".tmp");
+        let temp_path = PathBuf::from(temp_name);
+        let mut writer = io::BufWriter::new(File::create(&temp_path)?);
+        writeln!(writer, "{} {}", CACHE_HEADER, self.hash_length)?;
+        for (path, (stamp, hash)) in &self.entries {
+            writeln!(
+                writer,
+                "{} {} {} {} {} {}",
+                hash.to_hex(),
+                stamp.len,
+                stamp.mtime_nanos,
+                stamp.ctime_nanos,
+                stamp.inode,
+                hex::encode(name_bytes(path.as_os_str())),
+            )?;
+        }
+        writer.into_inner()?.sync_all()?;
+        fs::rename(&temp_path, path)
+    }
+
+    fn get(&self, path: &Path, stamp: &Stamp) -> Option<Digest> {
+        match self.entries.get(path) {
+            Some((cached_stamp, hash)) if cached_stamp == stamp => Some(*hash),
+            _ => None,
+        }
+    }
+
+    fn insert(&mut self, path: PathBuf, stamp: Stamp, hash: Digest) {
+        self.entries.insert(path, (stamp, hash));
+    }
+}
+
+fn parse_cache_line(line: &str, hash_length: usize) -> Option<(PathBuf, Stamp, Digest)> {
+    let mut fields = line.split(' ');
+    let hash_bytes = hex::decode(fields.next()?).ok()?;
+    if hash_bytes.len() != hash_length {
+        return None;
+    }
+    let hash = Digest::from_bytes(&hash_bytes)?;
+    let stamp = Stamp {
+        len: fields.next()?.parse().ok()?,
+        mtime_nanos: fields.next()?.parse().ok()?,
+        ctime_nanos: fields.next()?.parse().ok()?,
+        inode: fields.next()?.parse().ok()?,
+    };
+    let path = path_from_bytes(hex::decode(fields.next()?).ok()?);
+    if fields.next().is_some() {
+        return None;
+    }
+    Some((path, stamp, hash))
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn write_tree(root: &Path) {
+        fs::create_dir_all(root.join("a/b")).unwrap();
+        fs::create_dir(root.join("empty")).unwrap();
+        fs::write(root.join("top"), b"top level file").unwrap();
+        fs::write(root.join("a/one"), b"one").unwrap();
+        fs::write(root.join("a/b/two"), vec![7; 100_000]).unwrap();
+        #[cfg(unix)]
+        std::os::unix::fs::symlink("a/one", root.join("link")).unwrap();
+    }
+
+    fn leaf(hash_length: usize, input: &[u8]) -> Digest {
+        let mut state = TreeDigest::new()
+            .hash_length(hash_length)
+            .node_params(0)
+            .to_state();
+        state.update(input);
+        Digest::from_state(&state)
+    }
+
+    fn dir(hash_length: usize, depth: u8, entries: &[(u8, u32, &str, Digest)]) -> Digest {
+        let mut state = TreeDigest::new()
+            .hash_length(hash_length)
+            .node_params(depth)
+            .to_state();
+        for &(kind, mode, name, digest) in entries {
+            state.update(&[kind]);
+            state.update(&mode.to_le_bytes());
+            state.update(&(name.len() as u64).to_le_bytes());
+            state.update(name.as_bytes());
+            state.update(digest.as_bytes());
+        }
+        Digest::from_state(&state)
+    }
+
+    fn mode(path: &Path) -> u32 {
+        mode_bits(&fs::symlink_metadata(path).unwrap())
+    }
+
+    #[test]
+    fn test_encoding() {
+        let tempdir = tempfile::tempdir().unwrap();
+        let root = tempdir.path();
+        write_tree(root);
+        for &hash_length in &[16, OUTBYTES] {
+            let b = dir(
+                hash_length,
+                1,
+                &[(
+                    KIND_FILE,
+                    mode(&root.join("a/b/two")),
+                    "two",
+                    leaf(hash_length, &[7; 100_000]),
+                )],
+            );
+            let a = dir(
+                hash_length,
+                2,
+                &[
+                    (KIND_DIR, mode(&root.join("a/b")), "b", b),
+                    (
+                        KIND_FILE,
+                        mode(&root.join("a/one")),
+                        "one",
+                        leaf(hash_length, b"one"),
+                    ),
+                ],
+            );
+            let mut entries = vec![
+                (KIND_DIR, mode(&root.join("a")), "a", a),
+                (
+                    KIND_DIR,
+                    mode(&root.join("empty")),
+                    "empty",
+                    dir(hash_length, 1, &[]),
+                ),
+            ];
+            if cfg!(unix) {
+                entries.push((
+                    KIND_SYMLINK,
+                    mode(&root.join("link")),
+                    "link",
+                    leaf(hash_length, b"a/one"),
+                ));
+            }
+            entries.push((
+                KIND_FILE,
+                mode(&root.join("top")),
+                "top",
+                leaf(hash_length, b"top level file"),
+            ));
+            let expected = dir(hash_length, 3, &entries);
+
+            for &num_threads in &[1, 2, 8] {
+                let digest = TreeDigest::new()
+                    .hash_length(hash_length)
+                    .num_threads(num_threads)
+                    .digest(root, None)
+                    .unwrap();
+                assert_eq!(expected, digest);
+            }
+            // Subtrees have the same digest as a root or as a child.
+            let digest = TreeDigest::new()
+                .hash_length(hash_length)
+                .digest(&root.join("a"), None)
+                .unwrap();
+            assert_eq!(a, digest);
+        }
+    }
+
+    #[test]
+    fn test_changes() {
+        let tempdir = tempfile::tempdir().unwrap();
+        let root = tempdir.path();
+        write_tree(root);
+        let original = TreeDigest::new().digest(root, None).unwrap();
+
+        fs::write(root.join("a/one"), b"uno").unwrap();
+        let changed_content = TreeDigest::new().digest(root, None).unwrap();
+        assert_ne!(original, changed_content);
+
+        fs::rename(root.join("a/one"), root.join("a/uno")).unwrap();
+        let renamed = TreeDigest::new().digest(root, None).unwrap();
+        assert_ne!(changed_content, renamed);
+
+        #[cfg(unix)]
+        {
+            use std::os::unix::fs::PermissionsExt;
+            fs::set_permissions(root.join("top"), fs::Permissions::from_mode(0o600)).unwrap();
+            let chmodded = TreeDigest::new().digest(root, None).unwrap();
+            fs::set_permissions(root.join("top"), fs::Permissions::from_mode(0o755)).unwrap();
+            assert_ne!(chmodded, TreeDigest::new().digest(root, None).unwrap());
+        }
+    }
+
+    #[test]
+    fn test_cache() {
+        let tempdir = tempfile::tempdir().unwrap();
+        let root = tempdir.path().join("root");
+        fs::create_dir(&root).unwrap();
+        write_tree(&root);
+        let expected = TreeDigest::new().digest(&root, None).unwrap();
+
+        // Files this new are too racy to cache.
+        let mut cache = DigestCache::new(OUTBYTES);
+        let digest = TreeDigest::new().digest(&root, Some(&mut cache)).unwrap();
+        assert_eq!(expected, digest);
+        assert!(cache.entries.is_empty());
+
+        // A cache entry with a matching stamp is used instead of the file.
+        let one = root.join("a/one");
+        let stamp = Stamp::new(&fs::metadata(&one).unwrap());
+        cache.insert(one.clone(), stamp, leaf(OUTBYTES, b"cached"));
+        let cached = TreeDigest::new().digest(&root, Some(&mut cache)).unwrap();
+        assert_ne!(expected, cached);
+
+        // Saving and loading round-trips every entry.
+        let cache_path = tempdir.path().join("cache");
+        cache.insert(root.join("x"), stamp, leaf(OUTBYTES, b"x"));
+        cache.save(&cache_path).unwrap();
+        let loaded = DigestCache::load(&cache_path, OUTBYTES).unwrap();
+        assert_eq!(cache.entries, loaded.entries);
+        assert_eq!(
+            cached,
+            TreeDigest::new()
+                .digest(&root, Some(&mut loaded.clone()))
+                .unwrap()
+        );
+
+        // A cache for a different length loads empty, and a missing one too.
+        assert!(DigestCache::load(&cache_path, 32)
+            .unwrap()
+            .entries
+            .is_empty());
+        assert!(DigestCache::load(&tempdir.path().join("nope"), OUTBYTES)
+            .unwrap()
+            .entries
+            .is_empty());
+
+        // A changed file misses the cache.
+        fs::write(&one, b"changed").unwrap();
+        let changed = TreeDigest::new().digest(&root, Some(&mut cache)).unwrap();
+        assert_ne!(cached, changed);
+        assert_ne!(expected, changed);
+    }
+}
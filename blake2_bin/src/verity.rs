@@ -0,0 +1,746 @@
+//! A dm-verity-style hash tree over fixed-size blocks, for verifying reads
+//! from a read-only image without hashing the whole thing.
+//!
+//! The data is split into blocks of `block_size` bytes, with the last block
+//! zero-padded. Level 0 of the tree is the digest of every data block, packed
+//! `block_size / hash_length` to a hash block, with the last hash block
+//! zero-padded. Each level above is the digest of every hash block in the
+//! level below, until a level fits in a single hash block. The root hash is
+//! the digest of that block. The tree is stored as its levels concatenated
+//! from the bottom up, and the root hash is kept separately, somewhere
+//! trusted.
+//!
+//! Every digest uses the salt parameter of the hash function, so that trees
+//! of different images don't share digests, and the tree parameters bind each
+//! block to its position: the node depth is 0 for data blocks and `n + 1` for
+//! the hash blocks of level `n`, and the node offset is the block's index
+//! within its level.
+//!
+//! Every level is a batch of equal-sized, independent inputs, which is the
+//! best case for `hash_many`. Each level is split into runs of blocks over the
+//! available threads, and each thread hashes its run with `hash_many`.
+//!
+//! # Example
+//!
+//! ```
+//! use blake2_bin::verity::Verity;
+//!
+//! let data = vec![0xab; 100_000];
+//! let mut verity = Verity::blake2b();
+//! verity.salt(b"image salt");
+//! let (tree, root) = verity.build(&data[..])?;
+//!
+//! // Check blocks 3 and 4 against the tree and the trusted root.
+//! let blocks = &data[3 * 4096..5 * 4096];
+//! verity.verify(&tree, &root, data.len() as u64, 3, blocks).unwrap();
+//! # Ok::<(), std::io::Error>(())
+//! ```
+
+use std::cmp;
+use std::error;
+use std::fmt;
+use std::io;
+use std::io::prelude::*;
+use std::thread;
+
+// How many data blocks to read and hash at a time while building.
+const READ_BLOCKS: usize = 1024;
+
+// How many bytes of data to verify at a time. Tests use a small window, so
+// that they cover verification across several windows.
+#[cfg(not(test))]
+const VERIFY_WINDOW: usize = 4 << 20;
+#[cfg(test)]
+const VERIFY_WINDOW: usize = 1024;
+
+// How many blocks each hash_many call gets. Plenty for the widest
+// implementation, while keeping the job list small.
+const MANY_BLOCKS: usize = 64;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Algorithm {
+    Blake2b,
+    Blake2s,
+}
+
+/// Configuration for building and verifying hash trees.
+#[derive(Clone, Debug)]
+pub struct Verity {
+    algorithm: Algorithm,
+    block_size: usize,
+    hash_length: usize,
+    salt: Vec<u8>,
+    num_threads: usize,
+}
+
+/// The ways that verification can fail.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum VerifyError {
+    /// The tree isn't the right size for the data length.
+    BadTreeLength,
+    /// The top block of the tree doesn't match the root hash.
+    BadRoot,
+    /// A block doesn't match its digest in the level above. Level 0 means a
+    /// data block, and level `n + 1` means a hash block of tree level `n`.
+    Mismatch { level: usize, index: u64 },
+    /// The blocks to verify go past the end of the data.
+    OutOfRange,
+}
+
+impl fmt::Display for VerifyError {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match self {
+            VerifyError::BadTreeLength => write!(f, "hash tree has the wrong length"),
+            VerifyError::BadRoot => write!(f, "hash tree doesn't match the root hash"),
+            VerifyError::Mismatch { level: 0, index } => {
+                write!(f, "data block {} doesn't match", index)
+            }
+            VerifyError::Mismatch { level, index } => {
+                write!(
+                    f,
+                    "hash block {} of level {} doesn't match",
+                    index,
+                    level - 1
+                )
+            }
+            VerifyError::OutOfRange => write!(f, "blocks are past the end of the data"),
+        }
+    }
+}
+
+impl error::Error for VerifyError {}
+
+impl Verity {
+    fn new(algorithm: Algorithm, hash_length: usize) -> Self {
+        Self {
+            algorithm,
+            block_size: 4096,
+            hash_length,
+            salt: Vec::new(),
+            num_threads: 1,
+        }
+    }
+
+    /// BLAKE2b with a 64-byte digest and 4096-byte blocks.
+    pub fn blake2b() -> Self {
+        Self::new(Algorithm::Blake2b, blake2b_simd::OUTBYTES)
+    }
+
+    /// BLAKE2s with a 32-byte digest and 4096-byte blocks.
+    pub fn blake2s() -> Self {
+        Self::new(Algorithm::Blake2s, blake2s_simd::OUTBYTES)
+    }
+
+    fn max_hash_length(&self) -> usize {
+        match self.algorithm {
+            Algorithm::Blake2b => blake2b_simd::OUTBYTES,
+            Algorithm::Blake2s => blake2s_simd::OUTBYTES,
+        }
+    }
+
+    fn check_sizes(&self) {
+        assert!(
+            self.block_size / self.hash_length >= 2,
+            "A block must hold at least two hashes"
+        );
+    }
+
+    /// Set the size of data and hash blocks. Panics if a block can't hold at
+    /// least two hashes.
+    pub fn block_size(&mut self, block_size: usize) -> &mut Self {
+        self.block_size = block_size;
+        self.check_sizes();
+        self
+    }
+
+    /// Set the digest length, up to the maximum for the algorithm. Panics if
+    /// the length is out of range.
+    pub fn hash_length(&mut self, length: usize) -> &mut Self {
+        assert!(
+            1 <= length && length <= self.max_hash_length(),
+            "Bad hash length: {}",
+            length
+        );
+        self.hash_length = length;
+        self.check_sizes();
+        self
+    }
+
+    /// Set the salt, up to the salt parameter length of the algorithm. Panics
+    /// if the salt is too long.
+    pub fn salt(&mut self, salt: &[u8]) -> &mut Self {
+        let max = match self.algorithm {
+            Algorithm::Blake2b => blake2b_simd::SALTBYTES,
+            Algorithm::Blake2s => blake2s_simd::SALTBYTES,
+        };
+        assert!(salt.len() <= max, "Bad salt length: {}", salt.len());
+        self.salt = salt.to_vec();
+        self
+    }
+
+    /// Hash blocks on up to this many threads.
+    pub fn num_threads(&mut self, num_threads: usize) -> &mut Self {
+        self.num_threads = cmp::max(1, num_threads);
+        self
+    }
+
+    fn hashes_per_block(&self) -> u64 {
+        (self.block_size / self.hash_length) as u64
+    }
+
+    // The number of hash blocks in each level, from the bottom up.
+    fn level_blocks(&self, data_len: u64) -> Vec<u64> {
+        let mut levels = Vec::new();
+        let mut count = ceil_div(data_len, self.block_size as u64);
+        loop {
+            count = cmp::max(1, ceil_div(count, self.hashes_per_block()));
+            levels.push(count);
+            if count == 1 {
+                return levels;
+            }
+        }
+    }
+
+    /// The length of the tree for `data_len` bytes of data.
+    pub fn tree_len(&self, data_len: u64) -> u64 {
+        self.level_blocks(data_len).iter().sum::<u64>() * self.block_size as u64
+    }
+
+    // Hash each whole block in `blocks`, starting at node offset
+    // `first_index`, and write the digests contiguously to `out`.
+    fn hash_blocks_serial(&self, depth: u8, first_index: u64, blocks: &[u8], out: &mut [u8]) {
+        let hash_length = self.hash_length;
+        let block_size = self.block_size;
+        let blocks = blocks.chunks(block_size * MANY_BLOCKS);
+        let outs = out.chunks_mut(hash_length * MANY_BLOCKS);
+        for (i, (blocks, out)) in blocks.zip(outs).enumerate() {
+            let first_index = first_index + (i * MANY_BLOCKS) as u64;
+            match self.algorithm {
+                Algorithm::Blake2b => {
+                    let mut params = blake2b_simd::Params::new();
+                    params
+                        .hash_length(hash_length)
+                        .salt(&self.salt)
+                        .node_depth(depth);
+                    let mut jobs = Vec::with_capacity(MANY_BLOCKS);
+                    for (j, block) in blocks.chunks(block_size).enumerate() {
+                        params.node_offset(first_index + j as u64);
+                        jobs.push(blake2b_simd::many::HashManyJob::new(&params, block));
+                    }
+                    blake2b_simd::many::hash_many(jobs.iter_mut());
+                    for (job, out) in jobs.iter().zip(out.chunks_mut(hash_length)) {
+                        out.copy_from_slice(job.to_hash().as_bytes());
+                    }
+                }
+                Algorithm::Blake2s => {
+                    let mut params = blake2s_simd::Params::new();
+                    params
+                        .hash_length(hash_length)
+                        .salt(&self.salt)
+                        .node_depth(depth);
+                    let mut jobs = Vec::with_capacity(MANY_BLOCKS);
+                    for (j, block) in blocks.chunks(block_size).enumerate() {
+                        params.node_offset(first_index + j as u64);
+                        jobs.push(blake2s_simd::many::HashManyJob::new(&params, block));
+                    }
+                    blake2s_simd::many::hash_many(jobs.iter_mut());
+                    for (job, out) in jobs.iter().zip(out.chunks_mut(hash_length)) {
+                        out.copy_from_slice(job.to_hash().as_bytes());
+                    }
+                }
+            }
+        }
+    }
+
+    // Like hash_blocks_serial, but split over threads.
+    fn hash_blocks(&self, depth: u8, first_index: u64, blocks: &[u8], out: &mut [u8]) {
+        let num_blocks = blocks.len() / self.block_size;
+        let blocks_per_thread = ceil_div(num_blocks as u64, self.num_threads as u64) as usize;
+        // Don't bother with threads for less than one batch each.
+        let blocks_per_thread = cmp::max(blocks_per_thread, MANY_BLOCKS);
+        if blocks_per_thread >= num_blocks {
+            return self.hash_blocks_serial(depth, first_index, blocks, out);
+        }
+        thread::scope(|scope| {
+            let blocks = blocks.chunks(blocks_per_thread * self.block_size);
+            let outs = out.chunks_mut(blocks_per_thread * self.hash_length);
+            for (i, (blocks, out)) in blocks.zip(outs).enumerate() {
+                let first_index = first_index + (i * blocks_per_thread) as u64;
+                scope.spawn(move || self.hash_blocks_serial(depth, first_index, blocks, out));
+            }
+        });
+    }
+
+    // Pack the digests of one level into zero-padded hash blocks.
+    fn pack_level(&self, digests: &[u8]) -> Vec<u8> {
+        let per_block = self.hashes_per_block() as usize * self.hash_length;
+        let num_blocks = cmp::max(1, ceil_div(digests.len() as u64, per_block as u64) as usize);
+        let mut level = vec![0; num_blocks * self.block_size];
+        for (block, digests) in level
+            .chunks_mut(self.block_size)
+            .zip(digests.chunks(per_block))
+        {
+            block[..digests.len()].copy_from_slice(digests);
+        }
+        level
+    }
+
+    // The digest at `index` in a packed level.
+    fn digest_at<'a>(&self, level: &'a [u8], index: u64) -> &'a [u8] {
+        let hashes_per_block = self.hashes_per_block();
+        let start = (index / hashes_per_block) as usize * self.block_size
+            + (index % hashes_per_block) as usize * self.hash_length;
+        &level[start..][..self.hash_length]
+    }
+
+    fn root_hash(&self, depth: u8, top_block: &[u8]) -> Vec<u8> {
+        let mut root = vec![0; self.hash_length];
+        self.hash_blocks_serial(depth, 0, top_block, &mut root);
+        root
+    }
+
+    /// Read all of `data` and build its hash tree. Returns the tree and the
+    /// root hash.
+    pub fn build(&self, mut data: impl Read) -> io::Result<(Vec<u8>, Vec<u8>)> {
+        let mut buf = vec![0; READ_BLOCKS * self.block_size];
+        let mut level = Vec::new();
+        let mut num_blocks = 0u64;
+        loop {
+            let n = read_full(&mut data, &mut buf)?;
+            if n == 0 {
+                break;
+            }
+            // Zero-pad the last partial block.
+            let padded_len = ceil_div(n as u64, self.block_size as u64) as usize * self.block_size;
+            for b in &mut buf[n..padded_len] {
+                *b = 0;
+            }
+            let start = level.len();
+            level.resize(start + padded_len / self.block_size * self.hash_length, 0);
+            self.hash_blocks(0, num_blocks, &buf[..padded_len], &mut level[start..]);
+            num_blocks += (padded_len / self.block_size) as u64;
+            if n < buf.len() {
+                break;
+            }
+        }
+
+        let mut tree = Vec::new();
+        let mut depth = 1;
+        let mut level = self.pack_level(&level);
+        while level.len() > self.block_size {
+            let mut next = vec![0; level.len() / self.block_size * self.hash_length];
+            self.hash_blocks(depth, 0, &level, &mut next);
+            tree.extend_from_slice(&level);
+            level = self.pack_level(&next);
+            depth += 1;
+        }
+        let root = self.root_hash(depth, &level);
+        tree.extend_from_slice(&level);
+        Ok((tree, root))
+    }
+
+    // Check the length of the tree and its top block against the root, and
+    // split it into levels from the bottom up.
+    fn split_levels<'a>(
+        &self,
+        tree: &'a [u8],
+        root: &[u8],
+        data_len: u64,
+    ) -> Result<Vec<&'a [u8]>, VerifyError> {
+        if tree.len() as u64 != self.tree_len(data_len) {
+            return Err(VerifyError::BadTreeLength);
+        }
+        let level_blocks = self.level_blocks(data_len);
+        let mut levels = Vec::with_capacity(level_blocks.len());
+        let mut rest = tree;
+        for &count in &level_blocks {
+            let (level, next) = rest.split_at(count as usize * self.block_size);
+            levels.push(level);
+            rest = next;
+        }
+        // Check the top of the tree first, so that everything below is
+        // checked against trusted digests.
+        let top = levels.last().unwrap();
+        if self.root_hash(levels.len() as u8, top) != root {
+            return Err(VerifyError::BadRoot);
+        }
+        Ok(levels)
+    }
+
+    // The number of blocks to verify, or an error if the range goes past the
+    // end of the data.
+    fn check_range(&self, data_len: u64, first_block: u64, len: u64) -> Result<u64, VerifyError> {
+        let block_size = self.block_size as u64;
+        let num_blocks = ceil_div(len, block_size);
+        let end_block = first_block + num_blocks;
+        let whole = len % block_size == 0;
+        if end_block > ceil_div(data_len, block_size)
+            || (!whole && end_block * block_size < data_len)
+        {
+            return Err(VerifyError::OutOfRange);
+        }
+        Ok(num_blocks)
+    }
+
+    // Verify one window of whole data blocks, starting at first_block, and
+    // then the hash blocks above it. checked[depth] is the end of the hash
+    // blocks of each level that earlier windows have already checked, so
+    // each hash block is hashed only once over a run of windows.
+    fn verify_window(
+        &self,
+        levels: &[&[u8]],
+        checked: &mut [u64],
+        first_block: u64,
+        blocks: &[u8],
+    ) -> Result<(), VerifyError> {
+        let block_size = self.block_size as u64;
+        let hashes_per_block = self.hashes_per_block();
+        let mut digests = Vec::new();
+        let mut current = blocks;
+        let mut start = first_block;
+        for (depth, level) in levels.iter().enumerate() {
+            let end = start + current.len() as u64 / block_size;
+            digests.clear();
+            digests.resize(current.len() / self.block_size * self.hash_length, 0);
+            self.hash_blocks(depth as u8, start, current, &mut digests);
+            for (index, digest) in (start..end).zip(digests.chunks(self.hash_length)) {
+                if digest != self.digest_at(level, index) {
+                    return Err(VerifyError::Mismatch {
+                        level: depth,
+                        index,
+                    });
+                }
+            }
+            // Move up to the hash blocks that hold the digests just checked,
+            // leaving out any that are already done.
+            start = cmp::max(start / hashes_per_block, checked[depth]);
+            let next_end = ceil_div(end, hashes_per_block);
+            if start >= next_end {
+                break;
+            }
+            checked[depth] = next_end;
+            current = &level[(start * block_size) as usize..(next_end * block_size) as usize];
+        }
+        Ok(())
+    }
+
+    fn window_blocks(&self) -> usize {
+        cmp::max(1, VERIFY_WINDOW / self.block_size)
+    }
+
+    /// Verify the data blocks starting at index `first_block` against `tree`
+    /// and `root`, for data that's `data_len` bytes long in total. `blocks`
+    /// must be whole blocks, except that the last block of the data can be
+    /// short.
+    pub fn verify(
+        &self,
+        tree: &[u8],
+        root: &[u8],
+        data_len: u64,
+        first_block: u64,
+        blocks: &[u8],
+    ) -> Result<(), VerifyError> {
+        let levels = self.split_levels(tree, root, data_len)?;
+        self.check_range(data_len, first_block, blocks.len() as u64)?;
+        let mut checked = vec![0; levels.len()];
+        let whole_len = blocks.len() - blocks.len() % self.block_size;
+        let (whole, partial) = blocks.split_at(whole_len);
+        let mut index = first_block;
+        for window in whole.chunks(self.window_blocks() * self.block_size) {
+            self.verify_window(&levels, &mut checked, index, window)?;
+            index += (window.len() / self.block_size) as u64;
+        }
+        if !partial.is_empty() {
+            let mut padded = vec![0; self.block_size];
+            padded[..partial.len()].copy_from_slice(partial);
+            self.verify_window(&levels, &mut checked, index, &padded)?;
+        }
+        Ok(())
+    }
+
+    /// Like [`verify`](#method.verify), but read the `len` bytes of data
+    /// starting at block `first_block` from `data`, a few MiB at a time, so
+    /// that verifying a large image or device takes a bounded amount of
+    /// memory. A failed verification is an `InvalidData` error wrapping a
+    /// [`VerifyError`](enum.VerifyError.html).
+    pub fn verify_read(
+        &self,
+        tree: &[u8],
+        root: &[u8],
+        data_len: u64,
+        first_block: u64,
+        len: u64,
+        mut data: impl Read,
+    ) -> io::Result<()> {
+        let invalid = |e| io::Error::new(io::ErrorKind::InvalidData, e);
+        let levels = self.split_levels(tree, root, data_len).map_err(invalid)?;
+        let num_blocks = self
+            .check_range(data_len, first_block, len)
+            .map_err(invalid)?;
+        let mut checked = vec![0; levels.len()];
+        let mut buf = vec![0; self.window_blocks() * self.block_size];
+        let mut index = first_block;
+        let mut remaining = len;
+        while remaining > 0 {
+            let want = cmp::min(remaining, buf.len() as u64) as usize;
+            if read_full(&mut data, &mut buf[..want])? < want {
+                return Err(io::ErrorKind::UnexpectedEof.into());
+            }
+            remaining -= want as u64;
+            // Zero-pad the last partial block.
+            let padded_len =
+                ceil_div(want as u64, self.block_size as u64) as usize * self.block_size;
+            for b in &mut buf[want..padded_len] {
+                *b = 0;
+            }
+            self.verify_window(&levels, &mut checked, index, &buf[..padded_len])
+                .map_err(invalid)?;
+            index += (padded_len / self.block_size) as u64;
+        }
+        debug_assert_eq!(first_block + num_blocks, index);
+        Ok(())
+    }
+}
+
+fn ceil_div(a: u64, b: u64) -> u64 {
+    (a + b - 1) / b
+}
+
+// Fill as much of the buffer as possible, stopping short only at EOF.
+fn read_full(reader: &mut impl Read, buf: &mut [u8]) -> io::Result<usize> {
+    let mut filled = 0;
+    while filled < buf.len() {
+        match reader.read(&mut buf[filled..]) {
+            Ok(0) => break,
+            Ok(n) => filled += n,
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => {}
+            Err(e) => return Err(e),
+        }
+    }
+    Ok(filled)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn paint(len: usize) -> Vec<u8> {
+        (0..len).map(|i| (i % 251) as u8).collect()
+    }
+
+    // A straightforward reference, one hash at a time.
+    fn reference_hash(verity: &Verity, depth: u8, index: u64, block: &[u8]) -> Vec<u8> {
+        match verity.algorithm {
+            Algorithm::Blake2b => blake2b_simd::Params::new()
+                .hash_length(verity.hash_length)
+                .salt(&verity.salt)
+                .node_depth(depth)
+                .node_offset(index)
+                .hash(block)
+                .as_bytes()
+                .to_vec(),
+            Algorithm::Blake2s => blake2s_simd::Params::new()
+                .hash_length(verity.hash_length)
+                .salt(&verity.salt)
+                .node_depth(depth)
+                .node_offset(index)
+                .hash(block)
+                .as_bytes()
+                .to_vec(),
+        }
+    }
+
+    fn reference_tree(verity: &Verity, data: &[u8]) -> (Vec<u8>, Vec<u8>) {
+        let mut blocks: Vec<Vec<u8>> = data
+            .chunks(verity.block_size)
+            .map(|block| {
+                let mut block = block.to_vec();
+                block.resize(verity.block_size, 0);
+                block
+            })
+            .collect();
+        let mut tree = Vec::new();
+        let mut depth = 0;
+        loop {
+            let digests: Vec<Vec<u8>> = blocks
+                .iter()
+                .enumerate()
+                .map(|(i, block)| reference_hash(verity, depth, i as u64, block))
+                .collect();
+            let per_block = verity.hashes_per_block() as usize;
+            blocks = digests
+                .chunks(per_block)
+                .map(|digests| {
+                    let mut block = digests.concat();
+                    block.resize(verity.block_size, 0);
+                    block
+                })
+                .collect();
+            if blocks.is_empty() {
+                blocks.push(vec![0; verity.block_size]);
+            }
+            for block in &blocks {
+                tree.extend_from_slice(block);
+            }
+            depth += 1;
+            if blocks.len() == 1 {
+                let root = reference_hash(verity, depth, 0, &blocks[0]);
+                return (tree, root);
+            }
+        }
+    }
+
+    fn configs() -> Vec<Verity> {
+        let mut configs = Vec::new();
+        for &num_threads in &[1, 3] {
+            configs.push(Verity::blake2b().num_threads(num_threads).clone());
+            configs.push(Verity::blake2s().num_threads(num_threads).clone());
+            // Small blocks make deep trees, and 20 bytes doesn't divide 128.
+            configs.push(
+                Verity::blake2b()
+                    .block_size(128)
+                    .hash_length(20)
+                    .salt(b"salt")
+                    .num_threads(num_threads)
+                    .clone(),
+            );
+            configs.push(
+                Verity::blake2s()
+                    .block_size(64)
+                    .hash_length(32)
+                    .salt(b"salt")
+                    .num_threads(num_threads)
+                    .clone(),
+            );
+        }
+        configs
+    }
+
+    #[test]
+    fn test_build_matches_reference() {
+        for verity in &configs() {
+            let block_size = verity.block_size;
+            for &len in &[
+                0,
+                1,
+                block_size,
+                block_size + 1,
+                100 * block_size - 3,
+                1500 * block_size,
+            ] {
+                let data = paint(len);
+                let (tree, root) = verity.build(&data[..]).unwrap();
+                let (expected_tree, expected_root) = reference_tree(verity, &data);
+                assert_eq!(expected_tree, tree, "{:?} {}", verity, len);
+                assert_eq!(expected_root, root, "{:?} {}", verity, len);
+                assert_eq!(verity.tree_len(len as u64), tree.len() as u64);
+            }
+        }
+    }
+
+    #[test]
+    fn test_verify() {
+        for verity in &configs() {
+            let block_size = verity.block_size;
+            let len = 100 * block_size - 3;
+            let data = paint(len);
+            let (tree, root) = verity.build(&data[..]).unwrap();
+            let num_blocks = 100;
+
+            let ranges = [(0, num_blocks), (0, 1), (5, 1), (7, 30), (99, 1), (42, 0)];
+            for &(first, count) in &ranges {
+                let start = first * block_size;
+                let end = std::cmp::min((first + count) * block_size, len);
+                let blocks = &data[start..end];
+                assert_eq!(
+                    Ok(()),
+                    verity.verify(&tree, &root, len as u64, first as u64, blocks)
+                );
+                let result = verity.verify_read(
+                    &tree,
+                    &root,
+                    len as u64,
+                    first as u64,
+                    blocks.len() as u64,
+                    blocks,
+                );
+                assert!(result.is_ok());
+            }
+
+            // Corrupt a data block.
+            let mut bad_data = data.clone();
+            bad_data[9 * block_size + 5] ^= 1;
+            assert_eq!(
+                Err(VerifyError::Mismatch { level: 0, index: 9 }),
+                verity.verify(&tree, &root, len as u64, 0, &bad_data),
+            );
+            let err = verity
+                .verify_read(&tree, &root, len as u64, 0, len as u64, &bad_data[..])
+                .unwrap_err();
+            assert_eq!(io::ErrorKind::InvalidData, err.kind());
+            assert_eq!(
+                Some(&VerifyError::Mismatch { level: 0, index: 9 }),
+                err.get_ref().unwrap().downcast_ref::<VerifyError>(),
+            );
+            // A short read is an error, not a pass.
+            let err = verity
+                .verify_read(&tree, &root, len as u64, 0, len as u64, &data[..len - 1])
+                .unwrap_err();
+            assert_eq!(io::ErrorKind::UnexpectedEof, err.kind());
+            // Other blocks are still fine.
+            let blocks = &bad_data[10 * block_size..12 * block_size];
+            assert_eq!(Ok(()), verity.verify(&tree, &root, len as u64, 10, blocks));
+
+            // Corrupt the first hash block of the tree. If that's also the top
+            // block, the root catches it.
+            let mut bad_tree = tree.clone();
+            bad_tree[0] ^= 1;
+            if verity.level_blocks(len as u64).len() > 1 {
+                assert_eq!(
+                    Err(VerifyError::Mismatch { level: 0, index: 0 }),
+                    verity.verify(&bad_tree, &root, len as u64, 0, &data[..block_size]),
+                );
+                assert_eq!(
+                    Err(VerifyError::Mismatch { level: 1, index: 0 }),
+                    verity.verify(
+                        &bad_tree,
+                        &root,
+                        len as u64,
+                        1,
+                        &data[block_size..][..block_size]
+                    ),
+                );
+            } else {
+                assert_eq!(
+                    Err(VerifyError::BadRoot),
+                    verity.verify(&bad_tree, &root, len as u64, 0, &data[..block_size]),
+                );
+            }
+
+            // Corrupt the top of the tree.
+            let mut bad_tree = tree.clone();
+            *bad_tree.last_mut().unwrap() ^= 1;
+            assert_eq!(
+                Err(VerifyError::BadRoot),
+                verity.verify(&bad_tree, &root, len as u64, 0, &data),
+            );
+
+            // A different salt gives a different tree.
+            let mut other = verity.clone();
+            other.salt(b"other");
+            assert_eq!(
+                Err(VerifyError::BadRoot),
+                other.verify(&tree, &root, len as u64, 0, &data),
+            );
+
+            assert_eq!(
+                Err(VerifyError::BadTreeLength),
+                verity.verify(&tree[block_size..], &root, len as u64, 0, &data),
+            );
+            assert_eq!(
+                Err(VerifyError::OutOfRange),
+                verity.verify(&tree, &root, len as u64, 99, &data[..2 * block_size]),
+            );
+        }
+    }
+}
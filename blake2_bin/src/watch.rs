@@ -0,0 +1,504 @@
+//! The --watch mode, which keeps the digests of every file under a directory
+//! current as the files change (Linux only). This replaces re-running blake2
+//! over the whole tree on a timer, which reads everything again even when
+//! almost nothing has changed.
+//!
+//! Startup hashes every regular file in parallel, and after that inotify
+//! reports which paths changed. Events are collected until the tree has been
+//! quiet for a short while, so a burst of writes to one file costs one rehash,
+//! and then only the changed paths are hashed again. Small files go through
+//! `hash_many` in batches, the same way as with --files-from.
+//!
+//! Each change is printed as a record on stdout:
+//!
+//! ```text
+//! A <hash>  <path>     a new file
+//! M <hash>  <path>     a file whose contents changed
+//! D <old hash>  <path> a file that was removed
+//! ```
+//!
+//! With --watch-manifest, the current digests are also kept in a file, in the
+//! usual `<hash>  <path>` format and sorted by path. It's replaced atomically
+//! after each batch of changes. If it already exists at startup, the initial
+//! records are the differences from it, so changes made while nothing was
+//! watching show up too.
+//!
+//! Watching stops when the directory itself is removed or moved away. If the
+//! kernel's event queue overflows, the whole tree is rescanned.
+
+use crate::files_from::{hash_batch, read_small_file, MAX_BATCH_FILES};
+use crate::{hash_file, Opt, Params};
+use failure::Error;
+use std::collections::{BTreeMap, BTreeSet, HashMap};
+use std::ffi::{CString, OsStr};
+use std::fs::{self, File};
+use std::io;
+use std::io::prelude::*;
+use std::os::unix::ffi::OsStrExt;
+use std::path::{Path, PathBuf};
+use std::thread;
+use std::time::{Duration, Instant};
+
+// Hash a batch once no events have arrived for this long...
+const SETTLE: Duration = Duration::from_millis(100);
+// ...or once it's been collecting for this long, so that a file that's
+// written constantly still gets updated.
+const MAX_DELAY: Duration = Duration::from_secs(2);
+
+const EVENT_BUFFER_SIZE: usize = 64 * 1024;
+
+const WATCH_MASK: u32 = libc::IN_CREATE
+    | libc::IN_MODIFY
+    | libc::IN_CLOSE_WRITE
+    | libc::IN_MOVED_FROM
+    | libc::IN_MOVED_TO
+    | libc::IN_DELETE
+    | libc::IN_DELETE_SELF
+    | libc::IN_MOVE_SELF
+    | libc::IN_ONLYDIR
+    | libc::IN_DONT_FOLLOW;
+
+enum Events {
+    Changed,
+    Overflow,
+    RootGone,
+}
+
+struct Inotify {
+    fd: libc::c_int,
+    dirs: HashMap<libc::c_int, PathBuf>,
+    root_wd: libc::c_int,
+    buf: Vec<u8>,
+}
+
+impl Inotify {
+    fn new() -> io::Result<Self> {
+        let fd = unsafe { libc::inotify_init1(libc::IN_CLOEXEC) };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Self {
+            fd,
+            dirs: HashMap::new(),
+            root_wd: -1,
+            buf: vec![0; EVENT_BUFFER_SIZE],
+        })
+    }
+
+    fn add_watch(&mut self, dir: &Path) -> io::Result<libc::c_int> {
+        let c_path = CString::new(dir.as_os_str().as_bytes())?;
+        let wd = unsafe { libc::inotify_add_watch(self.fd, c_path.as_ptr(), WATCH_MASK) };
+        if wd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        self.dirs.insert(wd, dir.to_owned());
+        Ok(wd)
+    }
+
+    // Stop watching `dir` and everything under it. A directory that's been
+    // deleted has already lost its watch, and that error is ignored.
+    fn remove_under(&mut self, dir: &Path) {
+        let fd = self.fd;
+        self.dirs.retain(|&wd, path| {
+            if path.starts_with(dir) {
+                unsafe { libc::inotify_rm_watch(fd, wd) };
+                false
+            } else {
+                true
+            }
+        });
+    }
+
+    // Wait up to `timeout` for events, or forever if it's None, and return
+    // whether any arrived.
+    fn wait(&self, timeout: Option<Duration>) -> io::Result<bool> {
+        let mut pollfd = libc::pollfd {
+            fd: self.fd,
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        let timeout_ms = timeout.map_or(-1, |t| t.as_millis() as libc::c_int);
+        loop {
+            let n = unsafe { libc::poll(&mut pollfd, 1, timeout_ms) };
+            if n >= 0 {
+                return Ok(n > 0);
+            }
+            let e = io::Error::last_os_error();
+            if e.kind() != io::ErrorKind::Interrupted {
+                return Err(e);
+            }
+        }
+    }
+
+    // Read the pending events, and add the path each one refers to to `dirty`.
+    fn read(&mut self, dirty: &mut BTreeSet<PathBuf>) -> io::Result<Events> {
+        let n = loop {
+            let n = unsafe { libc::read(self.fd, self.buf.as_mut_ptr() as *mut _, self.buf.len()) };
+            if n >= 0 {
+                break n as usize;
+            }
+            let e = io::Error::last_os_error();
+            if e.kind() != io::ErrorKind::Interrupted {
+                return Err(e);
+            }
+        };
+        let header_len = std::mem::size_of::<libc::inotify_event>();
+        let mut result = Events::Changed;
+        let mut offset = 0;
+        while offset + header_len <= n {
+            // The kernel aligns each event, but our buffer might not be.
+            let event: libc::inotify_event =
+                unsafe { std::ptr::read_unaligned(self.buf[offset..].as_ptr() as *const _) };
+            let name = &self.buf[offset + header_len..][..event.len as usize];
+            offset += header_len + event.len as usize;
+
+            if event.mask & libc::IN_Q_OVERFLOW != 0 {
+                result = Events::Overflow;
+                continue;
+            }
+            if event.mask & libc::IN_IGNORED != 0 {
+                self.dirs.remove(&event.wd);
+                continue;
+            }
+            if event.wd == self.root_wd
+                && event.mask & (libc::IN_DELETE_SELF | libc::IN_MOVE_SELF) != 0
+            {
+                return Ok(Events::RootGone);
+            }
+            let dir = match self.dirs.get(&event.wd) {
+                Some(dir) => dir,
+                None => continue,
+            };
+            // The name is padded with NULs. Events on the directory itself
+            // have no name, and its parent reports those too.
+            let name_len = name.iter().position(|&b| b == 0).unwrap_or(name.len());
+            if name_len > 0 {
+                dirty.insert(dir.join(OsStr::from_bytes(&name[..name_len])));
+            }
+        }
+        Ok(result)
+    }
+}
+
+impl Drop for Inotify {
+    fn drop(&mut self) {
+        unsafe { libc::close(self.fd) };
+    }
+}
+
+fn flush_batch(
+    params: &Params,
+    results: &mut [Option<Result<String, Error>>],
+    indexes: &mut Vec<usize>,
+    inputs: &mut Vec<Vec<u8>>,
+) {
+    for (i, hash) in indexes.drain(..).zip(hash_batch(params, inputs)) {
+        results[i] = Some(Ok(hash));
+    }
+    inputs.clear();
+}
+
+// Hash a slice of paths on the current thread, batching the small files.
+fn hash_chunk(opt: &Opt, params: &Params, paths: &[PathBuf]) -> Vec<Result<String, Error>> {
+    let mut results = Vec::with_capacity(paths.len());
+    let mut batch_indexes = Vec::new();
+    let mut batch_inputs = Vec::new();
+    for path in paths {
+        // O_DIRECT reads are the caller's explicit choice, so don't batch them.
+        let small_file = if opt.direct {
+            Ok(None)
+        } else {
+            read_small_file(opt, path)
+        };
+        match small_file {
+            Ok(Some(contents)) => {
+                batch_indexes.push(results.len());
+                batch_inputs.push(contents);
+                results.push(None);
+                if batch_inputs.len() >= MAX_BATCH_FILES {
+                    flush_batch(params, &mut results, &mut batch_indexes, &mut batch_inputs);
+                }
+            }
+            Ok(None) => results.push(Some(hash_file(opt, params, path))),
+            Err(e) => results.push(Some(Err(e.into()))),
+        }
+    }
+    flush_batch(params, &mut results, &mut batch_indexes, &mut batch_inputs);
+    results.into_iter().map(Option::unwrap).collect()
+}
+
+// Hash all the paths, split across all the CPUs.
+fn hash_paths(opt: &Opt, params: &Params, paths: &[PathBuf]) -> Vec<Result<String, Error>> {
+    let num_threads = thread::available_parallelism().map_or(1, |n| n.get());
+    let chunk_len = std::cmp::max(
+        MAX_BATCH_FILES,
+        (paths.len() + num_threads - 1) / num_threads,
+    );
+    thread::scope(|scope| {
+        let handles: Vec<_> = paths
+            .chunks(chunk_len)
+            .map(|chunk| scope.spawn(move || hash_chunk(opt, params, chunk)))
+            .collect();
+        handles
+            .into_iter()
+            .flat_map(|handle| handle.join().unwrap())
+            .collect()
+    })
+}
+
+fn load_manifest(path: &Path) -> io::Result<BTreeMap<PathBuf, String>> {
+    let mut manifest = BTreeMap::new();
+    let contents = match fs::read_to_string(path) {
+        Ok(contents) => contents,
+        Err(e) if e.kind() == io::ErrorKind::NotFound => return Ok(manifest),
+        Err(e) => return Err(e),
+    };
+    for line in contents.lines() {
+        match line.find("  ") {
+            Some(i) => manifest.insert(PathBuf::from(&line[i + 2..]), line[..i].to_string()),
+            None => {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidData,
+                    "malformed manifest line",
+                ))
+            }
+        };
+    }
+    Ok(manifest)
+}
+
+struct Watcher<'a> {
+    opt: &'a Opt,
+    params: &'a Params,
+    root: PathBuf,
+    inotify: Inotify,
+    manifest: BTreeMap<PathBuf, String>,
+    manifest_path: Option<PathBuf>,
+    // The manifest file and its temporary file, which we write ourselves.
+    ignored: Vec<PathBuf>,
+}
+
+impl<'a> Watcher<'a> {
+    fn is_ignored(&self, path: &Path) -> bool {
+        let name = path.file_name();
+        if !self.ignored.iter().any(|p| p.file_name() == name) {
+            return false;
+        }
+        match path.parent().and_then(|p| p.canonicalize().ok()) {
+            Some(parent) => self.ignored.contains(&parent.join(name.unwrap())),
+            None => false,
+        }
+    }
+
+    // Watch `dir` and every directory under it, and collect the regular files.
+    // The watch goes on before the directory is listed, so that nothing
+    // created in between is missed.
+    fn watch_tree(&mut self, dir: &Path, files: &mut Vec<PathBuf>) -> io::Result<()> {
+        self.inotify.add_watch(dir)?;
+        for entry in fs::read_dir(dir)? {
+            let entry = entry?;
+            let path = entry.path();
+            let file_type = entry.file_type()?;
+            if file_type.is_dir() {
+                if let Err(e) = self.watch_tree(&path, files) {
+                    eprintln!("blake2: {}: {}", path.to_string_lossy(), e);
+                }
+            } else if file_type.is_file() && !self.is_ignored(&path) {
+                files.push(path);
+            }
+        }
+        Ok(())
+    }
+
+    // Hash `files`, drop everything else under the `removed` paths from the
+    // manifest, and print a record for each change.
+    fn apply(
+        &mut self,
+        files: Vec<PathBuf>,
+        mut removed: Vec<PathBuf>,
+        output: &mut impl Write,
+    ) -> io::Result<()> {
+        let mut records = BTreeMap::new();
+        let mut present = BTreeSet::new();
+        let results = hash_paths(self.opt, self.params, &files);
+        for (path, result) in files.into_iter().zip(results) {
+            match result {
+                Ok(hash) => {
+                    match self.manifest.insert(path.clone(), hash.clone()) {
+                        None => {
+                            records.insert(path.clone(), format!("A {}", hash));
+                        }
+                        Some(old) if old != hash => {
+                            records.insert(path.clone(), format!("M {}", hash));
+                        }
+                        Some(_) => {}
+                    }
+                    present.insert(path);
+                }
+                // The file went away between the event and the read. Its
+                // deletion event will come later, but handle it now.
+                Err(_) if fs::symlink_metadata(&path).is_err() => removed.push(path),
+                Err(e) => {
+                    output.flush()?;
+                    eprintln!("blake2: {}: {}", path.to_string_lossy(), e);
+                    present.insert(path);
+                }
+            }
+        }
+        for dir in removed {
+            // Paths sort right after their parents, so everything under `dir`
+            // is contiguous.
+            let gone: Vec<PathBuf> = self
+                .manifest
+                .range(dir.clone()..)
+                .take_while(|(path, _)| path.starts_with(&dir))
+                .filter(|(path, _)| !present.contains(*path))
+                .map(|(path, _)| path.clone())
+                .collect();
+            for path in gone {
+                let old = self.manifest.remove(&path).unwrap();
+                records.insert(path, format!("D {}", old));
+            }
+        }
+        if records.is_empty() {
+            return Ok(());
+        }
+        // Save first, so that anyone who sees a record can trust the manifest.
+        self.save_manifest()?;
+        for (path, record) in &records {
+            writeln!(output, "{}  {}", record, path.to_string_lossy())?;
+        }
+        output.flush()
+    }
+
+    fn save_manifest(&self) -> io::Result<()> {
+        let path = match &self.manifest_path {
+            Some(path) => path,
+            None => return Ok(()),
+        };
+        let tmp_path = tmp_path(path);
+        let mut file = io::BufWriter::new(File::create(&tmp_path)?);
+        for (path, hash) in &self.manifest {
+            writeln!(file, "{}  {}", hash, path.to_string_lossy())?;
+        }
+        file.into_inner()?.sync_all()?;
+        fs::rename(&tmp_path, path)
+    }
+
+    // Watch and walk the whole tree, and diff it against the manifest. This
+    // is how watching starts, and how it recovers from lost events.
+    fn rescan(&mut self, output: &mut impl Write) -> io::Result<()> {
+        let root = self.root.clone();
+        self.inotify.remove_under(&root);
+        let mut files = Vec::new();
+        // Watching the same directory twice gives the same descriptor.
+        self.inotify.root_wd = self.inotify.add_watch(&root)?;
+        self.watch_tree(&root, &mut files)?;
+        let removed = self.manifest.keys().cloned().collect();
+        self.apply(files, removed, output)
+    }
+
+    fn update(&mut self, dirty: BTreeSet<PathBuf>, output: &mut impl Write) -> io::Result<()> {
+        let mut files = Vec::new();
+        let mut removed = Vec::new();
+        for path in dirty {
+            if self.is_ignored(&path) {
+                continue;
+            }
+            match fs::symlink_metadata(&path) {
+                Ok(metadata) if metadata.is_file() => files.push(path),
+                Ok(metadata) if metadata.is_dir() => {
+                    // A directory that was created or moved in. It replaces
+                    // whatever was at this path before.
+                    self.inotify.remove_under(&path);
+                    if let Err(e) = self.watch_tree(&path, &mut files) {
+                        eprintln!("blake2: {}: {}", path.to_string_lossy(), e);
+                    }
+                    removed.push(path);
+                }
+                // Symlinks and special files aren't hashed, so if one of
+                // those replaced a file, it counts as a removal.
+                Ok(_) => removed.push(path),
+                Err(e) if e.kind() == io::ErrorKind::NotFound => {
+                    self.inotify.remove_under(&path);
+                    removed.push(path);
+                }
+                Err(e) => eprintln!("blake2: {}: {}", path.to_string_lossy(), e),
+            }
+        }
+        self.apply(files, removed, output)
+    }
+}
+
+fn tmp_path(path: &Path) -> PathBuf {
+    let mut name = path.file_name().unwrap_or_default().to_owned();
+    name.push(".tmp");
+    path.with_file_name(name)
+}
+
+/// Hash everything under `root`, then keep watching it and print a record
+/// whenever a file is added, changed, or removed. This only returns when the
+/// root directory goes away, or on an error.
+pub fn watch(
+    opt: &Opt,
+    params: &Params,
+    root: &Path,
+    manifest_path: Option<&Path>,
+    mut output: impl Write,
+) -> io::Result<()> {
+    if !fs::metadata(root)?.is_dir() {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidInput,
+            "--watch requires a directory",
+        ));
+    }
+    let mut ignored = Vec::new();
+    let mut manifest = BTreeMap::new();
+    if let Some(path) = manifest_path {
+        manifest = load_manifest(path)?;
+        let parent = match path.parent() {
+            Some(parent) if parent != Path::new("") => parent,
+            _ => Path::new("."),
+        };
+        let parent = parent.canonicalize()?;
+        ignored.push(parent.join(path.file_name().unwrap_or_default()));
+        ignored.push(parent.join(tmp_path(path).file_name().unwrap()));
+    }
+    let mut watcher = Watcher {
+        opt,
+        params,
+        root: root.to_owned(),
+        inotify: Inotify::new()?,
+        manifest,
+        manifest_path: manifest_path.map(Path::to_owned),
+        ignored,
+    };
+    watcher.rescan(&mut output)?;
+    // Write the manifest even if nothing changed, in case it didn't exist.
+    watcher.save_manifest()?;
+
+    loop {
+        let mut dirty = BTreeSet::new();
+        watcher.inotify.wait(None)?;
+        let mut events = watcher.inotify.read(&mut dirty)?;
+        let start = Instant::now();
+        while let Events::Changed = events {
+            let remaining = match MAX_DELAY.checked_sub(start.elapsed()) {
+                Some(remaining) => remaining,
+                None => break,
+            };
+            if !watcher
+                .inotify
+                .wait(Some(std::cmp::min(SETTLE, remaining)))?
+            {
+                break;
+            }
+            events = watcher.inotify.read(&mut dirty)?;
+        }
+        match events {
+            Events::Changed => watcher.update(dirty, &mut output)?,
+            Events::Overflow => watcher.rescan(&mut output)?,
+            Events::RootGone => return Ok(()),
+        }
+    }
+}
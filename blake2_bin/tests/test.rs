@@ -164,3 +164,402 @@ fn test_all_parameters_blake2sp() {
         .expect("blake2 failed");
     assert_eq!("947d4c671e2794f5e1a57daeca97bb46ed66", output);
 }
+
+#[test]
+fn test_offset_and_range_length() {
+    // Big enough to cover several O_DIRECT buffers.
+    let input: Vec<u8> = (0..3_000_000u32).map(|i| (i % 251) as u8).collect();
+    // O_DIRECT fails with EINVAL on tmpfs, which is where the system temp
+    // directory often is. The target directory is usually on a real disk.
+    let mut file = NamedTempFile::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+    file.write_all(&input).unwrap();
+    file.flush().unwrap();
+
+    let ranges: &[(usize, Option<usize>)] = &[
+        (0, None),
+        (5000, None),
+        (5000, Some(2_500_000)),
+        (4096, Some(1 << 20)),
+        (2_999_999, Some(10)),
+        (4_000_000, None),
+    ];
+    for &(offset, range_length) in ranges {
+        let start = std::cmp::min(offset, input.len());
+        let end = range_length.map_or(input.len(), |len| std::cmp::min(start + len, input.len()));
+        let expected = cmd!(blake2_exe())
+            .stdin_bytes(&input[start..end])
+            .read()
+            .expect("blake2 failed");
+
+        let mut flags = vec![format!("--offset={}", offset)];
+        if let Some(len) = range_length {
+            flags.push(format!("--range-length={}", len));
+        }
+        let modes: &[&[&str]] = if cfg!(target_os = "linux") {
+            &[&[], &["--mmap"], &["--direct"]]
+        } else {
+            &[&[], &["--mmap"]]
+        };
+        for mode in modes {
+            let mut args: Vec<String> = flags.clone();
+            args.extend(mode.iter().map(|s| s.to_string()));
+            args.push(file.path().to_string_lossy().into_owned());
+            let output = cmd(blake2_exe(), &args).read().expect("blake2 failed");
+            assert_eq!(expected, output, "{:?}", args);
+        }
+
+        let stdin_output = cmd(blake2_exe(), &flags)
+            .stdin_bytes(&input[..])
+            .read()
+            .expect("blake2 failed");
+        assert_eq!(expected, stdin_output, "stdin {:?}", flags);
+    }
+}
+
+#[test]
+fn test_files_from() {
+    let dir = tempfile::tempdir().unwrap();
+    // Small files get batched, and the large one in the middle doesn't.
+    let mut paths = Vec::new();
+    for (i, &len) in [0, 1, 100, 1_000_000, 65, 4096, 7].iter().enumerate() {
+        let path = dir.path().join(format!("file{}", i));
+        let contents: Vec<u8> = (0..len).map(|j| (j % 251) as u8).collect();
+        std::fs::write(&path, contents).unwrap();
+        paths.push(path);
+    }
+    let missing = dir.path().join("missing");
+
+    for flags in &[
+        &["-b"][..],
+        &["-s"],
+        &["-bp"],
+        &["--length=16", "--offset=3"],
+    ] {
+        let expected = cmd(
+            blake2_exe(),
+            flags
+                .iter()
+                .map(|s| s.to_string())
+                .chain(paths.iter().map(|p| p.to_string_lossy().into_owned())),
+        )
+        .read()
+        .expect("blake2 failed");
+
+        let newline_list: String = paths
+            .iter()
+            .map(|p| format!("{}\n", p.to_string_lossy()))
+            .collect();
+        let output = cmd(blake2_exe(), flags.iter().chain(&["--files-from", "-"]))
+            .stdin_bytes(newline_list)
+            .read()
+            .expect("blake2 failed");
+        assert_eq!(expected, output, "{:?}", flags);
+
+        let mut null_list = NamedTempFile::new().unwrap();
+        for path in &paths {
+            null_list
+                .write_all(path.to_string_lossy().as_bytes())
+                .unwrap();
+            null_list.write_all(b"\0").unwrap();
+        }
+        null_list.flush().unwrap();
+        let list_arg = format!("--files-from={}", null_list.path().to_string_lossy());
+        let output = cmd(blake2_exe(), flags.iter().chain(&["-0", &list_arg[..]]))
+            .read()
+            .expect("blake2 failed");
+        assert_eq!(expected, output, "{:?}", flags);
+    }
+
+    // A missing file is reported, but the rest of the list still gets hashed.
+    let list = format!(
+        "{}\n{}\n{}\n",
+        paths[0].to_string_lossy(),
+        missing.to_string_lossy(),
+        paths[1].to_string_lossy(),
+    );
+    let output = cmd!(blake2_exe(), "--files-from", "-")
+        .stdin_bytes(list)
+        .stderr_null()
+        .stdout_capture()
+        .unchecked()
+        .run()
+        .unwrap();
+    assert!(!output.status.success());
+    let stdout = String::from_utf8(output.stdout).unwrap();
+    let lines: Vec<&str> = stdout.lines().collect();
+    assert_eq!(2, lines.len());
+    assert!(lines[0].ends_with(&*paths[0].to_string_lossy()));
+    assert!(lines[1].ends_with(&*paths[1].to_string_lossy()));
+}
+
+#[test]
+fn test_tree_digest() {
+    let dir = tempfile::tempdir().unwrap();
+    let root = dir.path().join("root");
+    std::fs::create_dir_all(root.join("sub")).unwrap();
+    std::fs::write(root.join("file"), b"foo").unwrap();
+    std::fs::write(root.join("sub/file"), b"bar").unwrap();
+    let cache = dir.path().join("cache");
+
+    let expected = blake2_bin::tree::TreeDigest::new()
+        .hash_length(32)
+        .digest(&root, None)
+        .unwrap()
+        .to_hex();
+    let output = cmd!(blake2_exe(), "--tree-digest", "--length=32", &root)
+        .read()
+        .expect("blake2 failed");
+    assert_eq!(expected, output);
+    let cache_arg = format!("--tree-cache={}", cache.to_string_lossy());
+    for _ in 0..2 {
+        let output = cmd!(
+            blake2_exe(),
+            "--tree-digest",
+            "--length=32",
+            &cache_arg,
+            &root
+        )
+        .read()
+        .expect("blake2 failed");
+        assert_eq!(expected, output);
+    }
+    assert!(cache.exists());
+
+    // Multiple inputs are labeled, like regular files.
+    let output = cmd!(blake2_exe(), "--tree-digest", &root, root.join("sub"))
+        .read()
+        .expect("blake2 failed");
+    let lines: Vec<&str> = output.lines().collect();
+    assert_eq!(2, lines.len());
+    assert!(lines[1].ends_with(&*root.join("sub").to_string_lossy()));
+
+    // Flags for the regular hash parameters are rejected.
+    let result = cmd!(blake2_exe(), "--tree-digest", "-s", &root)
+        .stderr_null()
+        .stdout_null()
+        .unchecked()
+        .run()
+        .unwrap();
+    assert!(!result.status.success());
+}
+
+#[test]
+fn test_verity() {
+    let dir = tempfile::tempdir().unwrap();
+    let image = dir.path().join("image");
+    let tree = dir.path().join("tree");
+    let mut contents: Vec<u8> = (0..1_000_000u32).map(|i| (i % 251) as u8).collect();
+    std::fs::write(&image, &contents).unwrap();
+
+    let flags = ["-s", "--salt=0001020304050607"];
+    let tree_arg = format!("--verity-build={}", tree.to_string_lossy());
+    let root = cmd!(blake2_exe(), flags[0], flags[1], &tree_arg, &image)
+        .read()
+        .expect("blake2 failed");
+
+    // The library gives the same tree and root.
+    let (expected_tree, expected_root) = blake2_bin::verity::Verity::blake2s()
+        .salt(&[0, 1, 2, 3, 4, 5, 6, 7])
+        .build(&contents[..])
+        .unwrap();
+    assert_eq!(hex::encode(expected_root), root);
+    assert_eq!(expected_tree, std::fs::read(&tree).unwrap());
+
+    let verify = |extra: &[&str]| {
+        let mut args: Vec<String> = flags.iter().map(|s| s.to_string()).collect();
+        args.push(format!("--verity-verify={}", tree.to_string_lossy()));
+        args.push(format!("--verity-root={}", root));
+        args.extend(extra.iter().map(|s| s.to_string()));
+        args.push(image.to_string_lossy().into_owned());
+        cmd(blake2_exe(), &args)
+            .stdout_null()
+            .stderr_null()
+            .unchecked()
+            .run()
+            .unwrap()
+            .status
+            .success()
+    };
+    assert!(verify(&[]));
+    assert!(verify(&["--offset=5000", "--range-length=10000"]));
+
+    // Corrupt one byte in block 100. Ranges that don't cover it still verify.
+    contents[100 * 4096 + 17] ^= 1;
+    std::fs::write(&image, &contents).unwrap();
+    assert!(!verify(&[]));
+    assert!(!verify(&["--offset=409600", "--range-length=1"]));
+    assert!(verify(&["--offset=0", "--range-length=409600"]));
+    assert!(verify(&["--offset=413696"]));
+}
+
+#[test]
+fn test_decompress() {
+    // More than one of the ring buffers, so that they get reused.
+    let contents: Vec<u8> = (0..3_000_000u32).map(|i| (i % 251) as u8).collect();
+    let dir = tempfile::tempdir().unwrap();
+    let plain = dir.path().join("plain");
+    std::fs::write(&plain, &contents).unwrap();
+
+    // Two concatenated gzip members, which decode as one stream.
+    let (first, second) = contents.split_at(1_000_000);
+    let mut gzip = Vec::new();
+    for part in &[first, second] {
+        let mut encoder = flate2::write::GzEncoder::new(Vec::new(), flate2::Compression::default());
+        encoder.write_all(part).unwrap();
+        gzip.extend(encoder.finish().unwrap());
+    }
+    let gzip_path = dir.path().join("plain.gz");
+    std::fs::write(&gzip_path, &gzip).unwrap();
+    let zstd = zstd::encode_all(&contents[..], 3).unwrap();
+    let zstd_path = dir.path().join("plain.zst");
+    std::fs::write(&zstd_path, &zstd).unwrap();
+
+    for flags in &[
+        &["-b"][..],
+        &["-bp"],
+        &["-s"],
+        &["--offset=1048000", "--range-length=1100000"],
+        &["--offset=5000000"],
+    ] {
+        let expected = cmd(blake2_exe(), flags.iter().chain(&[plain.to_str().unwrap()]))
+            .read()
+            .expect("blake2 failed");
+        for (format, path, compressed) in &[
+            ("--decompress=gzip", &gzip_path, &gzip),
+            ("--decompress=zstd", &zstd_path, &zstd),
+        ] {
+            let output = cmd(
+                blake2_exe(),
+                flags.iter().chain(&[*format, path.to_str().unwrap()]),
+            )
+            .read()
+            .expect("blake2 failed");
+            assert_eq!(expected, output, "{} {:?}", format, flags);
+            let output = cmd(blake2_exe(), flags.iter().chain(&[*format]))
+                .stdin_bytes(&compressed[..])
+                .read()
+                .expect("blake2 failed");
+            assert_eq!(expected, output, "{} {:?} stdin", format, flags);
+        }
+    }
+
+    // Garbage input is an error, not the hash of nothing.
+    let result = cmd!(blake2_exe(), "--decompress=gzip", &plain)
+        .stdout_null()
+        .stderr_null()
+        .unchecked()
+        .run()
+        .unwrap();
+    assert!(!result.status.success());
+}
+
+#[test]
+#[cfg(target_os = "linux")]
+fn test_watch() {
+    use std::io::BufRead;
+
+    let dir = tempfile::tempdir().unwrap();
+    let root = dir.path().join("root");
+    let manifest = dir.path().join("manifest");
+    std::fs::create_dir_all(root.join("sub")).unwrap();
+    std::fs::write(root.join("a"), b"foo").unwrap();
+    // Big enough that it doesn't get batched.
+    std::fs::write(root.join("sub/b"), vec![0x42; 100_000]).unwrap();
+    let hash = |path: &std::path::Path| {
+        cmd!(blake2_exe(), "--length=16", path)
+            .read()
+            .expect("blake2 failed")
+    };
+    let line = |kind: &str, hash: &str, path: &std::path::Path| {
+        format!("{} {}  {}", kind, hash, path.to_string_lossy())
+    };
+
+    // A manifest left over from an earlier run, which is out of date.
+    let stale = "00000000000000000000000000000000";
+    std::fs::write(
+        &manifest,
+        format!(
+            "{}  {}\n{}  {}\n",
+            stale,
+            root.join("a").to_string_lossy(),
+            stale,
+            root.join("gone").to_string_lossy(),
+        ),
+    )
+    .unwrap();
+
+    let reader = cmd!(
+        blake2_exe(),
+        "--length=16",
+        "--watch",
+        "--watch-manifest",
+        &manifest,
+        &root
+    )
+    .reader()
+    .unwrap();
+    let mut lines = std::io::BufReader::new(reader).lines();
+    let mut next_line = || lines.next().unwrap().unwrap();
+
+    // The initial records are the differences from the old manifest.
+    assert_eq!(
+        line("M", &hash(&root.join("a")), &root.join("a")),
+        next_line()
+    );
+    assert_eq!(line("D", stale, &root.join("gone")), next_line());
+    let b_hash = hash(&root.join("sub/b"));
+    assert_eq!(line("A", &b_hash, &root.join("sub/b")), next_line());
+
+    // A burst of writes usually gives one record, but a slow machine can
+    // spread it past the settle time. Allow intermediate records, as long as
+    // the last one has the final hash. Unchanged hashes aren't reported, so
+    // nothing for this file follows it.
+    for i in 0..10 {
+        std::fs::write(root.join("a"), format!("bar{}", i)).unwrap();
+    }
+    let a_final = line("M", &hash(&root.join("a")), &root.join("a"));
+    let a_suffix = format!("  {}", root.join("a").to_string_lossy());
+    loop {
+        let record = next_line();
+        if record == a_final {
+            break;
+        }
+        assert!(
+            record.starts_with("M ") && record.ends_with(&a_suffix),
+            "unexpected record: {}",
+            record
+        );
+    }
+
+    // A directory moved in gets watched and hashed.
+    let outside = dir.path().join("outside");
+    std::fs::create_dir(&outside).unwrap();
+    std::fs::write(outside.join("c"), b"baz").unwrap();
+    std::fs::rename(&outside, root.join("new")).unwrap();
+    let c_hash = hash(&root.join("new/c"));
+    assert_eq!(line("A", &c_hash, &root.join("new/c")), next_line());
+    std::fs::write(root.join("new/c"), b"qux").unwrap();
+    let c_hash = hash(&root.join("new/c"));
+    assert_eq!(line("M", &c_hash, &root.join("new/c")), next_line());
+
+    std::fs::remove_dir_all(root.join("sub")).unwrap();
+    assert_eq!(line("D", &b_hash, &root.join("sub/b")), next_line());
+
+    let expected_manifest = format!(
+        "{}  {}\n{}  {}\n",
+        hash(&root.join("a")),
+        root.join("a").to_string_lossy(),
+        c_hash,
+        root.join("new/c").to_string_lossy(),
+    );
+    assert_eq!(
+        expected_manifest,
+        std::fs::read_to_string(&manifest).unwrap()
+    );
+
+    // Removing the root ends the watch successfully.
+    std::fs::remove_dir_all(&root).unwrap();
+    for line in lines {
+        line.unwrap();
+    }
+}
@@ -4,13 +4,14 @@ use core::arch::x86::*;
 use core::arch::x86_64::*;
 
 use crate::guts::{
-    assemble_count, count_high, count_low, final_block, flag_word, input_debug_asserts, Finalize,
-    Job, LastNode, Stride,
+    assemble_count, count_high, count_low, final_block, flag_word, input_debug_asserts, ChainStep,
+    Finalize, Job, LastNode, Stride,
 };
 use crate::{Count, Word, BLOCKBYTES, IV, SIGMA};
-use arrayref::{array_refs, mut_array_refs};
+use arrayref::{array_ref, array_refs, mut_array_refs};
 use core::cmp;
 use core::mem;
+use core::ptr;
 
 pub const DEGREE: usize = 4;
 
@@ -927,3 +928,967 @@ pub unsafe fn compress4_loop(jobs: &mut [Job; DEGREE], finalize: Finalize, strid
         job.input = &job.input[consumed..];
     }
 }
+
+// Two independent groups of DEGREE jobs, for compress8_loop. A single group's
+// rounds are one long chain of dependent adds, xors, and rotations, and wide
+// cores have execution ports to spare while they wait on it. Each step here
+// is done for group A and then for group B, so that the two chains can fill
+// in each other's gaps. This has twice the live state of round(), and it
+// spills more, so whether it's faster depends on the core.
+#[inline(always)]
+unsafe fn round_x2(
+    va: &mut [__m256i; 16],
+    vb: &mut [__m256i; 16],
+    ma: &[__m256i; 16],
+    mb: &[__m256i; 16],
+    r: usize,
+) {
+    va[0] = add(va[0], ma[SIGMA[r][0] as usize]);
+    va[1] = add(va[1], ma[SIGMA[r][2] as usize]);
+    va[2] = add(va[2], ma[SIGMA[r][4] as usize]);
+    va[3] = add(va[3], ma[SIGMA[r][6] as usize]);
+    vb[0] = add(vb[0], mb[SIGMA[r][0] as usize]);
+    vb[1] = add(vb[1], mb[SIGMA[r][2] as usize]);
+    vb[2] = add(vb[2], mb[SIGMA[r][4] as usize]);
+    vb[3] = add(vb[3], mb[SIGMA[r][6] as usize]);
+    va[0] = add(va[0], va[4]);
+    va[1] = add(va[1], va[5]);
+    va[2] = add(va[2], va[6]);
+    va[3] = add(va[3], va[7]);
+    vb[0] = add(vb[0], vb[4]);
+    vb[1] = add(vb[1], vb[5]);
+    vb[2] = add(vb[2], vb[6]);
+    vb[3] = add(vb[3], vb[7]);
+    va[12] = xor(va[12], va[0]);
+    va[13] = xor(va[13], va[1]);
+    va[14] = xor(va[14], va[2]);
+    va[15] = xor(va[15], va[3]);
+    vb[12] = xor(vb[12], vb[0]);
+    vb[13] = xor(vb[13], vb[1]);
+    vb[14] = xor(vb[14], vb[2]);
+    vb[15] = xor(vb[15], vb[3]);
+    va[12] = rot32(va[12]);
+    va[13] = rot32(va[13]);
+    va[14] = rot32(va[14]);
+    va[15] = rot32(va[15]);
+    vb[12] = rot32(vb[12]);
+    vb[13] = rot32(vb[13]);
+    vb[14] = rot32(vb[14]);
+    vb[15] = rot32(vb[15]);
+    va[8] = add(va[8], va[12]);
+    va[9] = add(va[9], va[13]);
+    va[10] = add(va[10], va[14]);
+    va[11] = add(va[11], va[15]);
+    vb[8] = add(vb[8], vb[12]);
+    vb[9] = add(vb[9], vb[13]);
+    vb[10] = add(vb[10], vb[14]);
+    vb[11] = add(vb[11], vb[15]);
+    va[4] = xor(va[4], va[8]);
+    va[5] = xor(va[5], va[9]);
+    va[6] = xor(va[6], va[10]);
+    va[7] = xor(va[7], va[11]);
+    vb[4] = xor(vb[4], vb[8]);
+    vb[5] = xor(vb[5], vb[9]);
+    vb[6] = xor(vb[6], vb[10]);
+    vb[7] = xor(vb[7], vb[11]);
+    va[4] = rot24(va[4]);
+    va[5] = rot24(va[5]);
+    va[6] = rot24(va[6]);
+    va[7] = rot24(va[7]);
+    vb[4] = rot24(vb[4]);
+    vb[5] = rot24(vb[5]);
+    vb[6] = rot24(vb[6]);
+    vb[7] = rot24(vb[7]);
+    va[0] = add(va[0], ma[SIGMA[r][1] as usize]);
+    va[1] = add(va[1], ma[SIGMA[r][3] as usize]);
+    va[2] = add(va[2], ma[SIGMA[r][5] as usize]);
+    va[3] = add(va[3], ma[SIGMA[r][7] as usize]);
+    vb[0] = add(vb[0], mb[SIGMA[r][1] as usize]);
+    vb[1] = add(vb[1], mb[SIGMA[r][3] as usize]);
+    vb[2] = add(vb[2], mb[SIGMA[r][5] as usize]);
+    vb[3] = add(vb[3], mb[SIGMA[r][7] as usize]);
+    va[0] = add(va[0], va[4]);
+    va[1] = add(va[1], va[5]);
+    va[2] = add(va[2], va[6]);
+    va[3] = add(va[3], va[7]);
+    vb[0] = add(vb[0], vb[4]);
+    vb[1] = add(vb[1], vb[5]);
+    vb[2] = add(vb[2], vb[6]);
+    vb[3] = add(vb[3], vb[7]);
+    va[12] = xor(va[12], va[0]);
+    va[13] = xor(va[13], va[1]);
+    va[14] = xor(va[14], va[2]);
+    va[15] = xor(va[15], va[3]);
+    vb[12] = xor(vb[12], vb[0]);
+    vb[13] = xor(vb[13], vb[1]);
+    vb[14] = xor(vb[14], vb[2]);
+    vb[15] = xor(vb[15], vb[3]);
+    va[12] = rot16(va[12]);
+    va[13] = rot16(va[13]);
+    va[14] = rot16(va[14]);
+    va[15] = rot16(va[15]);
+    vb[12] = rot16(vb[12]);
+    vb[13] = rot16(vb[13]);
+    vb[14] = rot16(vb[14]);
+    vb[15] = rot16(vb[15]);
+    va[8] = add(va[8], va[12]);
+    va[9] = add(va[9], va[13]);
+    va[10] = add(va[10], va[14]);
+    va[11] = add(va[11], va[15]);
+    vb[8] = add(vb[8], vb[12]);
+    vb[9] = add(vb[9], vb[13]);
+    vb[10] = add(vb[10], vb[14]);
+    vb[11] = add(vb[11], vb[15]);
+    va[4] = xor(va[4], va[8]);
+    va[5] = xor(va[5], va[9]);
+    va[6] = xor(va[6], va[10]);
+    va[7] = xor(va[7], va[11]);
+    vb[4] = xor(vb[4], vb[8]);
+    vb[5] = xor(vb[5], vb[9]);
+    vb[6] = xor(vb[6], vb[10]);
+    vb[7] = xor(vb[7], vb[11]);
+    va[4] = rot63(va[4]);
+    va[5] = rot63(va[5]);
+    va[6] = rot63(va[6]);
+    va[7] = rot63(va[7]);
+    vb[4] = rot63(vb[4]);
+    vb[5] = rot63(vb[5]);
+    vb[6] = rot63(vb[6]);
+    vb[7] = rot63(vb[7]);
+
+    va[0] = add(va[0], ma[SIGMA[r][8] as usize]);
+    va[1] = add(va[1], ma[SIGMA[r][10] as usize]);
+    va[2] = add(va[2], ma[SIGMA[r][12] as usize]);
+    va[3] = add(va[3], ma[SIGMA[r][14] as usize]);
+    vb[0] = add(vb[0], mb[SIGMA[r][8] as usize]);
+    vb[1] = add(vb[1], mb[SIGMA[r][10] as usize]);
+    vb[2] = add(vb[2], mb[SIGMA[r][12] as usize]);
+    vb[3] = add(vb[3], mb[SIGMA[r][14] as usize]);
+    va[0] = add(va[0], va[5]);
+    va[1] = add(va[1], va[6]);
+    va[2] = add(va[2], va[7]);
+    va[3] = add(va[3], va[4]);
+    vb[0] = add(vb[0], vb[5]);
+    vb[1] = add(vb[1], vb[6]);
+    vb[2] = add(vb[2], vb[7]);
+    vb[3] = add(vb[3], vb[4]);
+    va[15] = xor(va[15], va[0]);
+    va[12] = xor(va[12], va[1]);
+    va[13] = xor(va[13], va[2]);
+    va[14] = xor(va[14], va[3]);
+    vb[15] = xor(vb[15], vb[0]);
+    vb[12] = xor(vb[12], vb[1]);
+    vb[13] = xor(vb[13], vb[2]);
+    vb[14] = xor(vb[14], vb[3]);
+    va[15] = rot32(va[15]);
+    va[12] = rot32(va[12]);
+    va[13] = rot32(va[13]);
+    va[14] = rot32(va[14]);
+    vb[15] = rot32(vb[15]);
+    vb[12] = rot32(vb[12]);
+    vb[13] = rot32(vb[13]);
+    vb[14] = rot32(vb[14]);
+    va[10] = add(va[10], va[15]);
+    va[11] = add(va[11], va[12]);
+    va[8] = add(va[8], va[13]);
+    va[9] = add(va[9], va[14]);
+    vb[10] = add(vb[10], vb[15]);
+    vb[11] = add(vb[11], vb[12]);
+    vb[8] = add(vb[8], vb[13]);
+    vb[9] = add(vb[9], vb[14]);
+    va[5] = xor(va[5], va[10]);
+    va[6] = xor(va[6], va[11]);
+    va[7] = xor(va[7], va[8]);
+    va[4] = xor(va[4], va[9]);
+    vb[5] = xor(vb[5], vb[10]);
+    vb[6] = xor(vb[6], vb[11]);
+    vb[7] = xor(vb[7], vb[8]);
+    vb[4] = xor(vb[4], vb[9]);
+    va[5] = rot24(va[5]);
+    va[6] = rot24(va[6]);
+    va[7] = rot24(va[7]);
+    va[4] = rot24(va[4]);
+    vb[5] = rot24(vb[5]);
+    vb[6] = rot24(vb[6]);
+    vb[7] = rot24(vb[7]);
+    vb[4] = rot24(vb[4]);
+    va[0] = add(va[0], ma[SIGMA[r][9] as usize]);
+    va[1] = add(va[1], ma[SIGMA[r][11] as usize]);
+    va[2] = add(va[2], ma[SIGMA[r][13] as usize]);
+    va[3] = add(va[3], ma[SIGMA[r][15] as usize]);
+    vb[0] = add(vb[0], mb[SIGMA[r][9] as usize]);
+    vb[1] = add(vb[1], mb[SIGMA[r][11] as usize]);
+    vb[2] = add(vb[2], mb[SIGMA[r][13] as usize]);
+    vb[3] = add(vb[3], mb[SIGMA[r][15] as usize]);
+    va[0] = add(va[0], va[5]);
+    va[1] = add(va[1], va[6]);
+    va[2] = add(va[2], va[7]);
+    va[3] = add(va[3], va[4]);
+    vb[0] = add(vb[0], vb[5]);
+    vb[1] = add(vb[1], vb[6]);
+    vb[2] = add(vb[2], vb[7]);
+    vb[3] = add(vb[3], vb[4]);
+    va[15] = xor(va[15], va[0]);
+    va[12] = xor(va[12], va[1]);
+    va[13] = xor(va[13], va[2]);
+    va[14] = xor(va[14], va[3]);
+    vb[15] = xor(vb[15], vb[0]);
+    vb[12] = xor(vb[12], vb[1]);
+    vb[13] = xor(vb[13], vb[2]);
+    vb[14] = xor(vb[14], vb[3]);
+    va[15] = rot16(va[15]);
+    va[12] = rot16(va[12]);
+    va[13] = rot16(va[13]);
+    va[14] = rot16(va[14]);
+    vb[15] = rot16(vb[15]);
+    vb[12] = rot16(vb[12]);
+    vb[13] = rot16(vb[13]);
+    vb[14] = rot16(vb[14]);
+    va[10] = add(va[10], va[15]);
+    va[11] = add(va[11], va[12]);
+    va[8] = add(va[8], va[13]);
+    va[9] = add(va[9], va[14]);
+    vb[10] = add(vb[10], vb[15]);
+    vb[11] = add(vb[11], vb[12]);
+    vb[8] = add(vb[8], vb[13]);
+    vb[9] = add(vb[9], vb[14]);
+    va[5] = xor(va[5], va[10]);
+    va[6] = xor(va[6], va[11]);
+    va[7] = xor(va[7], va[8]);
+    va[4] = xor(va[4], va[9]);
+    vb[5] = xor(vb[5], vb[10]);
+    vb[6] = xor(vb[6], vb[11]);
+    vb[7] = xor(vb[7], vb[8]);
+    vb[4] = xor(vb[4], vb[9]);
+    va[5] = rot63(va[5]);
+    va[6] = rot63(va[6]);
+    va[7] = rot63(va[7]);
+    va[4] = rot63(va[4]);
+    vb[5] = rot63(vb[5]);
+    vb[6] = rot63(vb[6]);
+    vb[7] = rot63(vb[7]);
+    vb[4] = rot63(vb[4]);
+}
+
+// Like compress4_transposed, but for two groups at once. Each argument is
+// an array with one entry per group.
+macro_rules! compress4x2_transposed {
+    (
+        $h_vecs:expr,
+        $msg_vecs:expr,
+        $count_low:expr,
+        $count_high:expr,
+        $lastblock:expr,
+        $lastnode:expr,
+    ) => {
+        let h_vecs: &mut [[__m256i; 8]; 2] = $h_vecs;
+        let msg_vecs: &[[__m256i; 16]; 2] = $msg_vecs;
+        let count_low: [__m256i; 2] = $count_low;
+        let count_high: [__m256i; 2] = $count_high;
+        let lastblock: [__m256i; 2] = $lastblock;
+        let lastnode: [__m256i; 2] = $lastnode;
+
+        let mut va = [
+            h_vecs[0][0],
+            h_vecs[0][1],
+            h_vecs[0][2],
+            h_vecs[0][3],
+            h_vecs[0][4],
+            h_vecs[0][5],
+            h_vecs[0][6],
+            h_vecs[0][7],
+            set1(IV[0]),
+            set1(IV[1]),
+            set1(IV[2]),
+            set1(IV[3]),
+            xor(set1(IV[4]), count_low[0]),
+            xor(set1(IV[5]), count_high[0]),
+            xor(set1(IV[6]), lastblock[0]),
+            xor(set1(IV[7]), lastnode[0]),
+        ];
+        let mut vb = [
+            h_vecs[1][0],
+            h_vecs[1][1],
+            h_vecs[1][2],
+            h_vecs[1][3],
+            h_vecs[1][4],
+            h_vecs[1][5],
+            h_vecs[1][6],
+            h_vecs[1][7],
+            set1(IV[0]),
+            set1(IV[1]),
+            set1(IV[2]),
+            set1(IV[3]),
+            xor(set1(IV[4]), count_low[1]),
+            xor(set1(IV[5]), count_high[1]),
+            xor(set1(IV[6]), lastblock[1]),
+            xor(set1(IV[7]), lastnode[1]),
+        ];
+
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 0);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 1);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 2);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 3);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 4);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 5);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 6);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 7);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 8);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 9);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 10);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 11);
+
+        for i in 0..8 {
+            h_vecs[0][i] = xor(xor(h_vecs[0][i], va[i]), va[i + 8]);
+            h_vecs[1][i] = xor(xor(h_vecs[1][i], vb[i]), vb[i + 8]);
+        }
+    };
+}
+
+// The final blocks of one group of jobs, with their count deltas and flags,
+// as compress4_loop prepares them.
+#[inline(always)]
+unsafe fn fin_vecs(
+    jobs: &[Job; DEGREE],
+    fin_offset: usize,
+    bufs: &mut [[u8; BLOCKBYTES]; DEGREE],
+    finalize: Finalize,
+    stride: Stride,
+) -> ([*const [u8; BLOCKBYTES]; DEGREE], __m256i, __m256i, __m256i) {
+    let mut blocks = [ptr::null(); DEGREE];
+    let mut lens = [0; DEGREE];
+    let mut last_block = [false; DEGREE];
+    let mut last_node = [false; DEGREE];
+    for (i, buf) in bufs.iter_mut().enumerate() {
+        let (block, len, should_finalize) = final_block(jobs[i].input, fin_offset, buf, stride);
+        blocks[i] = block;
+        lens[i] = len as Word;
+        last_block[i] = finalize.yes() && should_finalize;
+        last_node[i] = finalize.yes() && should_finalize && jobs[i].last_node.yes();
+    }
+    (
+        blocks,
+        loadu(&lens),
+        flags_vec(last_block),
+        flags_vec(last_node),
+    )
+}
+
+#[inline(always)]
+unsafe fn msg_blocks(jobs: &[Job; DEGREE], offset: usize) -> [*const [u8; BLOCKBYTES]; DEGREE] {
+    let mut blocks = [ptr::null(); DEGREE];
+    for i in 0..DEGREE {
+        blocks[i] = jobs[i].input.as_ptr().add(offset) as *const [u8; BLOCKBYTES];
+    }
+    blocks
+}
+
+// Like compress4_loop, but for 8 jobs in two interleaved groups. See round_x2.
+#[target_feature(enable = "avx2")]
+pub unsafe fn compress8_loop(jobs: &mut [Job; 2 * DEGREE], finalize: Finalize, stride: Stride) {
+    // If we're not finalizing, there can't be a partial block at the end.
+    for job in jobs.iter() {
+        input_debug_asserts(job.input, finalize);
+    }
+
+    let min_len = jobs.iter().map(|job| job.input.len()).min().unwrap();
+    let mut fin_offset = min_len.saturating_sub(1);
+    fin_offset -= fin_offset % stride.padded_blockbytes();
+
+    let (jobs_a, jobs_b) = mut_array_refs!(&mut *jobs, DEGREE, DEGREE);
+    let groups: [&mut [Job; DEGREE]; 2] = [jobs_a, jobs_b];
+    let mut h_vecs = [
+        transpose_state_vecs(groups[0]),
+        transpose_state_vecs(groups[1]),
+    ];
+    let (counts_lo_a, counts_hi_a) = load_counts(groups[0]);
+    let (counts_lo_b, counts_hi_b) = load_counts(groups[1]);
+    let mut counts_lo = [counts_lo_a, counts_lo_b];
+    let mut counts_hi = [counts_hi_a, counts_hi_b];
+
+    // Performance note, making these buffers mem::uninitialized() seems to
+    // cause problems in the optimizer.
+    let mut bufs_a = [[0; BLOCKBYTES]; DEGREE];
+    let mut bufs_b = [[0; BLOCKBYTES]; DEGREE];
+    let fin_a = fin_vecs(groups[0], fin_offset, &mut bufs_a, finalize, stride);
+    let fin_b = fin_vecs(groups[1], fin_offset, &mut bufs_b, finalize, stride);
+
+    // The main loop.
+    let mut offset = 0;
+    loop {
+        let blocks;
+        let counts_delta;
+        let last_block;
+        let last_node;
+        if offset == fin_offset {
+            blocks = [fin_a.0, fin_b.0];
+            counts_delta = [fin_a.1, fin_b.1];
+            last_block = [fin_a.2, fin_b.2];
+            last_node = [fin_a.3, fin_b.3];
+        } else {
+            blocks = [msg_blocks(groups[0], offset), msg_blocks(groups[1], offset)];
+            counts_delta = [set1(BLOCKBYTES as Word); 2];
+            last_block = [set1(0); 2];
+            last_node = [set1(0); 2];
+        }
+
+        let m_vecs = [transpose_msg_vecs(blocks[0]), transpose_msg_vecs(blocks[1])];
+        add_to_counts(&mut counts_lo[0], &mut counts_hi[0], counts_delta[0]);
+        add_to_counts(&mut counts_lo[1], &mut counts_hi[1], counts_delta[1]);
+        compress4x2_transposed!(
+            &mut h_vecs,
+            &m_vecs,
+            counts_lo,
+            counts_hi,
+            last_block,
+            last_node,
+        );
+
+        // Check for termination before bumping the offset, to avoid overflow.
+        if offset == fin_offset {
+            break;
+        }
+
+        offset += stride.padded_blockbytes();
+    }
+
+    // Write out the results.
+    let [jobs_a, jobs_b] = groups;
+    untranspose_state_vecs(&h_vecs[0], jobs_a);
+    untranspose_state_vecs(&h_vecs[1], jobs_b);
+    store_counts(jobs_a, counts_lo[0], counts_hi[0]);
+    store_counts(jobs_b, counts_lo[1], counts_hi[1]);
+    let max_consumed = offset.saturating_add(stride.padded_blockbytes());
+    for job in jobs.iter_mut() {
+        let consumed = cmp::min(max_consumed, job.input.len());
+        job.input = &job.input[consumed..];
+    }
+}
+
+// One round of compress4_transposed for four jobs, plus the same round for a
+// fifth job in scalar registers. The vector code runs on the SIMD ports and
+// the scalar code runs on the integer ALUs, which would otherwise be idle.
+// With BMI2, the scalar rotations compile to RORX, which doesn't clobber
+// flags or its input. Each group of four vector statements is followed by
+// its four scalar counterparts, so that the scheduler sees both streams in
+// the same window.
+#[inline(always)]
+unsafe fn round_hybrid(
+    v: &mut [__m256i; 16],
+    w: &mut [Word; 16],
+    m: &[__m256i; 16],
+    mw: &[Word; 16],
+    r: usize,
+) {
+    v[0] = add(v[0], m[SIGMA[r][0] as usize]);
+    v[1] = add(v[1], m[SIGMA[r][2] as usize]);
+    v[2] = add(v[2], m[SIGMA[r][4] as usize]);
+    v[3] = add(v[3], m[SIGMA[r][6] as usize]);
+    w[0] = w[0].wrapping_add(mw[SIGMA[r][0] as usize]);
+    w[1] = w[1].wrapping_add(mw[SIGMA[r][2] as usize]);
+    w[2] = w[2].wrapping_add(mw[SIGMA[r][4] as usize]);
+    w[3] = w[3].wrapping_add(mw[SIGMA[r][6] as usize]);
+    v[0] = add(v[0], v[4]);
+    v[1] = add(v[1], v[5]);
+    v[2] = add(v[2], v[6]);
+    v[3] = add(v[3], v[7]);
+    w[0] = w[0].wrapping_add(w[4]);
+    w[1] = w[1].wrapping_add(w[5]);
+    w[2] = w[2].wrapping_add(w[6]);
+    w[3] = w[3].wrapping_add(w[7]);
+    v[12] = xor(v[12], v[0]);
+    v[13] = xor(v[13], v[1]);
+    v[14] = xor(v[14], v[2]);
+    v[15] = xor(v[15], v[3]);
+    w[12] ^= w[0];
+    w[13] ^= w[1];
+    w[14] ^= w[2];
+    w[15] ^= w[3];
+    v[12] = rot32(v[12]);
+    v[13] = rot32(v[13]);
+    v[14] = rot32(v[14]);
+    v[15] = rot32(v[15]);
+    w[12] = w[12].rotate_right(32);
+    w[13] = w[13].rotate_right(32);
+    w[14] = w[14].rotate_right(32);
+    w[15] = w[15].rotate_right(32);
+    v[8] = add(v[8], v[12]);
+    v[9] = add(v[9], v[13]);
+    v[10] = add(v[10], v[14]);
+    v[11] = add(v[11], v[15]);
+    w[8] = w[8].wrapping_add(w[12]);
+    w[9] = w[9].wrapping_add(w[13]);
+    w[10] = w[10].wrapping_add(w[14]);
+    w[11] = w[11].wrapping_add(w[15]);
+    v[4] = xor(v[4], v[8]);
+    v[5] = xor(v[5], v[9]);
+    v[6] = xor(v[6], v[10]);
+    v[7] = xor(v[7], v[11]);
+    w[4] ^= w[8];
+    w[5] ^= w[9];
+    w[6] ^= w[10];
+    w[7] ^= w[11];
+    v[4] = rot24(v[4]);
+    v[5] = rot24(v[5]);
+    v[6] = rot24(v[6]);
+    v[7] = rot24(v[7]);
+    w[4] = w[4].rotate_right(24);
+    w[5] = w[5].rotate_right(24);
+    w[6] = w[6].rotate_right(24);
+    w[7] = w[7].rotate_right(24);
+    v[0] = add(v[0], m[SIGMA[r][1] as usize]);
+    v[1] = add(v[1], m[SIGMA[r][3] as usize]);
+    v[2] = add(v[2], m[SIGMA[r][5] as usize]);
+    v[3] = add(v[3], m[SIGMA[r][7] as usize]);
+    w[0] = w[0].wrapping_add(mw[SIGMA[r][1] as usize]);
+    w[1] = w[1].wrapping_add(mw[SIGMA[r][3] as usize]);
+    w[2] = w[2].wrapping_add(mw[SIGMA[r][5] as usize]);
+    w[3] = w[3].wrapping_add(mw[SIGMA[r][7] as usize]);
+    v[0] = add(v[0], v[4]);
+    v[1] = add(v[1], v[5]);
+    v[2] = add(v[2], v[6]);
+    v[3] = add(v[3], v[7]);
+    w[0] = w[0].wrapping_add(w[4]);
+    w[1] = w[1].wrapping_add(w[5]);
+    w[2] = w[2].wrapping_add(w[6]);
+    w[3] = w[3].wrapping_add(w[7]);
+    v[12] = xor(v[12], v[0]);
+    v[13] = xor(v[13], v[1]);
+    v[14] = xor(v[14], v[2]);
+    v[15] = xor(v[15], v[3]);
+    w[12] ^= w[0];
+    w[13] ^= w[1];
+    w[14] ^= w[2];
+    w[15] ^= w[3];
+    v[12] = rot16(v[12]);
+    v[13] = rot16(v[13]);
+    v[14] = rot16(v[14]);
+    v[15] = rot16(v[15]);
+    w[12] = w[12].rotate_right(16);
+    w[13] = w[13].rotate_right(16);
+    w[14] = w[14].rotate_right(16);
+    w[15] = w[15].rotate_right(16);
+    v[8] = add(v[8], v[12]);
+    v[9] = add(v[9], v[13]);
+    v[10] = add(v[10], v[14]);
+    v[11] = add(v[11], v[15]);
+    w[8] = w[8].wrapping_add(w[12]);
+    w[9] = w[9].wrapping_add(w[13]);
+    w[10] = w[10].wrapping_add(w[14]);
+    w[11] = w[11].wrapping_add(w[15]);
+    v[4] = xor(v[4], v[8]);
+    v[5] = xor(v[5], v[9]);
+    v[6] = xor(v[6], v[10]);
+    v[7] = xor(v[7], v[11]);
+    w[4] ^= w[8];
+    w[5] ^= w[9];
+    w[6] ^= w[10];
+    w[7] ^= w[11];
+    v[4] = rot63(v[4]);
+    v[5] = rot63(v[5]);
+    v[6] = rot63(v[6]);
+    v[7] = rot63(v[7]);
+    w[4] = w[4].rotate_right(63);
+    w[5] = w[5].rotate_right(63);
+    w[6] = w[6].rotate_right(63);
+    w[7] = w[7].rotate_right(63);
+    v[0] = add(v[0], m[SIGMA[r][8] as usize]);
+    v[1] = add(v[1], m[SIGMA[r][10] as usize]);
+    v[2] = add(v[2], m[SIGMA[r][12] as usize]);
+    v[3] = add(v[3], m[SIGMA[r][14] as usize]);
+    w[0] = w[0].wrapping_add(mw[SIGMA[r][8] as usize]);
+    w[1] = w[1].wrapping_add(mw[SIGMA[r][10] as usize]);
+    w[2] = w[2].wrapping_add(mw[SIGMA[r][12] as usize]);
+    w[3] = w[3].wrapping_add(mw[SIGMA[r][14] as usize]);
+    v[0] = add(v[0], v[5]);
+    v[1] = add(v[1], v[6]);
+    v[2] = add(v[2], v[7]);
+    v[3] = add(v[3], v[4]);
+    w[0] = w[0].wrapping_add(w[5]);
+    w[1] = w[1].wrapping_add(w[6]);
+    w[2] = w[2].wrapping_add(w[7]);
+    w[3] = w[3].wrapping_add(w[4]);
+    v[15] = xor(v[15], v[0]);
+    v[12] = xor(v[12], v[1]);
+    v[13] = xor(v[13], v[2]);
+    v[14] = xor(v[14], v[3]);
+    w[15] ^= w[0];
+    w[12] ^= w[1];
+    w[13] ^= w[2];
+    w[14] ^= w[3];
+    v[15] = rot32(v[15]);
+    v[12] = rot32(v[12]);
+    v[13] = rot32(v[13]);
+    v[14] = rot32(v[14]);
+    w[15] = w[15].rotate_right(32);
+    w[12] = w[12].rotate_right(32);
+    w[13] = w[13].rotate_right(32);
+    w[14] = w[14].rotate_right(32);
+    v[10] = add(v[10], v[15]);
+    v[11] = add(v[11], v[12]);
+    v[8] = add(v[8], v[13]);
+    v[9] = add(v[9], v[14]);
+    w[10] = w[10].wrapping_add(w[15]);
+    w[11] = w[11].wrapping_add(w[12]);
+    w[8] = w[8].wrapping_add(w[13]);
+    w[9] = w[9].wrapping_add(w[14]);
+    v[5] = xor(v[5], v[10]);
+    v[6] = xor(v[6], v[11]);
+    v[7] = xor(v[7], v[8]);
+    v[4] = xor(v[4], v[9]);
+    w[5] ^= w[10];
+    w[6] ^= w[11];
+    w[7] ^= w[8];
+    w[4] ^= w[9];
+    v[5] = rot24(v[5]);
+    v[6] = rot24(v[6]);
+    v[7] = rot24(v[7]);
+    v[4] = rot24(v[4]);
+    w[5] = w[5].rotate_right(24);
+    w[6] = w[6].rotate_right(24);
+    w[7] = w[7].rotate_right(24);
+    w[4] = w[4].rotate_right(24);
+    v[0] = add(v[0], m[SIGMA[r][9] as usize]);
+    v[1] = add(v[1], m[SIGMA[r][11] as usize]);
+    v[2] = add(v[2], m[SIGMA[r][13] as usize]);
+    v[3] = add(v[3], m[SIGMA[r][15] as usize]);
+    w[0] = w[0].wrapping_add(mw[SIGMA[r][9] as usize]);
+    w[1] = w[1].wrapping_add(mw[SIGMA[r][11] as usize]);
+    w[2] = w[2].wrapping_add(mw[SIGMA[r][13] as usize]);
+    w[3] = w[3].wrapping_add(mw[SIGMA[r][15] as usize]);
+    v[0] = add(v[0], v[5]);
+    v[1] = add(v[1], v[6]);
+    v[2] = add(v[2], v[7]);
+    v[3] = add(v[3], v[4]);
+    w[0] = w[0].wrapping_add(w[5]);
+    w[1] = w[1].wrapping_add(w[6]);
+    w[2] = w[2].wrapping_add(w[7]);
+    w[3] = w[3].wrapping_add(w[4]);
+    v[15] = xor(v[15], v[0]);
+    v[12] = xor(v[12], v[1]);
+    v[13] = xor(v[13], v[2]);
+    v[14] = xor(v[14], v[3]);
+    w[15] ^= w[0];
+    w[12] ^= w[1];
+    w[13] ^= w[2];
+    w[14] ^= w[3];
+    v[15] = rot16(v[15]);
+    v[12] = rot16(v[12]);
+    v[13] = rot16(v[13]);
+    v[14] = rot16(v[14]);
+    w[15] = w[15].rotate_right(16);
+    w[12] = w[12].rotate_right(16);
+    w[13] = w[13].rotate_right(16);
+    w[14] = w[14].rotate_right(16);
+    v[10] = add(v[10], v[15]);
+    v[11] = add(v[11], v[12]);
+    v[8] = add(v[8], v[13]);
+    v[9] = add(v[9], v[14]);
+    w[10] = w[10].wrapping_add(w[15]);
+    w[11] = w[11].wrapping_add(w[12]);
+    w[8] = w[8].wrapping_add(w[13]);
+    w[9] = w[9].wrapping_add(w[14]);
+    v[5] = xor(v[5], v[10]);
+    v[6] = xor(v[6], v[11]);
+    v[7] = xor(v[7], v[8]);
+    v[4] = xor(v[4], v[9]);
+    w[5] ^= w[10];
+    w[6] ^= w[11];
+    w[7] ^= w[8];
+    w[4] ^= w[9];
+    v[5] = rot63(v[5]);
+    v[6] = rot63(v[6]);
+    v[7] = rot63(v[7]);
+    v[4] = rot63(v[4]);
+    w[5] = w[5].rotate_right(63);
+    w[6] = w[6].rotate_right(63);
+    w[7] = w[7].rotate_right(63);
+    w[4] = w[4].rotate_right(63);
+}
+
+// Like compress4_transposed, with a fifth job carried along in scalar words.
+macro_rules! compress4_hybrid {
+    (
+        $h_vecs:expr,
+        $h_words:expr,
+        $msg_vecs:expr,
+        $msg_words:expr,
+        $count_low:expr,
+        $count_high:expr,
+        $lastblock:expr,
+        $lastnode:expr,
+        $count_low_word:expr,
+        $count_high_word:expr,
+        $lastblock_word:expr,
+        $lastnode_word:expr,
+    ) => {
+        let h_vecs: &mut [__m256i; 8] = $h_vecs;
+        let h_words: &mut [Word; 8] = $h_words;
+        let msg_vecs: &[__m256i; 16] = $msg_vecs;
+        let msg_words: &[Word; 16] = $msg_words;
+        let count_low: __m256i = $count_low;
+        let count_high: __m256i = $count_high;
+        let lastblock: __m256i = $lastblock;
+        let lastnode: __m256i = $lastnode;
+        let count_low_word: Word = $count_low_word;
+        let count_high_word: Word = $count_high_word;
+        let lastblock_word: Word = $lastblock_word;
+        let lastnode_word: Word = $lastnode_word;
+
+        let mut v = [
+            h_vecs[0],
+            h_vecs[1],
+            h_vecs[2],
+            h_vecs[3],
+            h_vecs[4],
+            h_vecs[5],
+            h_vecs[6],
+            h_vecs[7],
+            set1(IV[0]),
+            set1(IV[1]),
+            set1(IV[2]),
+            set1(IV[3]),
+            xor(set1(IV[4]), count_low),
+            xor(set1(IV[5]), count_high),
+            xor(set1(IV[6]), lastblock),
+            xor(set1(IV[7]), lastnode),
+        ];
+        let mut w = [
+            h_words[0],
+            h_words[1],
+            h_words[2],
+            h_words[3],
+            h_words[4],
+            h_words[5],
+            h_words[6],
+            h_words[7],
+            IV[0],
+            IV[1],
+            IV[2],
+            IV[3],
+            IV[4] ^ count_low_word,
+            IV[5] ^ count_high_word,
+            IV[6] ^ lastblock_word,
+            IV[7] ^ lastnode_word,
+        ];
+
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 0);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 1);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 2);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 3);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 4);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 5);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 6);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 7);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 8);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 9);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 10);
+        round_hybrid(&mut v, &mut w, &msg_vecs, &msg_words, 11);
+
+        for i in 0..8 {
+            h_vecs[i] = xor(xor(h_vecs[i], v[i]), v[i + 8]);
+            h_words[i] ^= w[i] ^ w[i + 8];
+        }
+    };
+}
+
+#[inline(always)]
+fn load_msg_words(block: &[u8; BLOCKBYTES]) -> [Word; 16] {
+    let (b0, b1, b2, b3, b4, b5, b6, b7, b8, b9, b10, b11, b12, b13, b14, b15) =
+        array_refs!(block, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8);
+    [
+        Word::from_le_bytes(*b0),
+        Word::from_le_bytes(*b1),
+        Word::from_le_bytes(*b2),
+        Word::from_le_bytes(*b3),
+        Word::from_le_bytes(*b4),
+        Word::from_le_bytes(*b5),
+        Word::from_le_bytes(*b6),
+        Word::from_le_bytes(*b7),
+        Word::from_le_bytes(*b8),
+        Word::from_le_bytes(*b9),
+        Word::from_le_bytes(*b10),
+        Word::from_le_bytes(*b11),
+        Word::from_le_bytes(*b12),
+        Word::from_le_bytes(*b13),
+        Word::from_le_bytes(*b14),
+        Word::from_le_bytes(*b15),
+    ]
+}
+
+// Like compress4_loop, but with a fifth job in scalar registers. See
+// round_hybrid.
+#[target_feature(enable = "avx2,bmi2")]
+pub unsafe fn compress5_loop(jobs: &mut [Job; DEGREE + 1], finalize: Finalize, stride: Stride) {
+    // If we're not finalizing, there can't be a partial block at the end.
+    for job in jobs.iter() {
+        input_debug_asserts(job.input, finalize);
+    }
+
+    let min_len = jobs.iter().map(|job| job.input.len()).min().unwrap();
+    let mut fin_offset = min_len.saturating_sub(1);
+    fin_offset -= fin_offset % stride.padded_blockbytes();
+
+    let (jobs4, job5) = mut_array_refs!(&mut *jobs, DEGREE, 1);
+    let job5 = &mut job5[0];
+    let mut h_vecs = transpose_state_vecs(jobs4);
+    let (mut counts_lo, mut counts_hi) = load_counts(jobs4);
+    let mut h_words = *job5.words;
+    let mut count = job5.count;
+
+    // Performance note, making these buffers mem::uninitialized() seems to
+    // cause problems in the optimizer.
+    let mut bufs = [[0; BLOCKBYTES]; DEGREE];
+    let mut buf5 = [0; BLOCKBYTES];
+    let (fin_blocks, fin_counts_delta, fin_last_block, fin_last_node) =
+        fin_vecs(jobs4, fin_offset, &mut bufs, finalize, stride);
+    let (fin_block5, fin_len5, finalize5) = final_block(job5.input, fin_offset, &mut buf5, stride);
+    let fin_last_block5 = flag_word(finalize.yes() && finalize5);
+    let fin_last_node5 = flag_word(finalize.yes() && finalize5 && job5.last_node.yes());
+
+    // The main loop.
+    let mut offset = 0;
+    loop {
+        let blocks;
+        let counts_delta;
+        let last_block;
+        let last_node;
+        let block5;
+        let count_delta5;
+        let last_block5;
+        let last_node5;
+        if offset == fin_offset {
+            blocks = fin_blocks;
+            counts_delta = fin_counts_delta;
+            last_block = fin_last_block;
+            last_node = fin_last_node;
+            block5 = fin_block5;
+            count_delta5 = fin_len5;
+            last_block5 = fin_last_block5;
+            last_node5 = fin_last_node5;
+        } else {
+            blocks = msg_blocks(jobs4, offset);
+            counts_delta = set1(BLOCKBYTES as Word);
+            last_block = set1(0);
+            last_node = set1(0);
+            block5 = array_ref!(job5.input, offset, BLOCKBYTES);
+            count_delta5 = BLOCKBYTES;
+            last_block5 = 0;
+            last_node5 = 0;
+        }
+
+        let m_vecs = transpose_msg_vecs(blocks);
+        let m_words = load_msg_words(block5);
+        add_to_counts(&mut counts_lo, &mut counts_hi, counts_delta);
+        count = count.wrapping_add(count_delta5 as Count);
+        compress4_hybrid!(
+            &mut h_vecs,
+            &mut h_words,
+            &m_vecs,
+            &m_words,
+            counts_lo,
+            counts_hi,
+            last_block,
+            last_node,
+            count_low(count),
+            count_high(count),
+            last_block5,
+            last_node5,
+        );
+
+        // Check for termination before bumping the offset, to avoid overflow.
+        if offset == fin_offset {
+            break;
+        }
+
+        offset += stride.padded_blockbytes();
+    }
+
+    // Write out the results.
+    untranspose_state_vecs(&h_vecs, jobs4);
+    store_counts(jobs4, counts_lo, counts_hi);
+    *job5.words = h_words;
+    job5.count = count;
+    let max_consumed = offset.saturating_add(stride.padded_blockbytes());
+    for job in jobs.iter_mut() {
+        let consumed = cmp::min(max_consumed, job.input.len());
+        job.input = &job.input[consumed..];
+    }
+}
+
+#[inline(always)]
+unsafe fn transpose_chains(chains: &[[Word; 8]; DEGREE]) -> [__m256i; 8] {
+    let words0 = array_refs!(&chains[0], DEGREE, DEGREE);
+    let words1 = array_refs!(&chains[1], DEGREE, DEGREE);
+    let words2 = array_refs!(&chains[2], DEGREE, DEGREE);
+    let words3 = array_refs!(&chains[3], DEGREE, DEGREE);
+    let [h0, h1, h2, h3] = transpose_vecs(
+        loadu(words0.0),
+        loadu(words1.0),
+        loadu(words2.0),
+        loadu(words3.0),
+    );
+    let [h4, h5, h6, h7] = transpose_vecs(
+        loadu(words0.1),
+        loadu(words1.1),
+        loadu(words2.1),
+        loadu(words3.1),
+    );
+    [h0, h1, h2, h3, h4, h5, h6, h7]
+}
+
+#[inline(always)]
+unsafe fn untranspose_chains(h_vecs: &[__m256i; 8], chains: &mut [[Word; 8]; DEGREE]) {
+    let [chain0, chain1, chain2, chain3] = chains;
+    let words0 = mut_array_refs!(chain0, DEGREE, DEGREE);
+    let words1 = mut_array_refs!(chain1, DEGREE, DEGREE);
+    let words2 = mut_array_refs!(chain2, DEGREE, DEGREE);
+    let words3 = mut_array_refs!(chain3, DEGREE, DEGREE);
+    let out = transpose_vecs(h_vecs[0], h_vecs[1], h_vecs[2], h_vecs[3]);
+    storeu(out[0], words0.0);
+    storeu(out[1], words1.0);
+    storeu(out[2], words2.0);
+    storeu(out[3], words3.0);
+    let out = transpose_vecs(h_vecs[4], h_vecs[5], h_vecs[6], h_vecs[7]);
+    storeu(out[0], words0.1);
+    storeu(out[1], words1.1);
+    storeu(out[2], words2.1);
+    storeu(out[3], words3.1);
+}
+
+// Run `iterations` steps of four independent hash chains. Each chain starts as
+// the little-endian words of its seed, zero-padded, and ends as the state
+// words of its final digest. In between, the digests stay in transposed
+// vectors, and each one becomes the message of the next step after masking.
+#[target_feature(enable = "avx2")]
+pub unsafe fn iterate4(chains: &mut [[Word; 8]; DEGREE], step: &ChainStep, iterations: u64) {
+    let masks = step.digest_masks();
+    let mut mask_vecs = [set1(0); 8];
+    let mut init_vecs = [set1(0); 8];
+    for i in 0..8 {
+        mask_vecs[i] = set1(masks[i]);
+        init_vecs[i] = set1(step.words[i]);
+    }
+    let count_lo = set1(count_low(step.count));
+    let count_hi = set1(count_high(step.count));
+    let last_block = set1(flag_word(true));
+    let last_node = set1(flag_word(step.last_node.yes()));
+
+    let mut h_vecs = transpose_chains(chains);
+    for _ in 0..iterations {
+        let mut m_vecs = [set1(0); 16];
+        for i in 0..8 {
+            m_vecs[i] = and(h_vecs[i], mask_vecs[i]);
+        }
+        h_vecs = init_vecs;
+        compress4_transposed!(
+            &mut h_vecs,
+            &m_vecs,
+            count_lo,
+            count_hi,
+            last_block,
+            last_node,
+        );
+    }
+    untranspose_chains(&h_vecs, chains);
+}
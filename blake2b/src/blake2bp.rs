@@ -85,7 +85,7 @@ impl Params {
         }
     }
 
-    fn to_words(&self) -> ([[Word; 8]; DEGREE], [Word; 8]) {
+    pub(crate) fn to_words(&self) -> ([[Word; 8]; DEGREE], [Word; 8]) {
         let mut base_params = crate::Params::new();
         base_params
             .hash_length(self.hash_length as usize)
@@ -119,6 +119,11 @@ impl Params {
         (leaf_words, root_words)
     }
 
+    #[cfg(feature = "std")]
+    pub(crate) fn is_keyed(&self) -> bool {
+        self.key_length > 0
+    }
+
     /// Hash an input all at once with these parameters.
     pub fn hash(&self, input: &[u8]) -> Hash {
         // If there's a key, just fall back to using the State.
@@ -269,6 +274,43 @@ impl State {
         }
     }
 
+    // The inverse of midstate(): a state that has already absorbed `offset`
+    // bytes of input, whose compressed leaf words are `leaf_words`.
+    #[cfg(feature = "std")]
+    pub(crate) fn from_midstate(
+        params: &Params,
+        leaf_words: &[[Word; 8]; DEGREE],
+        offset: Count,
+    ) -> Self {
+        let mut state = Self::with_params(params);
+        state.leaf_words = *leaf_words;
+        let mut total = offset;
+        if state.is_keyed {
+            total = total.wrapping_add((DEGREE * BLOCKBYTES) as Count);
+        }
+        state.count = total / DEGREE as Count;
+        state.buf_len = 0;
+        state
+    }
+
+    // The leaf words with the buffer compressed but not finalized, for the
+    // checkpoints in the prefix module. This is only meaningful when the input
+    // so far, including any key blocks, is a nonzero multiple of
+    // DEGREE * BLOCKBYTES, so that every leaf has whole blocks buffered.
+    #[cfg(feature = "std")]
+    pub(crate) fn midstate(&self) -> [[Word; 8]; DEGREE] {
+        debug_assert_eq!(0, self.buf_len as usize % (DEGREE * BLOCKBYTES));
+        let mut leaf_words = self.leaf_words;
+        let mut count = self.count;
+        Self::compress_to_leaves(
+            &mut leaf_words,
+            &self.buf[..self.buf_len as usize],
+            &mut count,
+            self.implementation,
+        );
+        leaf_words
+    }
+
     fn fill_buf(&mut self, input: &mut &[u8]) {
         let take = cmp::min(self.buf.len() - self.buf_len as usize, input.len());
         self.buf[self.buf_len as usize..][..take].copy_from_slice(&input[..take]);
@@ -360,6 +402,34 @@ impl State {
         self
     }
 
+    /// Copy `src` into `dst` and add it to the hash, in one pass over memory. See
+    /// [`State::update_copy`](../struct.State.html#method.update_copy).
+    ///
+    /// # Panics
+    ///
+    /// Panics if `dst` and `src` have different lengths.
+    pub fn update_copy(&mut self, dst: &mut [u8], src: &[u8]) -> &mut Self {
+        assert_eq!(dst.len(), src.len(), "dst and src must be the same length");
+        for (dst, src) in dst
+            .chunks_mut(crate::COPY_CHUNK)
+            .zip(src.chunks(crate::COPY_CHUNK))
+        {
+            dst.copy_from_slice(src);
+            self.update(src);
+        }
+        self
+    }
+
+    /// Add at most `max_bytes` of `input` to the hash, and return the number of bytes consumed.
+    /// The budget is rounded down to a whole number of leaf compression rounds (`DEGREE` blocks),
+    /// but at least one round is consumed when there's input available, so that repeated calls
+    /// always make progress. See the [`cooperative`](../cooperative/index.html) module.
+    pub fn update_budgeted(&mut self, input: &[u8], max_bytes: usize) -> usize {
+        let take = crate::cooperative::budget_len(input.len(), max_bytes, DEGREE * BLOCKBYTES);
+        self.update(&input[..take]);
+        take
+    }
+
     /// Finalize the state and return a `Hash`. This method is idempotent, and calling it multiple
     /// times will give the same result. It's also possible to `update` with more input in between.
     pub fn finalize(&self) -> Hash {
@@ -479,6 +549,20 @@ pub(crate) fn force_portable(params: &mut Params) {
     params.implementation = Implementation::portable();
 }
 
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+pub(crate) fn force_sse41(params: &mut Params) {
+    if let Some(imp) = Implementation::sse41_if_supported() {
+        params.implementation = imp;
+    }
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+pub(crate) fn force_avx2(params: &mut Params) {
+    if let Some(imp) = Implementation::avx2_if_supported() {
+        params.implementation = imp;
+    }
+}
+
 #[cfg(test)]
 pub(crate) mod test {
     use super::*;
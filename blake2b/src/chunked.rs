@@ -0,0 +1,390 @@
+//! A chunked, authenticated format for large inputs, where each fixed-size
+//! chunk gets its own keyed BLAKE2b tag, so that byte ranges can be verified
+//! independently.
+//!
+//! Every chunk is hashed with the same key and parameters, except that
+//! `node_offset` is set to the chunk index and the final chunk sets the
+//! `last_node` flag. This binds each tag to its position and prevents
+//! truncation. A root tag is computed over the concatenated chunk tags, with
+//! `node_depth` set to 1. All the chunks except possibly the last are the same
+//! length, so tagging is a perfect fit for the [`many`](../many/index.html)
+//! interfaces, and with the [`tag_chunks_parallel`] method it can also be
+//! spread over multiple threads.
+//!
+//! This module is only available with the `std` feature.
+//!
+//! # Example
+//!
+//! ```
+//! use blake2b_simd::chunked;
+//!
+//! let params = chunked::Params::new(b"my secret key", 4096);
+//! let data = vec![0xab; 10_000];
+//! let tags = params.tag_chunks(&data);
+//! let root = params.root(&tags);
+//!
+//! // Later, verify only the bytes we actually need.
+//! let verifier = params.verifier(tags, &root).expect("bad root tag");
+//! let range = verifier.chunk_range(5000, 6000);
+//! let chunk_data = &data[range.start as usize..range.end as usize];
+//! assert!(verifier.verify(range.start, chunk_data));
+//! ```
+//!
+//! [`tag_chunks_parallel`]: struct.Params.html#method.tag_chunks_parallel
+
+use crate::many::{hash_many, HashManyJob, MAX_DEGREE};
+use crate::Hash;
+use crate::OUTBYTES;
+use arrayvec::ArrayVec;
+use core::cmp;
+use core::fmt;
+use core::ops::Range;
+use std::thread;
+use std::vec::Vec;
+
+// The number of chunks we hash in each call to hash_many. A multiple of
+// MAX_DEGREE keeps all the lanes busy, and going a little beyond that lets
+// compress_many refill lanes without returning to us.
+const BATCH: usize = 2 * MAX_DEGREE;
+
+/// The parameters of a chunked format: the key, the chunk size, and the tag
+/// length.
+#[derive(Clone)]
+pub struct Params {
+    base: crate::Params,
+    chunk_size: usize,
+    hash_length: usize,
+}
+
+impl Params {
+    /// Create the parameters for a format with the given key and chunk size.
+    /// The key may be empty, though then the tags are just hashes. The chunk
+    /// size must be nonzero and fit in a `u32`. For the best performance it
+    /// should be a multiple of [`BLOCKBYTES`](../constant.BLOCKBYTES.html).
+    pub fn new(key: &[u8], chunk_size: usize) -> Self {
+        assert!(
+            chunk_size > 0 && chunk_size as u64 <= u32::MAX as u64,
+            "Bad chunk size: {}",
+            chunk_size
+        );
+        let mut base = crate::Params::new();
+        base.key(key)
+            .fanout(0)
+            .max_depth(2)
+            .max_leaf_length(chunk_size as u32)
+            .inner_hash_length(OUTBYTES);
+        Self {
+            base,
+            chunk_size,
+            hash_length: OUTBYTES,
+        }
+    }
+
+    /// Set the length of every tag, from 1 to `OUTBYTES` (64). The default is
+    /// `OUTBYTES`.
+    pub fn hash_length(&mut self, length: usize) -> &mut Self {
+        self.base.hash_length(length).inner_hash_length(length);
+        self.hash_length = length;
+        self
+    }
+
+    /// The chunk size in bytes.
+    pub fn chunk_size(&self) -> usize {
+        self.chunk_size
+    }
+
+    /// The number of chunks an input of `len` bytes is split into. Note that
+    /// the empty input still has one (empty) chunk.
+    pub fn num_chunks(&self, len: u64) -> u64 {
+        cmp::max(
+            1,
+            (len + self.chunk_size as u64 - 1) / self.chunk_size as u64,
+        )
+    }
+
+    fn chunk_params(&self, index: u64, last: bool) -> crate::Params {
+        let mut params = self.base.clone();
+        params.node_offset(index).node_depth(0).last_node(last);
+        params
+    }
+
+    fn root_params(&self) -> crate::Params {
+        let mut params = self.base.clone();
+        params.node_offset(0).node_depth(1).last_node(true);
+        params
+    }
+
+    // Tag the chunks of `input`, which starts at chunk `first_index`, and
+    // append the tags to `out`. If `input_is_final` is true, the last chunk of
+    // `input` is the last chunk of the whole format.
+    fn tag_chunks_at(
+        &self,
+        input: &[u8],
+        first_index: u64,
+        input_is_final: bool,
+        out: &mut Vec<Hash>,
+    ) {
+        // The empty input is a single empty chunk.
+        if input.is_empty() {
+            let params = self.chunk_params(first_index, input_is_final);
+            out.push(params.hash(&[]));
+            return;
+        }
+        let num_chunks = (input.len() + self.chunk_size - 1) / self.chunk_size;
+        let mut chunks = input.chunks(self.chunk_size).enumerate().peekable();
+        while chunks.peek().is_some() {
+            let mut jobs = ArrayVec::<HashManyJob, BATCH>::new();
+            for (i, chunk) in chunks.by_ref().take(BATCH) {
+                let last = input_is_final && i == num_chunks - 1;
+                let params = self.chunk_params(first_index + i as u64, last);
+                jobs.push(HashManyJob::new(&params, chunk));
+            }
+            hash_many(jobs.iter_mut());
+            out.extend(jobs.iter().map(|job| job.to_hash()));
+        }
+    }
+
+    /// Compute the tag of every chunk in `input`, using SIMD lanes on a single
+    /// thread.
+    pub fn tag_chunks(&self, input: &[u8]) -> Vec<Hash> {
+        let mut tags = Vec::with_capacity(self.num_chunks(input.len() as u64) as usize);
+        self.tag_chunks_at(input, 0, true, &mut tags);
+        tags
+    }
+
+    /// Compute the tag of every chunk in `input`, like [`tag_chunks`], but
+    /// split the chunks evenly over up to `num_threads` threads. The result is
+    /// the same as that of [`tag_chunks`].
+    ///
+    /// [`tag_chunks`]: #method.tag_chunks
+    pub fn tag_chunks_parallel(&self, input: &[u8], num_threads: usize) -> Vec<Hash> {
+        let num_chunks = self.num_chunks(input.len() as u64) as usize;
+        let chunks_per_thread =
+            (num_chunks + cmp::max(1, num_threads) - 1) / cmp::max(1, num_threads);
+        if chunks_per_thread >= num_chunks {
+            return self.tag_chunks(input);
+        }
+        let bytes_per_thread = chunks_per_thread * self.chunk_size;
+        let mut tags = Vec::with_capacity(num_chunks);
+        thread::scope(|scope| {
+            let handles: Vec<_> = input
+                .chunks(bytes_per_thread)
+                .enumerate()
+                .map(|(i, part)| {
+                    let is_final = (i + 1) * bytes_per_thread >= input.len();
+                    scope.spawn(move || {
+                        let mut part_tags = Vec::with_capacity(chunks_per_thread);
+                        let first_index = (i * chunks_per_thread) as u64;
+                        self.tag_chunks_at(part, first_index, is_final, &mut part_tags);
+                        part_tags
+                    })
+                })
+                .collect();
+            for handle in handles {
+                tags.extend(handle.join().expect("tagging thread panicked"));
+            }
+        });
+        tags
+    }
+
+    /// Compute the root tag over a complete list of chunk tags.
+    pub fn root(&self, tags: &[Hash]) -> Hash {
+        let mut state = self.root_params().to_state();
+        for tag in tags {
+            state.update(tag.as_bytes());
+        }
+        state.finalize()
+    }
+
+    /// Check a complete list of chunk tags against a root tag, and if they
+    /// match, return a [`Verifier`] for random access to the chunks. The
+    /// comparison is constant time.
+    ///
+    /// [`Verifier`]: struct.Verifier.html
+    pub fn verifier(&self, tags: Vec<Hash>, root: &Hash) -> Option<Verifier> {
+        if tags.is_empty() || self.root(&tags) != *root {
+            return None;
+        }
+        Some(Verifier {
+            params: self.clone(),
+            tags,
+        })
+    }
+}
+
+impl fmt::Debug for Params {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        // NB: Don't print the key itself. Debug shouldn't leak secrets.
+        write!(
+            f,
+            "Params {{ chunk_size: {}, hash_length: {} }}",
+            self.chunk_size, self.hash_length,
+        )
+    }
+}
+
+/// A random-access verifier for a chunked format, holding chunk tags that have
+/// already been checked against the root tag. Verifying a range hashes only
+/// the chunks that overlap it.
+#[derive(Clone)]
+pub struct Verifier {
+    params: Params,
+    tags: Vec<Hash>,
+}
+
+impl Verifier {
+    /// The chunk-aligned byte range that needs to be read, in order to verify
+    /// the bytes from `start` to `end`. The end of the returned range may be
+    /// past the end of the input, if it ends within the final chunk.
+    pub fn chunk_range(&self, start: u64, end: u64) -> Range<u64> {
+        let chunk_size = self.params.chunk_size as u64;
+        let first = start / chunk_size;
+        let last = cmp::max(first + 1, (end + chunk_size - 1) / chunk_size);
+        first * chunk_size..last * chunk_size
+    }
+
+    /// Verify `data`, which begins at the byte offset `offset` in the input.
+    /// The offset must be a multiple of the chunk size, and `data` must consist
+    /// of whole chunks, except that it may end with the final (short) chunk of
+    /// the input. The comparisons are constant time.
+    pub fn verify(&self, offset: u64, data: &[u8]) -> bool {
+        let chunk_size = self.params.chunk_size as u64;
+        if offset % chunk_size != 0 {
+            return false;
+        }
+        let first = offset / chunk_size;
+        let count = self.params.num_chunks(data.len() as u64);
+        if first.saturating_add(count) > self.tags.len() as u64 {
+            return false;
+        }
+        let is_final = first + count == self.tags.len() as u64;
+        if !is_final && data.len() as u64 != count * chunk_size {
+            return false;
+        }
+        let mut found = Vec::with_capacity(count as usize);
+        self.params.tag_chunks_at(data, first, is_final, &mut found);
+        let expected = &self.tags[first as usize..][..count as usize];
+        // Check every tag, rather than stopping at the first mismatch.
+        found
+            .iter()
+            .zip(expected)
+            .fold(true, |ok, (found, expected)| (found == expected) & ok)
+    }
+
+    /// The verified chunk tags.
+    pub fn tags(&self) -> &[Hash] {
+        &self.tags
+    }
+}
+
+impl fmt::Debug for Verifier {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(
+            f,
+            "Verifier {{ params: {:?}, num_chunks: {} }}",
+            self.params,
+            self.tags.len(),
+        )
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::paint_test_input;
+    use crate::BLOCKBYTES;
+
+    // Tag each chunk one at a time with a State, as a reference.
+    fn reference_tags(
+        key: &[u8],
+        chunk_size: usize,
+        hash_length: usize,
+        input: &[u8],
+    ) -> Vec<Hash> {
+        let mut chunks: Vec<&[u8]> = input.chunks(chunk_size).collect();
+        if chunks.is_empty() {
+            chunks.push(&[]);
+        }
+        let num_chunks = chunks.len();
+        chunks
+            .iter()
+            .enumerate()
+            .map(|(i, chunk)| {
+                crate::Params::new()
+                    .key(key)
+                    .hash_length(hash_length)
+                    .fanout(0)
+                    .max_depth(2)
+                    .max_leaf_length(chunk_size as u32)
+                    .inner_hash_length(hash_length)
+                    .node_offset(i as u64)
+                    .last_node(i == num_chunks - 1)
+                    .to_state()
+                    .update(chunk)
+                    .finalize()
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_against_reference() {
+        let chunk_size = 2 * BLOCKBYTES;
+        let mut input = [0; 20 * BLOCKBYTES + 1];
+        paint_test_input(&mut input);
+        for &len in &[
+            0,
+            1,
+            chunk_size - 1,
+            chunk_size,
+            chunk_size + 1,
+            input.len(),
+        ] {
+            for &hash_length in &[16, OUTBYTES] {
+                let mut params = Params::new(b"key", chunk_size);
+                params.hash_length(hash_length);
+                let expected = reference_tags(b"key", chunk_size, hash_length, &input[..len]);
+                assert_eq!(expected, params.tag_chunks(&input[..len]));
+                for &threads in &[0, 1, 2, 3, 100] {
+                    assert_eq!(expected, params.tag_chunks_parallel(&input[..len], threads));
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_verify_ranges() {
+        let chunk_size = BLOCKBYTES;
+        let mut input = [0; 10 * BLOCKBYTES + 10];
+        paint_test_input(&mut input);
+        let params = Params::new(b"key", chunk_size);
+        let tags = params.tag_chunks(&input);
+        let root = params.root(&tags);
+
+        // The wrong root should be rejected.
+        let wrong_root = Params::new(b"other key", chunk_size).root(&tags);
+        assert!(params.verifier(tags.clone(), &wrong_root).is_none());
+
+        // Dropping the final chunk's tag should also be rejected.
+        assert!(params.verifier(tags[..10].to_vec(), &root).is_none());
+
+        let verifier = params.verifier(tags, &root).unwrap();
+        for &(start, end) in &[(0, 1), (5, 300), (128, 256), (1000, 1290), (1280, 1290)] {
+            let range = verifier.chunk_range(start, end);
+            assert!(range.start <= start && range.end >= end);
+            let capped_end = cmp::min(range.end as usize, input.len());
+            let data = &input[range.start as usize..capped_end];
+            assert!(verifier.verify(range.start, data), "{}..{}", start, end);
+
+            // Corrupting any byte should fail verification.
+            let mut corrupt = data.to_vec();
+            let last = corrupt.len() - 1;
+            corrupt[last] ^= 1;
+            assert!(!verifier.verify(range.start, &corrupt));
+        }
+
+        // Unaligned offsets, truncated chunks, and chunks past the end fail.
+        assert!(!verifier.verify(1, &input[1..129]));
+        assert!(!verifier.verify(0, &input[..100]));
+        assert!(!verifier.verify(11 * BLOCKBYTES as u64, &[0]));
+    }
+}
@@ -0,0 +1,176 @@
+//! Cooperative hashing for async executors.
+//!
+//! Hashing a long input inside an async task blocks the executor thread until
+//! it's done, which delays every other task scheduled on that thread. The
+//! [`update`] function returns a future that hashes its input in bounded
+//! slices, and yields back to the executor in between them. Each slice is a
+//! whole number of compression batches (blocks for BLAKE2b, groups of leaf
+//! blocks for BLAKE2bp). The state holds back the last batch of each slice,
+//! in case it's the end of the input, so slicing copies at most one batch per
+//! slice into the state's buffer.
+//!
+//! This module doesn't depend on any particular executor. Each time the future
+//! yields, it wakes itself immediately, so it will be polled again after the
+//! other ready tasks have had a turn.
+//!
+//! # Example
+//!
+//! ```
+//! # async fn example() {
+//! use blake2b_simd::{blake2b, cooperative, State};
+//!
+//! let input = vec![0; 1_000_000];
+//! let mut state = State::new();
+//! cooperative::update(&mut state, &input, cooperative::DEFAULT_BUDGET).await;
+//! assert_eq!(blake2b(&input), state.finalize());
+//! # }
+//! ```
+//!
+//! [`update`]: fn.update.html
+
+use core::cmp;
+use core::fmt;
+use core::future::Future;
+use core::pin::Pin;
+use core::task::{Context, Poll};
+
+/// A reasonable default for the number of bytes to hash between yields. This
+/// is on the order of tens of microseconds of work on a modern x86 machine.
+pub const DEFAULT_BUDGET: usize = 1 << 16; // 64 KiB
+
+/// State types that support [`update_budgeted`], implemented for both
+/// [`State`] and [`blake2bp::State`].
+///
+/// [`update_budgeted`]: ../struct.State.html#method.update_budgeted
+/// [`State`]: ../struct.State.html
+/// [`blake2bp::State`]: ../blake2bp/struct.State.html
+pub trait BudgetedUpdate {
+    /// Add at most `max_bytes` of `input`, rounded to whole compression
+    /// batches, and return the number of bytes consumed.
+    fn update_budgeted(&mut self, input: &[u8], max_bytes: usize) -> usize;
+}
+
+impl BudgetedUpdate for crate::State {
+    fn update_budgeted(&mut self, input: &[u8], max_bytes: usize) -> usize {
+        crate::State::update_budgeted(self, input, max_bytes)
+    }
+}
+
+impl BudgetedUpdate for crate::blake2bp::State {
+    fn update_budgeted(&mut self, input: &[u8], max_bytes: usize) -> usize {
+        crate::blake2bp::State::update_budgeted(self, input, max_bytes)
+    }
+}
+
+// Round the budget down to a whole number of batches, but always take at least
+// one batch, so that every call makes progress.
+pub(crate) fn budget_len(input_len: usize, max_bytes: usize, batch_bytes: usize) -> usize {
+    let budget = cmp::max(batch_bytes, max_bytes - max_bytes % batch_bytes);
+    cmp::min(input_len, budget)
+}
+
+/// The future returned by [`update`](fn.update.html).
+pub struct Update<'s, 'i, S: BudgetedUpdate> {
+    state: &'s mut S,
+    input: &'i [u8],
+    max_bytes: usize,
+}
+
+/// Add `input` to `state`, hashing at most `max_bytes` (rounded to whole
+/// compression batches) each time the returned future is polled, and yielding
+/// in between.
+pub fn update<'s, 'i, S: BudgetedUpdate>(
+    state: &'s mut S,
+    input: &'i [u8],
+    max_bytes: usize,
+) -> Update<'s, 'i, S> {
+    Update {
+        state,
+        input,
+        max_bytes,
+    }
+}
+
+impl<'s, 'i, S: BudgetedUpdate> Future for Update<'s, 'i, S> {
+    type Output = ();
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context) -> Poll<()> {
+        let this = self.get_mut();
+        let consumed = this.state.update_budgeted(this.input, this.max_bytes);
+        this.input = &this.input[consumed..];
+        if this.input.is_empty() {
+            Poll::Ready(())
+        } else {
+            cx.waker().wake_by_ref();
+            Poll::Pending
+        }
+    }
+}
+
+impl<'s, 'i, S: BudgetedUpdate> fmt::Debug for Update<'s, 'i, S> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(
+            f,
+            "Update {{ remaining: {}, max_bytes: {} }}",
+            self.input.len(),
+            self.max_bytes,
+        )
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::{blake2bp, paint_test_input, State, BLOCKBYTES};
+    use core::ptr;
+    use core::task::{RawWaker, RawWakerVTable, Waker};
+
+    fn noop_raw_waker() -> RawWaker {
+        fn clone(_: *const ()) -> RawWaker {
+            noop_raw_waker()
+        }
+        fn noop(_: *const ()) {}
+        static VTABLE: RawWakerVTable = RawWakerVTable::new(clone, noop, noop, noop);
+        RawWaker::new(ptr::null(), &VTABLE)
+    }
+
+    // Poll the future to completion and return the number of polls.
+    fn run<S: BudgetedUpdate>(state: &mut S, input: &[u8], max_bytes: usize) -> usize {
+        let waker = unsafe { Waker::from_raw(noop_raw_waker()) };
+        let mut cx = Context::from_waker(&waker);
+        let mut future = update(state, input, max_bytes);
+        let mut polls = 1;
+        while Pin::new(&mut future).poll(&mut cx).is_pending() {
+            polls += 1;
+        }
+        polls
+    }
+
+    #[test]
+    fn test_budget_len() {
+        assert_eq!(0, budget_len(0, 1000, BLOCKBYTES));
+        assert_eq!(10, budget_len(10, 0, BLOCKBYTES));
+        assert_eq!(BLOCKBYTES, budget_len(1000, 0, BLOCKBYTES));
+        assert_eq!(BLOCKBYTES, budget_len(1000, BLOCKBYTES + 1, BLOCKBYTES));
+        assert_eq!(2 * BLOCKBYTES, budget_len(1000, 2 * BLOCKBYTES, BLOCKBYTES));
+    }
+
+    #[test]
+    fn test_cooperative_update() {
+        let mut input = [0; 20 * BLOCKBYTES + 3];
+        paint_test_input(&mut input);
+
+        // Start each state with one byte buffered, so that the slices aren't
+        // aligned with the buffer.
+        let mut state = State::new();
+        state.update(&input[..1]);
+        let polls = run(&mut state, &input[1..], 4 * BLOCKBYTES);
+        assert_eq!(6, polls);
+        assert_eq!(crate::blake2b(&input), state.finalize());
+
+        let mut state = blake2bp::State::new();
+        state.update(&input[..1]);
+        run(&mut state, &input[1..], 0);
+        assert_eq!(blake2bp::blake2bp(&input), state.finalize());
+    }
+}
@@ -1,11 +1,19 @@
 use crate::*;
 use arrayref::array_ref;
 use core::cmp;
+#[cfg(all(feature = "std", any(target_arch = "x86", target_arch = "x86_64")))]
+use std::sync::atomic::{AtomicU8, Ordering};
 
 #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
 pub const MAX_DEGREE: usize = 4;
 
-#[cfg(not(any(target_arch = "x86", target_arch = "x86_64")))]
+#[cfg(all(
+    feature = "portable_simd",
+    not(any(target_arch = "x86", target_arch = "x86_64"))
+))]
+pub const MAX_DEGREE: usize = portable_simd::DEGREE;
+
+#[cfg(not(any(target_arch = "x86", target_arch = "x86_64", feature = "portable_simd")))]
 pub const MAX_DEGREE: usize = 1;
 
 // Variants other than Portable are unreachable in no_std, unless CPU features
@@ -13,21 +21,77 @@ pub const MAX_DEGREE: usize = 1;
 // This might change in the future if is_x86_feature_detected moves into libcore.
 #[allow(dead_code)]
 #[derive(Clone, Copy, Debug, Eq, PartialEq)]
+#[repr(u8)]
 enum Platform {
     Portable,
+    Portable2,
     #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
     SSE41,
     #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
     AVX2,
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    AVX2Interleaved,
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    AVX2Hybrid,
+    #[cfg(feature = "portable_simd")]
+    PortableSimd,
+}
+
+#[cfg(all(feature = "std", any(target_arch = "x86", target_arch = "x86_64")))]
+impl Platform {
+    fn from_u8(x: u8) -> Self {
+        match x {
+            x if x == Platform::AVX2 as u8 => Platform::AVX2,
+            x if x == Platform::SSE41 as u8 => Platform::SSE41,
+            #[cfg(feature = "portable_simd")]
+            x if x == Platform::PortableSimd as u8 => Platform::PortableSimd,
+            _ => Platform::Portable,
+        }
+    }
 }
 
+// Runtime detection gives the same answer every time, but it isn't free, and
+// Params::new() calls it for every hash. Cache the result after the first call.
+#[cfg(all(feature = "std", any(target_arch = "x86", target_arch = "x86_64")))]
+static DETECTED: AtomicU8 = AtomicU8::new(UNDETECTED);
+#[cfg(all(feature = "std", any(target_arch = "x86", target_arch = "x86_64")))]
+const UNDETECTED: u8 = u8::MAX;
+
 #[derive(Clone, Copy, Debug)]
 pub struct Implementation(Platform);
 
 impl Implementation {
+    #[allow(unreachable_code)]
     pub fn detect() -> Self {
+        // If the build assumes AVX2, detection is a constant, and the cache
+        // would only get in the way. Returning the constant directly lets the
+        // optimizer fold away the match in the compress functions wherever the
+        // detected implementation is used.
+        #[cfg(all(
+            any(target_arch = "x86", target_arch = "x86_64"),
+            target_feature = "avx2"
+        ))]
+        {
+            return Implementation(Platform::AVX2);
+        }
+        #[cfg(all(feature = "std", any(target_arch = "x86", target_arch = "x86_64")))]
+        {
+            let cached = DETECTED.load(Ordering::Relaxed);
+            if cached != UNDETECTED {
+                return Implementation(Platform::from_u8(cached));
+            }
+            let detected = Self::detect_uncached();
+            DETECTED.store(detected.0 as u8, Ordering::Relaxed);
+            return detected;
+        }
+        // Without std, there's no runtime detection to cache.
+        Self::detect_uncached()
+    }
+
+    fn detect_uncached() -> Self {
         // Try the different implementations in order of how fast/modern they
-        // are. Currently on non-x86, everything just uses portable.
+        // are. On non-x86, the core::simd implementation is used if it's
+        // enabled, and otherwise everything just uses portable.
         #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
         {
             if let Some(avx2_impl) = Self::avx2_if_supported() {
@@ -40,6 +104,14 @@ impl Implementation {
                 return sse41_impl;
             }
         }
+        #[cfg(all(
+            feature = "portable_simd",
+            not(any(target_arch = "x86", target_arch = "x86_64"))
+        ))]
+        {
+            return Self::portable_simd();
+        }
+        #[allow(unreachable_code)]
         Self::portable()
     }
 
@@ -47,6 +119,24 @@ impl Implementation {
         Implementation(Platform::Portable)
     }
 
+    // Two instances interleaved in scalar code, for instruction-level
+    // parallelism on targets without SIMD. This is never detected. Two
+    // 16-word states need more general purpose registers than x86_64 has, and
+    // there the spills make it slower than portable. It's here for measuring
+    // on targets with more registers.
+    #[allow(dead_code)]
+    pub fn portable2() -> Self {
+        Implementation(Platform::Portable2)
+    }
+
+    // This is always available when it's compiled in, but x86 prefers the
+    // dedicated kernels above.
+    #[cfg(feature = "portable_simd")]
+    #[allow(dead_code)]
+    pub fn portable_simd() -> Self {
+        Implementation(Platform::PortableSimd)
+    }
+
     #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
     #[allow(unreachable_code)]
     pub fn sse41_if_supported() -> Option<Self> {
@@ -83,12 +173,53 @@ impl Implementation {
         None
     }
 
+    // The AVX2 kernels with two groups of lanes interleaved, for twice the
+    // degree. This is never detected. The interleaved rounds need more vector
+    // registers than x86 has, and on the cores we've measured the spills make
+    // it about half as fast as plain AVX2. It's here for measuring on cores
+    // with more room to spare.
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    #[allow(dead_code)]
+    pub fn avx2_interleaved_if_supported() -> Option<Self> {
+        Self::avx2_if_supported().map(|_| Implementation(Platform::AVX2Interleaved))
+    }
+
+    // Four AVX2 lanes plus a fifth job in scalar registers, for batches that
+    // would otherwise leave one job to run serially. This is never detected,
+    // because the scalar lane has to keep up with the vector lanes, and
+    // whether it does depends on the core.
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    #[allow(dead_code, unreachable_code)]
+    pub fn avx2_hybrid_if_supported() -> Option<Self> {
+        Self::avx2_if_supported()?;
+        // Check whether BMI2 support is assumed by the build.
+        #[cfg(target_feature = "bmi2")]
+        {
+            return Some(Implementation(Platform::AVX2Hybrid));
+        }
+        // Otherwise dynamically check for support if we can.
+        #[cfg(feature = "std")]
+        {
+            if is_x86_feature_detected!("bmi2") {
+                return Some(Implementation(Platform::AVX2Hybrid));
+            }
+        }
+        None
+    }
+
     pub fn degree(&self) -> usize {
         match self.0 {
             #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
             Platform::AVX2 => avx2::DEGREE,
             #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Platform::AVX2Interleaved => 2 * avx2::DEGREE,
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Platform::AVX2Hybrid => avx2::DEGREE + 1,
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
             Platform::SSE41 => sse41::DEGREE,
+            #[cfg(feature = "portable_simd")]
+            Platform::PortableSimd => portable_simd::DEGREE,
+            Platform::Portable2 => portable::DEGREE,
             Platform::Portable => 1,
         }
     }
@@ -104,31 +235,91 @@ impl Implementation {
     ) {
         match self.0 {
             #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
-            Platform::AVX2 => unsafe {
+            Platform::AVX2 | Platform::AVX2Interleaved | Platform::AVX2Hybrid => unsafe {
                 avx2::compress1_loop(input, words, count, last_node, finalize, stride);
             },
-            // Note that there's an SSE version of compress1 in the official C
-            // implementation, but I haven't ported it yet.
+            #[cfg(feature = "portable_simd")]
+            Platform::PortableSimd => {
+                portable_simd::compress1_loop(input, words, count, last_node, finalize, stride);
+            }
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Platform::SSE41 => unsafe {
+                sse41::compress1_loop(input, words, count, last_node, finalize, stride);
+            },
             _ => {
                 portable::compress1_loop(input, words, count, last_node, finalize, stride);
             }
         }
     }
 
-    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
     pub fn compress2_loop(&self, jobs: &mut [Job; 2], finalize: Finalize, stride: Stride) {
         match self.0 {
-            Platform::AVX2 | Platform::SSE41 => unsafe {
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Platform::AVX2 | Platform::AVX2Interleaved | Platform::AVX2Hybrid | Platform::SSE41 => unsafe {
                 sse41::compress2_loop(jobs, finalize, stride)
             },
+            #[cfg(feature = "portable_simd")]
+            Platform::PortableSimd => unsafe {
+                portable_simd::compress_n_loop(jobs, finalize, stride)
+            },
+            Platform::Portable2 => portable::compress2_loop(jobs, finalize, stride),
             _ => panic!("unsupported"),
         }
     }
 
-    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64", feature = "portable_simd"))]
     pub fn compress4_loop(&self, jobs: &mut [Job; 4], finalize: Finalize, stride: Stride) {
         match self.0 {
-            Platform::AVX2 => unsafe { avx2::compress4_loop(jobs, finalize, stride) },
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Platform::AVX2 | Platform::AVX2Interleaved | Platform::AVX2Hybrid => unsafe {
+                avx2::compress4_loop(jobs, finalize, stride)
+            },
+            #[cfg(feature = "portable_simd")]
+            Platform::PortableSimd => unsafe {
+                portable_simd::compress_n_loop(jobs, finalize, stride)
+            },
+            _ => panic!("unsupported"),
+        }
+    }
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    pub fn compress5_loop(&self, jobs: &mut [Job; 5], finalize: Finalize, stride: Stride) {
+        match self.0 {
+            Platform::AVX2Hybrid => unsafe { avx2::compress5_loop(jobs, finalize, stride) },
+            _ => panic!("unsupported"),
+        }
+    }
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    pub fn compress8_loop(&self, jobs: &mut [Job; 8], finalize: Finalize, stride: Stride) {
+        match self.0 {
+            Platform::AVX2Interleaved => unsafe { avx2::compress8_loop(jobs, finalize, stride) },
+            _ => panic!("unsupported"),
+        }
+    }
+
+    pub fn iterate2(&self, chains: &mut [[Word; 8]; 2], step: &ChainStep, iterations: u64) {
+        match self.0 {
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Platform::AVX2 | Platform::AVX2Interleaved | Platform::AVX2Hybrid | Platform::SSE41 => unsafe {
+                sse41::iterate2(chains, step, iterations)
+            },
+            #[cfg(feature = "portable_simd")]
+            Platform::PortableSimd => unsafe { portable_simd::iterate_n(chains, step, iterations) },
+            Platform::Portable2 => portable::iterate2(chains, step, iterations),
+            _ => panic!("unsupported"),
+        }
+    }
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64", feature = "portable_simd"))]
+    pub fn iterate4(&self, chains: &mut [[Word; 8]; 4], step: &ChainStep, iterations: u64) {
+        match self.0 {
+            #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+            Platform::AVX2 | Platform::AVX2Interleaved | Platform::AVX2Hybrid => unsafe {
+                avx2::iterate4(chains, step, iterations)
+            },
+            #[cfg(feature = "portable_simd")]
+            Platform::PortableSimd => unsafe { portable_simd::iterate_n(chains, step, iterations) },
             _ => panic!("unsupported"),
         }
     }
@@ -154,6 +345,37 @@ impl<'a, 'b> core::fmt::Debug for Job<'a, 'b> {
     }
 }
 
+// The parts of a hash chain step that are the same for every chain and every
+// step, for the iterateN kernels. Each step hashes the previous digest, which
+// is hash_length bytes, as a single final block.
+#[derive(Clone, Copy)]
+pub struct ChainStep {
+    // The state words after the key block, if any.
+    pub words: [Word; 8],
+    // The count after the final block, including any key block.
+    pub count: Count,
+    pub last_node: LastNode,
+    pub hash_length: usize,
+}
+
+impl ChainStep {
+    // For each state word, a mask of the bytes that belong to the digest.
+    // Masking the state words of one step gives the message words of the next.
+    pub fn digest_masks(&self) -> [Word; 8] {
+        let mut masks = [0; 8];
+        for (i, mask) in masks.iter_mut().enumerate() {
+            let start = i * size_of::<Word>();
+            let bytes = cmp::min(self.hash_length.saturating_sub(start), size_of::<Word>());
+            *mask = if bytes == size_of::<Word>() {
+                !0
+            } else {
+                (1 << (8 * bytes)) - 1
+            };
+        }
+        masks
+    }
+}
+
 // Finalize could just be a bool, but this is easier to read at callsites.
 #[derive(Clone, Copy, Debug)]
 pub enum Finalize {
@@ -263,6 +485,17 @@ mod test {
     use super::*;
     use core::mem::size_of;
 
+    #[test]
+    #[cfg(all(feature = "std", any(target_arch = "x86", target_arch = "x86_64")))]
+    fn test_detection_cached() {
+        let uncached = Implementation::detect_uncached().0;
+        assert_eq!(uncached, Implementation::detect().0);
+        assert_eq!(uncached, Platform::from_u8(uncached as u8));
+        #[cfg(not(target_feature = "avx2"))]
+        assert_eq!(uncached as u8, DETECTED.load(Ordering::Relaxed));
+        assert_eq!(uncached, Implementation::detect().0);
+    }
+
     #[test]
     fn test_detection() {
         assert_eq!(Platform::Portable, Implementation::portable().0);
@@ -293,6 +526,14 @@ mod test {
                 assert!(Implementation::sse41_if_supported().is_none());
             }
         }
+
+        #[cfg(all(
+            feature = "portable_simd",
+            not(any(target_arch = "x86", target_arch = "x86_64"))
+        ))]
+        {
+            assert_eq!(Platform::PortableSimd, Implementation::detect().0);
+        }
     }
 
     // TODO: Move all of these case tests into the implementation files.
@@ -417,6 +658,11 @@ mod test {
         exercise_compress1_loop(Implementation::portable());
     }
 
+    #[test]
+    fn test_compress1_loop_portable2() {
+        exercise_compress1_loop(Implementation::portable2());
+    }
+
     #[test]
     #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
     fn test_compress1_loop_sse41() {
@@ -434,12 +680,17 @@ mod test {
         }
     }
 
+    #[test]
+    #[cfg(feature = "portable_simd")]
+    fn test_compress1_loop_portable_simd() {
+        exercise_compress1_loop(Implementation::portable_simd());
+    }
+
     // I use ArrayVec everywhere in here becuase currently these tests pass
     // under no_std. I might decide that's not worth maintaining at some point,
     // since really all we care about with no_std is that the library builds,
     // but for now it's here. Everything is keyed off of this N constant so
     // that it's easy to copy the code to exercise_compress4_loop.
-    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
     fn exercise_compress2_loop(implementation: Implementation) {
         const N: usize = 2;
 
@@ -486,6 +737,11 @@ mod test {
         });
     }
 
+    #[test]
+    fn test_compress2_loop_portable2() {
+        exercise_compress2_loop(Implementation::portable2());
+    }
+
     #[test]
     #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
     fn test_compress2_loop_sse41() {
@@ -503,9 +759,15 @@ mod test {
         }
     }
 
+    #[test]
+    #[cfg(feature = "portable_simd")]
+    fn test_compress2_loop_portable_simd() {
+        exercise_compress2_loop(Implementation::portable_simd());
+    }
+
     // Copied from exercise_compress2_loop, with a different value of N and an
     // interior call to compress4_loop.
-    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64", feature = "portable_simd"))]
     fn exercise_compress4_loop(implementation: Implementation) {
         const N: usize = 4;
 
@@ -560,6 +822,126 @@ mod test {
         }
     }
 
+    #[test]
+    #[cfg(feature = "portable_simd")]
+    fn test_compress4_loop_portable_simd() {
+        exercise_compress4_loop(Implementation::portable_simd());
+    }
+
+    // Copied from exercise_compress2_loop, with a different value of N and an
+    // interior call to compress5_loop.
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    fn exercise_compress5_loop(implementation: Implementation) {
+        const N: usize = 5;
+
+        let mut input_buffer = [0; 100 * BLOCKBYTES];
+        paint_test_input(&mut input_buffer);
+        let mut inputs = arrayvec::ArrayVec::<_, N>::new();
+        for i in 0..N {
+            inputs.push(&input_buffer[i..]);
+        }
+
+        exercise_cases(|stride, length, last_node, finalize, count| {
+            let mut reference_words = arrayvec::ArrayVec::<_, N>::new();
+            for i in 0..N {
+                let words = reference_compression(
+                    &inputs[i][..length],
+                    stride,
+                    last_node,
+                    finalize,
+                    count.wrapping_add((i * BLOCKBYTES) as Count),
+                    i,
+                );
+                reference_words.push(words);
+            }
+
+            let mut test_words = arrayvec::ArrayVec::<_, N>::new();
+            for i in 0..N {
+                test_words.push(initial_test_words(i));
+            }
+            let mut jobs = arrayvec::ArrayVec::<_, N>::new();
+            for (i, words) in test_words.iter_mut().enumerate() {
+                jobs.push(Job {
+                    input: &inputs[i][..length],
+                    words,
+                    count: count.wrapping_add((i * BLOCKBYTES) as Count),
+                    last_node,
+                });
+            }
+            let mut jobs = jobs.into_inner().expect("full");
+            implementation.compress5_loop(&mut jobs, finalize, stride);
+
+            for i in 0..N {
+                assert_eq!(reference_words[i], test_words[i], "words {} unequal", i);
+            }
+        });
+    }
+
+    #[test]
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    fn test_compress5_loop_avx2_hybrid() {
+        if let Some(imp) = Implementation::avx2_hybrid_if_supported() {
+            exercise_compress5_loop(imp);
+        }
+    }
+
+    // Copied from exercise_compress2_loop, with a different value of N and an
+    // interior call to compress8_loop.
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    fn exercise_compress8_loop(implementation: Implementation) {
+        const N: usize = 8;
+
+        let mut input_buffer = [0; 100 * BLOCKBYTES];
+        paint_test_input(&mut input_buffer);
+        let mut inputs = arrayvec::ArrayVec::<_, N>::new();
+        for i in 0..N {
+            inputs.push(&input_buffer[i..]);
+        }
+
+        exercise_cases(|stride, length, last_node, finalize, count| {
+            let mut reference_words = arrayvec::ArrayVec::<_, N>::new();
+            for i in 0..N {
+                let words = reference_compression(
+                    &inputs[i][..length],
+                    stride,
+                    last_node,
+                    finalize,
+                    count.wrapping_add((i * BLOCKBYTES) as Count),
+                    i,
+                );
+                reference_words.push(words);
+            }
+
+            let mut test_words = arrayvec::ArrayVec::<_, N>::new();
+            for i in 0..N {
+                test_words.push(initial_test_words(i));
+            }
+            let mut jobs = arrayvec::ArrayVec::<_, N>::new();
+            for (i, words) in test_words.iter_mut().enumerate() {
+                jobs.push(Job {
+                    input: &inputs[i][..length],
+                    words,
+                    count: count.wrapping_add((i * BLOCKBYTES) as Count),
+                    last_node,
+                });
+            }
+            let mut jobs = jobs.into_inner().expect("full");
+            implementation.compress8_loop(&mut jobs, finalize, stride);
+
+            for i in 0..N {
+                assert_eq!(reference_words[i], test_words[i], "words {} unequal", i);
+            }
+        });
+    }
+
+    #[test]
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    fn test_compress8_loop_avx2_interleaved() {
+        if let Some(imp) = Implementation::avx2_interleaved_if_supported() {
+            exercise_compress8_loop(imp);
+        }
+    }
+
     #[test]
     fn sanity_check_count_size() {
         assert_eq!(size_of::<Count>(), 2 * size_of::<Word>());
@@ -42,7 +42,7 @@
 //! }
 //! ```
 
-use crate::guts::{self, Finalize, Implementation, Job, LastNode, Stride};
+use crate::guts::{self, ChainStep, Finalize, Implementation, Job, LastNode, Stride};
 use crate::state_words_to_bytes;
 use crate::Count;
 use crate::Hash;
@@ -51,7 +51,9 @@ use crate::State;
 use crate::Word;
 use crate::BLOCKBYTES;
 use arrayvec::ArrayVec;
+use core::cmp;
 use core::fmt;
+use core::mem::size_of;
 
 /// The largest possible value of [`degree`](fn.degree.html) on the target
 /// platform.
@@ -92,9 +94,20 @@ pub fn degree() -> usize {
     guts::Implementation::detect().degree()
 }
 
-type JobsVec<'a, 'b> = ArrayVec<Job<'a, 'b>, { guts::MAX_DEGREE }>;
-
+// Interleaved and hybrid AVX2 have higher degrees than AVX2, and Portable2 has
+// degree 2 on every target, but they're never detected, so they don't count
+// towards MAX_DEGREE.
 #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+const JOBS_VEC_CAPACITY: usize = 2 * guts::MAX_DEGREE;
+#[cfg(not(any(target_arch = "x86", target_arch = "x86_64")))]
+const JOBS_VEC_CAPACITY: usize = if guts::MAX_DEGREE > 2 {
+    guts::MAX_DEGREE
+} else {
+    2
+};
+
+type JobsVec<'a, 'b> = ArrayVec<Job<'a, 'b>, JOBS_VEC_CAPACITY>;
+
 #[inline(always)]
 fn fill_jobs_vec<'a, 'b>(
     jobs_iter: &mut impl Iterator<Item = Job<'a, 'b>>,
@@ -110,7 +123,6 @@ fn fill_jobs_vec<'a, 'b>(
     }
 }
 
-#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
 #[inline(always)]
 fn evict_finished<'a, 'b>(vec: &mut JobsVec<'a, 'b>, num_jobs: usize) {
     // Iterate backwards so that removal doesn't cause an out-of-bounds panic.
@@ -147,6 +159,34 @@ pub(crate) fn compress_many<'a, 'b, I>(
     let mut jobs_vec = JobsVec::new();
 
     #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    if imp.degree() >= 8 {
+        loop {
+            fill_jobs_vec(&mut jobs_iter, &mut jobs_vec, 8);
+            if jobs_vec.len() < 8 {
+                break;
+            }
+            let jobs_array = arrayref::array_mut_ref!(jobs_vec, 0, 8);
+            imp.compress8_loop(jobs_array, finalize, stride);
+            evict_finished(&mut jobs_vec, 8);
+        }
+    }
+
+    // Only the hybrid AVX2 implementation has degree 5. Its leftover jobs go
+    // through the regular 4-way loop below.
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    if imp.degree() == 5 {
+        loop {
+            fill_jobs_vec(&mut jobs_iter, &mut jobs_vec, 5);
+            if jobs_vec.len() < 5 {
+                break;
+            }
+            let jobs_array = arrayref::array_mut_ref!(jobs_vec, 0, 5);
+            imp.compress5_loop(jobs_array, finalize, stride);
+            evict_finished(&mut jobs_vec, 5);
+        }
+    }
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64", feature = "portable_simd"))]
     if imp.degree() >= 4 {
         loop {
             fill_jobs_vec(&mut jobs_iter, &mut jobs_vec, 4);
@@ -159,7 +199,6 @@ pub(crate) fn compress_many<'a, 'b, I>(
         }
     }
 
-    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
     if imp.degree() >= 2 {
         loop {
             fill_jobs_vec(&mut jobs_iter, &mut jobs_vec, 2);
@@ -275,7 +314,10 @@ pub struct HashManyJob<'a> {
     count: Count,
     last_node: LastNode,
     hash_length: u8,
+    // For a vectored job, the input is the current segment, and the rest are
+    // in segments. For a contiguous job, segments is empty.
     input: &'a [u8],
+    segments: &'a [&'a [u8]],
     finished: bool,
     implementation: guts::Implementation,
 }
@@ -313,11 +355,118 @@ impl<'a> HashManyJob<'a> {
             last_node: params.last_node,
             hash_length: params.hash_length,
             input,
+            segments: &[],
             finished,
             implementation: params.implementation,
         }
     }
 
+    /// Construct a new `HashManyJob` from a set of hashing parameters and an
+    /// input that's split into segments, like a header followed by a list of
+    /// body buffers. The hash is the same as the hash of all the segments
+    /// concatenated, but the segments aren't copied into a single buffer.
+    ///
+    /// [`hash_many`] hashes the full blocks within each segment in place, like
+    /// any other input. Only blocks that straddle a segment boundary get
+    /// copied, one block at a time.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use blake2b_simd::{blake2b, many::{hash_many, HashManyJob}, Params};
+    ///
+    /// let header = [0xaa; 40];
+    /// let body = [0xbb; 1000];
+    /// let segments = [&header[..], &body[..300], &body[300..]];
+    /// let mut message = header.to_vec();
+    /// message.extend_from_slice(&body);
+    ///
+    /// let params = Params::new();
+    /// let mut jobs = [
+    ///     HashManyJob::new_vectored(&params, &segments),
+    ///     HashManyJob::new(&params, &message),
+    /// ];
+    /// hash_many(jobs.iter_mut());
+    ///
+    /// assert_eq!(blake2b(&message), jobs[0].to_hash());
+    /// assert_eq!(jobs[1].to_hash(), jobs[0].to_hash());
+    /// ```
+    ///
+    /// [`hash_many`]: fn.hash_many.html
+    pub fn new_vectored(params: &Params, segments: &'a [&'a [u8]]) -> Self {
+        // Drop empty segments at either end. HashManyJob::new needs to see
+        // whether there's any input at all, and trailing empty segments would
+        // hide the end of the input from the segmented loop in hash_many.
+        let mut segments = segments;
+        while let Some((first, rest)) = segments.split_first() {
+            if !first.is_empty() {
+                break;
+            }
+            segments = rest;
+        }
+        while let Some((last, rest)) = segments.split_last() {
+            if !last.is_empty() {
+                break;
+            }
+            segments = rest;
+        }
+        let (input, segments) = match segments.split_first() {
+            Some((&first, rest)) => (first, rest),
+            None => (&[][..], &[][..]),
+        };
+        let mut job = Self::new(params, input);
+        job.segments = segments;
+        job
+    }
+
+    // Skip ahead to the next segment with input in it, if the current one is
+    // used up. Because new_vectored() drops trailing empty segments, an empty
+    // segments list after this means the current segment is the last input.
+    fn next_segment(&mut self) {
+        while self.input.is_empty() {
+            if let Some((&first, rest)) = self.segments.split_first() {
+                self.input = first;
+                self.segments = rest;
+            } else {
+                break;
+            }
+        }
+    }
+
+    // Take the next piece of a vectored job's input. Runs of full blocks come
+    // straight from the current segment. A block that straddles a boundary is
+    // copied into the stage, filling it from as many segments as it needs.
+    fn next_piece(&mut self, stage: &mut [u8; BLOCKBYTES]) -> Piece<'a> {
+        self.next_segment();
+        if self.segments.is_empty() {
+            // The rest of the input is contiguous.
+            let input = self.input;
+            self.input = &[];
+            return Piece::Last(input);
+        }
+        // There's input after this segment, so none of these full blocks can
+        // be the last block.
+        let full_blocks_len = self.input.len() - self.input.len() % BLOCKBYTES;
+        if full_blocks_len > 0 {
+            let (run, rest) = self.input.split_at(full_blocks_len);
+            self.input = rest;
+            return Piece::Run(run);
+        }
+        let mut staged = 0;
+        while staged < BLOCKBYTES && !self.input.is_empty() {
+            let take = cmp::min(BLOCKBYTES - staged, self.input.len());
+            stage[staged..][..take].copy_from_slice(&self.input[..take]);
+            staged += take;
+            self.input = &self.input[take..];
+            self.next_segment();
+        }
+        if self.input.is_empty() {
+            Piece::LastStaged(staged)
+        } else {
+            Piece::Staged
+        }
+    }
+
     /// Get the hash from a finished job. If you call this before calling
     /// [`hash_many`], it will panic in debug mode.
     ///
@@ -335,13 +484,15 @@ impl<'a> HashManyJob<'a> {
 impl<'a> fmt::Debug for HashManyJob<'a> {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         // NB: Don't print the words. Leaking them would allow length extension.
+        let input_len: usize =
+            self.input.len() + self.segments.iter().map(|s| s.len()).sum::<usize>();
         write!(
             f,
             "HashManyJob {{ count: {}, hash_length: {}, last_node: {}, input_len: {} }}",
             self.count,
             self.hash_length,
             self.last_node.yes(),
-            self.input.len(),
+            input_len,
         )
     }
 }
@@ -406,16 +557,845 @@ where
     // bytes in every HashManyJob, but that would add unnecessary storage and
     // zeroing for all callers.
     let unfinished_jobs = peekable_jobs.into_iter().filter(|j| !j.finished);
-    let jobs = unfinished_jobs.map(|j| {
+    // Vectored jobs are set aside and hashed in windows of their own, as each
+    // window fills up. Contiguous jobs go straight through.
+    let mut segmented = SegmentedJobs::new();
+    let jobs = unfinished_jobs.filter_map(|j| {
+        if !j.segments.is_empty() {
+            segmented.push(j);
+            if segmented.is_full() {
+                hash_segmented(&mut segmented, implementation);
+            }
+            return None;
+        }
         j.finished = true;
-        Job {
+        Some(Job {
             input: j.input,
             words: &mut j.words,
             count: j.count,
             last_node: j.last_node,
-        }
+        })
     });
     compress_many(jobs, implementation, Finalize::Yes, Stride::Serial);
+    hash_segmented(&mut segmented, implementation);
+}
+
+// How many vectored jobs hash_many works on at once. Each one needs a block
+// of staging space on the stack.
+const SEGMENTED_WINDOW: usize = 16;
+
+type SegmentedJobs<'a, 'b> = ArrayVec<&'a mut HashManyJob<'b>, SEGMENTED_WINDOW>;
+
+// The next part of a vectored job's input, from HashManyJob::next_piece.
+#[derive(Clone, Copy)]
+enum Piece<'a> {
+    // Full blocks within one segment, with more input after them.
+    Run(&'a [u8]),
+    // One full block in the stage, with more input after it.
+    Staged,
+    // The rest of the input, within one segment.
+    Last(&'a [u8]),
+    // The rest of the input, in the first n bytes of the stage.
+    LastStaged(usize),
+}
+
+impl<'a> Piece<'a> {
+    fn is_last(&self) -> bool {
+        match self {
+            Piece::Last(_) | Piece::LastStaged(_) => true,
+            Piece::Run(_) | Piece::Staged => false,
+        }
+    }
+
+    fn input<'s>(&self, stage: &'s [u8; BLOCKBYTES]) -> &'s [u8]
+    where
+        'a: 's,
+    {
+        match *self {
+            Piece::Run(input) | Piece::Last(input) => input,
+            Piece::Staged => stage,
+            Piece::LastStaged(len) => &stage[..len],
+        }
+    }
+}
+
+// Hash a window of vectored jobs and clear it. Every round takes the next
+// piece of each job and compresses all of them together, so the jobs keep
+// sharing SIMD lanes across their segment boundaries. The last pieces are
+// held back until every job has reached its own, and then they're all
+// finalized together.
+fn hash_segmented(jobs: &mut SegmentedJobs, implementation: Implementation) {
+    let mut stages = [[0; BLOCKBYTES]; SEGMENTED_WINDOW];
+    let mut pieces = [Piece::Run(&[]); SEGMENTED_WINDOW];
+    loop {
+        let mut any_runs = false;
+        for ((job, stage), piece) in jobs.iter_mut().zip(&mut stages).zip(&mut pieces) {
+            if !piece.is_last() {
+                *piece = job.next_piece(stage);
+                any_runs |= !piece.is_last();
+            }
+        }
+        if !any_runs {
+            break;
+        }
+        let round =
+            jobs.iter_mut()
+                .zip(&stages)
+                .zip(&pieces)
+                .filter_map(|((job, stage), piece)| {
+                    if piece.is_last() {
+                        return None;
+                    }
+                    let input = piece.input(stage);
+                    let count = job.count;
+                    job.count = job.count.wrapping_add(input.len() as Count);
+                    Some(Job {
+                        input,
+                        words: &mut job.words,
+                        count,
+                        last_node: job.last_node,
+                    })
+                });
+        compress_many(round, implementation, Finalize::No, Stride::Serial);
+    }
+    let last = jobs
+        .iter_mut()
+        .zip(&stages)
+        .zip(&pieces)
+        .map(|((job, stage), piece)| {
+            job.finished = true;
+            Job {
+                input: piece.input(stage),
+                words: &mut job.words,
+                count: job.count,
+                last_node: job.last_node,
+            }
+        });
+    compress_many(last, implementation, Finalize::Yes, Stride::Serial);
+    jobs.clear();
+}
+
+// How many inputs hash_many_truncated hashes per call to compress_many. Only
+// this many sets of state words are live at once, on the stack.
+const TRUNCATED_CHUNK: usize = 64;
+
+// Store the first out.len() bytes of the state, touching only the words that
+// hold them.
+fn store_truncated(words: &[Word; 8], out: &mut [u8]) {
+    for (word, out) in words.iter().zip(out.chunks_mut(size_of::<Word>())) {
+        out.copy_from_slice(&word.to_le_bytes()[..out.len()]);
+    }
+}
+
+/// Hash many inputs to short outputs, like fingerprints for hash tables and
+/// Bloom filters, and write each output directly into `outputs`.
+///
+/// This computes the same hashes as [`hash_many`], but without the per-input
+/// [`HashManyJob`] and [`Hash`]. Only a small window of state words is live at
+/// any one time, and only the words that hold the first `N` bytes of each
+/// hash are stored to the output. The key block, if any, is compressed once
+/// for all the inputs, rather than once per input.
+///
+/// # Panics
+///
+/// Panics if `params` doesn't have a hash length of `N`, or if `inputs` and
+/// `outputs` have different lengths.
+///
+/// # Example
+///
+/// ```
+/// use blake2b_simd::{many::hash_many_truncated, Params};
+///
+/// let mut params = Params::new();
+/// params.hash_length(16);
+/// let inputs = [&b"foo"[..], b"bar", b"baz", b"bing", b"bang"];
+/// let mut fingerprints = [[0; 16]; 5];
+/// hash_many_truncated(&params, &inputs, &mut fingerprints);
+///
+/// for (input, fingerprint) in inputs.iter().zip(fingerprints.iter()) {
+///     assert_eq!(params.hash(input).as_bytes(), fingerprint);
+/// }
+/// ```
+///
+/// [`hash_many`]: fn.hash_many.html
+/// [`HashManyJob`]: struct.HashManyJob.html
+/// [`Hash`]: ../struct.Hash.html
+pub fn hash_many_truncated<T: AsRef<[u8]>, const N: usize>(
+    params: &Params,
+    inputs: &[T],
+    outputs: &mut [[u8; N]],
+) {
+    assert_eq!(N, params.hash_length as usize, "N must be the hash length");
+    assert_eq!(inputs.len(), outputs.len(), "one output per input");
+    let implementation = params.implementation;
+    let mut initial_words = params.to_words();
+    let mut initial_count = 0;
+    if params.key_length > 0 {
+        implementation.compress1_loop(
+            &params.key_block,
+            &mut initial_words,
+            0,
+            params.last_node,
+            Finalize::No,
+            Stride::Serial,
+        );
+        initial_count = BLOCKBYTES as Count;
+    }
+    // The key block is the last block of an empty keyed input. Finalize it by
+    // itself, like HashManyJob::new does.
+    let keyed_empty = |words: &mut [Word; 8]| {
+        *words = params.to_words();
+        implementation.compress1_loop(
+            &params.key_block,
+            words,
+            0,
+            params.last_node,
+            Finalize::Yes,
+            Stride::Serial,
+        );
+    };
+    let start = TruncatedStart {
+        words: &initial_words,
+        count: initial_count,
+        keyed: params.key_length > 0,
+        last_node: params.last_node,
+        implementation,
+    };
+    hash_truncated_from(&start, keyed_empty, inputs, outputs);
+}
+
+// Where hash_truncated_from starts each input: the state after the key block,
+// if any.
+struct TruncatedStart<'a> {
+    words: &'a [Word; 8],
+    count: Count,
+    keyed: bool,
+    last_node: LastNode,
+    implementation: Implementation,
+}
+
+// The shared loop of hash_many_truncated and MacKey. For keyed hashing,
+// keyed_empty produces the final state words of an empty input.
+fn hash_truncated_from<T: AsRef<[u8]>, const N: usize>(
+    start: &TruncatedStart,
+    keyed_empty: impl Fn(&mut [Word; 8]),
+    inputs: &[T],
+    outputs: &mut [[u8; N]],
+) {
+    let input_chunks = inputs.chunks(TRUNCATED_CHUNK);
+    let output_chunks = outputs.chunks_mut(TRUNCATED_CHUNK);
+    for (inputs, outputs) in input_chunks.zip(output_chunks) {
+        let mut words = [*start.words; TRUNCATED_CHUNK];
+        let jobs = inputs
+            .iter()
+            .zip(words.iter_mut())
+            .filter_map(|(input, words)| {
+                let input = input.as_ref();
+                if start.keyed && input.is_empty() {
+                    keyed_empty(words);
+                    return None;
+                }
+                Some(Job {
+                    input,
+                    words,
+                    count: start.count,
+                    last_node: start.last_node,
+                })
+            });
+        compress_many(jobs, start.implementation, Finalize::Yes, Stride::Serial);
+        for (words, output) in words.iter().zip(outputs.iter_mut()) {
+            store_truncated(words, output);
+        }
+    }
+}
+
+/// Hash many inputs to 64-bit fingerprints, like [`hash_many_truncated`] with
+/// `N = 8`, and store each one as a little-endian `u64`.
+///
+/// # Panics
+///
+/// Panics if `params` doesn't have a hash length of 8, or if `inputs` and
+/// `outputs` have different lengths.
+///
+/// # Example
+///
+/// ```
+/// use blake2b_simd::{many::hash_many_u64, Params};
+///
+/// let mut params = Params::new();
+/// params.hash_length(8);
+/// let inputs = [&b"foo"[..], b"bar", b"baz"];
+/// let mut fingerprints = [0u64; 3];
+/// hash_many_u64(&params, &inputs, &mut fingerprints);
+///
+/// let expected = params.hash(b"bar");
+/// assert_eq!(&fingerprints[1].to_le_bytes(), expected.as_bytes());
+/// ```
+///
+/// [`hash_many_truncated`]: fn.hash_many_truncated.html
+pub fn hash_many_u64<T: AsRef<[u8]>>(params: &Params, inputs: &[T], outputs: &mut [u64]) {
+    assert_eq!(inputs.len(), outputs.len(), "one output per input");
+    let mut bytes = [[0; 8]; TRUNCATED_CHUNK];
+    let input_chunks = inputs.chunks(TRUNCATED_CHUNK);
+    let output_chunks = outputs.chunks_mut(TRUNCATED_CHUNK);
+    for (inputs, outputs) in input_chunks.zip(output_chunks) {
+        let bytes = &mut bytes[..inputs.len()];
+        hash_many_truncated(params, inputs, bytes);
+        for (bytes, output) in bytes.iter().zip(outputs.iter_mut()) {
+            *output = u64::from_le_bytes(*bytes);
+        }
+    }
+}
+
+/// A precomputed key for checking many short MACs under the same key, like
+/// per-packet or per-record authentication tags.
+///
+/// A keyed BLAKE2b hash compresses the key, padded to a full block, before
+/// any input. `MacKey` does that once, when it's constructed, and every call
+/// to [`mac_many`] or [`verify_many`] starts from the resulting midstate. The
+/// inputs of a call are hashed together across SIMD lanes, as in
+/// [`hash_many_truncated`], so a receive batch of equal-length messages runs
+/// in the widest kernel available, four at a time with AVX2. As with
+/// [`degree`], batches that are a multiple of the degree work best.
+///
+/// `MacKey` holds the midstate, not the key or the `Params`, and its `Debug`
+/// output doesn't include either.
+///
+/// # Panics
+///
+/// [`new`] panics if `params` doesn't have a key, or doesn't have a hash
+/// length of `N`.
+///
+/// # Example
+///
+/// ```
+/// use blake2b_simd::{many::MacKey, Params};
+///
+/// let mac_key = MacKey::<16>::new(Params::new().hash_length(16).key(b"cookie key"));
+/// let packets = [&b"first handshake"[..], b"second handshake"];
+/// let mut macs = [[0; 16]; 2];
+/// mac_key.mac_many(&packets, &mut macs);
+///
+/// let mut valid = [false; 2];
+/// mac_key.verify_many(&packets, &[macs[0], [0; 16]], &mut valid);
+/// assert_eq!(valid, [true, false]);
+/// ```
+///
+/// [`new`]: #method.new
+/// [`mac_many`]: #method.mac_many
+/// [`verify_many`]: #method.verify_many
+/// [`hash_many_truncated`]: fn.hash_many_truncated.html
+/// [`degree`]: fn.degree.html
+#[derive(Clone)]
+pub struct MacKey<const N: usize> {
+    words: [Word; 8],
+    // The final state words for an empty input, where the key block is the
+    // last block.
+    empty_words: [Word; 8],
+    last_node: LastNode,
+    implementation: Implementation,
+}
+
+impl<const N: usize> MacKey<N> {
+    /// Compress the key block of `params` into a midstate.
+    pub fn new(params: &Params) -> Self {
+        assert!(params.key_length > 0, "a MacKey needs a key");
+        assert_eq!(N, params.hash_length as usize, "N must be the hash length");
+        let mut words = params.to_words();
+        let mut empty_words = params.to_words();
+        params.implementation.compress1_loop(
+            &params.key_block,
+            &mut words,
+            0,
+            params.last_node,
+            Finalize::No,
+            Stride::Serial,
+        );
+        params.implementation.compress1_loop(
+            &params.key_block,
+            &mut empty_words,
+            0,
+            params.last_node,
+            Finalize::Yes,
+            Stride::Serial,
+        );
+        Self {
+            words,
+            empty_words,
+            last_node: params.last_node,
+            implementation: params.implementation,
+        }
+    }
+
+    /// Compute the MAC of each input into the matching element of `outputs`.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `inputs` and `outputs` have different lengths.
+    pub fn mac_many<T: AsRef<[u8]>>(&self, inputs: &[T], outputs: &mut [[u8; N]]) {
+        assert_eq!(inputs.len(), outputs.len(), "one output per input");
+        let start = TruncatedStart {
+            words: &self.words,
+            count: BLOCKBYTES as Count,
+            keyed: true,
+            last_node: self.last_node,
+            implementation: self.implementation,
+        };
+        hash_truncated_from(&start, |words| *words = self.empty_words, inputs, outputs);
+    }
+
+    /// Check the MAC of each input against the matching element of `macs`,
+    /// and store whether it matched in `results`. Each comparison is constant
+    /// time.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `inputs`, `macs`, and `results` don't all have the same
+    /// length.
+    pub fn verify_many<T: AsRef<[u8]>>(
+        &self,
+        inputs: &[T],
+        macs: &[[u8; N]],
+        results: &mut [bool],
+    ) {
+        assert_eq!(inputs.len(), macs.len(), "one MAC per input");
+        assert_eq!(inputs.len(), results.len(), "one result per input");
+        let mut computed = [[0; N]; TRUNCATED_CHUNK];
+        let chunks = inputs
+            .chunks(TRUNCATED_CHUNK)
+            .zip(macs.chunks(TRUNCATED_CHUNK))
+            .zip(results.chunks_mut(TRUNCATED_CHUNK));
+        for ((inputs, macs), results) in chunks {
+            let computed = &mut computed[..inputs.len()];
+            self.mac_many(inputs, computed);
+            for ((computed, mac), result) in computed.iter().zip(macs).zip(results) {
+                *result = constant_time_eq::constant_time_eq(computed, mac);
+            }
+        }
+    }
+}
+
+impl<const N: usize> fmt::Debug for MacKey<N> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        // NB: Don't print the words. They're as good as the key.
+        write!(
+            f,
+            "MacKey {{ hash_length: {}, last_node: {} }}",
+            N,
+            self.last_node.yes(),
+        )
+    }
+}
+
+// How many jobs a HashManyIter keeps in flight. The extra jobs beyond
+// MAX_DEGREE are look-ahead, so that there's something to fill a lane with
+// when a short input finishes.
+const STREAM_WINDOW: usize = 2 * guts::MAX_DEGREE;
+
+// How far a HashManyIter advances a long input in each round, before it
+// checks for finished lanes to refill.
+const STREAM_ROUND_BYTES: usize = 16 * BLOCKBYTES;
+
+struct StreamJob<Id, T> {
+    id: Id,
+    input: T,
+    offset: usize,
+    words: [Word; 8],
+    count: Count,
+    finished: bool,
+}
+
+/// An iterator that hashes a stream of inputs, returned by
+/// [`hash_many_iter`].
+///
+/// [`hash_many_iter`]: fn.hash_many_iter.html
+pub struct HashManyIter<'p, I, Id, T> {
+    params: &'p Params,
+    inputs: I,
+    initial_words: [Word; 8],
+    initial_count: Count,
+    live: ArrayVec<StreamJob<Id, T>, STREAM_WINDOW>,
+    ready: ArrayVec<(Id, Hash), STREAM_WINDOW>,
+}
+
+/// Hash an unbounded stream of `(id, input)` pairs, and yield `(id, hash)`
+/// pairs as the inputs finish.
+///
+/// Unlike [`hash_many`], this doesn't need every job up front. It pulls a
+/// window of twice [`MAX_DEGREE`] inputs at a time, half to fill the lanes
+/// and half as look-ahead. It refills the window as inputs finish, so memory
+/// use is constant no matter how many inputs there are. Long inputs are
+/// hashed a few blocks at a time, so that short inputs behind them can keep
+/// the other SIMD lanes busy.
+///
+/// Results come out in the order that inputs finish, which isn't
+/// necessarily the order they went in. That's what the ids are for. The
+/// inputs can be anything that implements `AsRef<[u8]>`, like a borrowed
+/// slice or an owned `Vec<u8>`. Each input is dropped after its hash is
+/// yielded.
+///
+/// # Example
+///
+/// ```
+/// use blake2b_simd::{many::hash_many_iter, Params};
+///
+/// let rows = vec![(1, &b"foo"[..]), (2, &b"bar"[..]), (3, &b"baz"[..])];
+/// let params = Params::new();
+/// let mut seen = 0;
+/// for (id, hash) in hash_many_iter(&params, rows.iter().copied()) {
+///     let (_, row) = rows.iter().find(|(row_id, _)| *row_id == id).unwrap();
+///     assert_eq!(params.hash(row), hash);
+///     seen += 1;
+/// }
+/// assert_eq!(rows.len(), seen);
+/// ```
+///
+/// [`hash_many`]: fn.hash_many.html
+/// [`MAX_DEGREE`]: constant.MAX_DEGREE.html
+pub fn hash_many_iter<'p, I, Id, T>(
+    params: &'p Params,
+    inputs: I,
+) -> HashManyIter<'p, I::IntoIter, Id, T>
+where
+    I: IntoIterator<Item = (Id, T)>,
+    T: AsRef<[u8]>,
+{
+    let mut initial_words = params.to_words();
+    let mut initial_count = 0;
+    if params.key_length > 0 {
+        params.implementation.compress1_loop(
+            &params.key_block,
+            &mut initial_words,
+            0,
+            params.last_node,
+            Finalize::No,
+            Stride::Serial,
+        );
+        initial_count = BLOCKBYTES as Count;
+    }
+    HashManyIter {
+        params,
+        inputs: inputs.into_iter(),
+        initial_words,
+        initial_count,
+        live: ArrayVec::new(),
+        ready: ArrayVec::new(),
+    }
+}
+
+impl<'p, I, Id, T> HashManyIter<'p, I, Id, T>
+where
+    I: Iterator<Item = (Id, T)>,
+    T: AsRef<[u8]>,
+{
+    fn fill(&mut self) {
+        while !self.live.is_full() {
+            let (id, input) = match self.inputs.next() {
+                Some(pair) => pair,
+                None => return,
+            };
+            if self.params.key_length > 0 && input.as_ref().is_empty() {
+                // The key block is the last block, and it's already been
+                // compressed without finalization. Hash this one by itself,
+                // and hand it out before taking any more input.
+                self.ready.push((id, self.params.hash(&[])));
+                return;
+            }
+            self.live.push(StreamJob {
+                id,
+                input,
+                offset: 0,
+                words: self.initial_words,
+                count: self.initial_count,
+                finished: false,
+            });
+        }
+    }
+
+    // Advance every live job. Inputs with more than a round left get a round
+    // of blocks without finalization, and everything else gets finished.
+    fn run_round(&mut self) {
+        let implementation = self.params.implementation;
+        let last_node = self.params.last_node;
+        let middles = self.live.iter_mut().filter_map(|job| {
+            let rest = &job.input.as_ref()[job.offset..];
+            if rest.len() <= STREAM_ROUND_BYTES {
+                return None;
+            }
+            let count = job.count;
+            job.offset += STREAM_ROUND_BYTES;
+            job.count = job.count.wrapping_add(STREAM_ROUND_BYTES as Count);
+            Some(Job {
+                input: &rest[..STREAM_ROUND_BYTES],
+                words: &mut job.words,
+                count,
+                last_node,
+            })
+        });
+        compress_many(middles, implementation, Finalize::No, Stride::Serial);
+
+        let lasts = self.live.iter_mut().filter_map(|job| {
+            let rest = &job.input.as_ref()[job.offset..];
+            if rest.len() > STREAM_ROUND_BYTES {
+                return None;
+            }
+            job.finished = true;
+            Some(Job {
+                input: rest,
+                words: &mut job.words,
+                count: job.count,
+                last_node,
+            })
+        });
+        compress_many(lasts, implementation, Finalize::Yes, Stride::Serial);
+
+        // Move finished jobs to the ready queue, in order.
+        let mut i = 0;
+        while i < self.live.len() {
+            if self.live[i].finished {
+                let job = self.live.remove(i);
+                let hash = Hash {
+                    bytes: state_words_to_bytes(&job.words),
+                    len: self.params.hash_length,
+                };
+                self.ready.push((job.id, hash));
+            } else {
+                i += 1;
+            }
+        }
+    }
+}
+
+impl<'p, I, Id, T> Iterator for HashManyIter<'p, I, Id, T>
+where
+    I: Iterator<Item = (Id, T)>,
+    T: AsRef<[u8]>,
+{
+    type Item = (Id, Hash);
+
+    fn next(&mut self) -> Option<(Id, Hash)> {
+        loop {
+            // The ready queue is only ever refilled when it's empty, so it
+            // can't overflow.
+            if !self.ready.is_empty() {
+                return Some(self.ready.remove(0));
+            }
+            self.fill();
+            if !self.ready.is_empty() {
+                continue;
+            }
+            if self.live.is_empty() {
+                return None;
+            }
+            self.run_round();
+        }
+    }
+}
+
+impl<'p, I, Id, T> fmt::Debug for HashManyIter<'p, I, Id, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        // NB: Don't print the words. Leaking them would allow length extension.
+        write!(
+            f,
+            "HashManyIter {{ live: {}, ready: {} }}",
+            self.live.len(),
+            self.ready.len(),
+        )
+    }
+}
+
+// The per-step constants shared by every chain. If there's a key, its block is
+// compressed once here, rather than once per chain per step.
+fn chain_step(params: &Params) -> ChainStep {
+    let mut words = params.to_words();
+    let mut count = 0;
+    if params.key_length > 0 {
+        params.implementation.compress1_loop(
+            &params.key_block,
+            &mut words,
+            0,
+            params.last_node,
+            Finalize::No,
+            Stride::Serial,
+        );
+        count = BLOCKBYTES as Count;
+    }
+    ChainStep {
+        words,
+        count: count + params.hash_length as Count,
+        last_node: params.last_node,
+        hash_length: params.hash_length as usize,
+    }
+}
+
+fn load_chain(seed: &[u8]) -> [Word; 8] {
+    let mut words = [0; 8];
+    for (word, bytes) in words.iter_mut().zip(seed.chunks(size_of::<Word>())) {
+        let mut word_bytes = [0; size_of::<Word>()];
+        word_bytes[..bytes.len()].copy_from_slice(bytes);
+        *word = Word::from_le_bytes(word_bytes);
+    }
+    words
+}
+
+fn store_chain(chain: &[Word; 8], out: &mut [u8]) {
+    out.copy_from_slice(&state_words_to_bytes(chain)[..out.len()]);
+}
+
+// The serial fallback, for leftover chains and for the portable implementation.
+fn iterate1(
+    implementation: Implementation,
+    chain: &mut [Word; 8],
+    step: &ChainStep,
+    iterations: u64,
+) {
+    let count = step.count - step.hash_length as Count;
+    for _ in 0..iterations {
+        let digest = state_words_to_bytes(chain);
+        *chain = step.words;
+        implementation.compress1_loop(
+            &digest[..step.hash_length],
+            chain,
+            count,
+            step.last_node,
+            Finalize::Yes,
+            Stride::Serial,
+        );
+    }
+}
+
+/// Run many independent hash chains, where each step of a chain hashes the
+/// previous step's output. `seeds` is the concatenation of the starting value
+/// of each chain, each exactly `params`' hash length, and the final value of
+/// each chain is written to the same position in `out`. That is, for every
+/// chain:
+///
+/// ```text
+/// out = H(H(...H(seed)...))    // `iterations` times
+/// ```
+///
+/// A single chain is inherently serial, but the same step across different
+/// chains is a natural SIMD batch. This function keeps [`degree`] chains in
+/// the lanes of a set of vectors and runs all of their steps without going
+/// back to bytes in between. Chain counts that are a multiple of [`degree`]
+/// give the best throughput. See [`iterate_parallel`] to also spread the
+/// chains over multiple threads.
+///
+/// # Panics
+///
+/// Panics if `seeds` and `out` have different lengths, or if their length
+/// isn't a multiple of the hash length.
+///
+/// # Example
+///
+/// ```
+/// use blake2b_simd::{many::iterate, Params};
+///
+/// let mut params = Params::new();
+/// params.hash_length(32);
+/// let seeds = [0x42; 5 * 32];
+/// let mut out = [0; 5 * 32];
+/// iterate(&params, &seeds, 3, &mut out);
+///
+/// let mut expected = params.hash(&seeds[..32]);
+/// for _ in 1..3 {
+///     expected = params.hash(expected.as_bytes());
+/// }
+/// for chain in out.chunks(32) {
+///     assert_eq!(expected.as_bytes(), chain);
+/// }
+/// ```
+///
+/// [`degree`]: fn.degree.html
+/// [`iterate_parallel`]: fn.iterate_parallel.html
+pub fn iterate(params: &Params, seeds: &[u8], iterations: u64, out: &mut [u8]) {
+    let hash_length = params.hash_length as usize;
+    assert_eq!(
+        seeds.len(),
+        out.len(),
+        "seeds and out must be the same length"
+    );
+    assert_eq!(
+        0,
+        seeds.len() % hash_length,
+        "length must be a multiple of the hash length"
+    );
+    let step = chain_step(params);
+    let implementation = params.implementation;
+    let mut seeds = seeds.chunks_exact(hash_length);
+    let mut outs = out.chunks_exact_mut(hash_length);
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64", feature = "portable_simd"))]
+    if implementation.degree() >= 4 {
+        while seeds.len() >= 4 {
+            let mut chains = [[0; 8]; 4];
+            for chain in chains.iter_mut() {
+                *chain = load_chain(seeds.next().unwrap());
+            }
+            implementation.iterate4(&mut chains, &step, iterations);
+            for chain in chains.iter() {
+                store_chain(chain, outs.next().unwrap());
+            }
+        }
+    }
+
+    if implementation.degree() >= 2 {
+        while seeds.len() >= 2 {
+            let mut chains = [[0; 8]; 2];
+            for chain in chains.iter_mut() {
+                *chain = load_chain(seeds.next().unwrap());
+            }
+            implementation.iterate2(&mut chains, &step, iterations);
+            for chain in chains.iter() {
+                store_chain(chain, outs.next().unwrap());
+            }
+        }
+    }
+
+    for (seed, out) in seeds.zip(outs) {
+        let mut chain = load_chain(seed);
+        iterate1(implementation, &mut chain, &step, iterations);
+        store_chain(&chain, out);
+    }
+}
+
+/// Run hash chains like [`iterate`], but split them evenly over up to
+/// `num_threads` threads. The result is the same as that of [`iterate`].
+///
+/// [`iterate`]: fn.iterate.html
+#[cfg(feature = "std")]
+pub fn iterate_parallel(
+    params: &Params,
+    seeds: &[u8],
+    iterations: u64,
+    out: &mut [u8],
+    num_threads: usize,
+) {
+    let hash_length = params.hash_length as usize;
+    let num_chains = seeds.len() / hash_length;
+    let num_threads = num_threads.max(1);
+    // Round each thread's share up to a whole number of SIMD batches.
+    let batch = params.implementation.degree();
+    let batches_per_thread = (num_chains + batch * num_threads - 1) / (batch * num_threads);
+    let chains_per_thread = batches_per_thread * batch;
+    if chains_per_thread >= num_chains {
+        return iterate(params, seeds, iterations, out);
+    }
+    // Check lengths here too, so that a mismatch doesn't split unevenly.
+    assert_eq!(
+        seeds.len(),
+        out.len(),
+        "seeds and out must be the same length"
+    );
+    let bytes_per_thread = chains_per_thread * hash_length;
+    std::thread::scope(|scope| {
+        for (seeds, out) in seeds
+            .chunks(bytes_per_thread)
+            .zip(out.chunks_mut(bytes_per_thread))
+        {
+            scope.spawn(move || iterate(params, seeds, iterations, out));
+        }
+    });
 }
 
 #[cfg(test)]
@@ -424,6 +1404,7 @@ mod test {
     use crate::guts;
     use crate::paint_test_input;
     use crate::BLOCKBYTES;
+    use crate::OUTBYTES;
     use arrayvec::ArrayVec;
 
     #[test]
@@ -531,4 +1512,265 @@ mod test {
             }
         }
     }
+
+    #[test]
+    fn test_hash_many_vectored() {
+        let mut input = [0; 6 * BLOCKBYTES];
+        paint_test_input(&mut input);
+        // Segment lengths, cut from the front of the input in order, so that
+        // the concatenated segments are always a prefix of it. These cover
+        // empty segments, runs of full blocks, and blocks that straddle
+        // several segments.
+        let layouts: &[&[usize]] = &[
+            &[],
+            &[0],
+            &[0, 0],
+            &[1],
+            &[BLOCKBYTES],
+            &[BLOCKBYTES, 0],
+            &[0, BLOCKBYTES, 0, 0],
+            &[1, 1, 1],
+            &[BLOCKBYTES - 1, 1],
+            &[BLOCKBYTES - 1, 2],
+            &[BLOCKBYTES, BLOCKBYTES],
+            &[BLOCKBYTES + 1, BLOCKBYTES - 1, 0],
+            &[3, 5, 0, 7, 2 * BLOCKBYTES + 9, 11, BLOCKBYTES],
+            &[2 * BLOCKBYTES, 1, 0, BLOCKBYTES - 1, 2 * BLOCKBYTES],
+        ];
+        const MAX_SEGMENTS: usize = 8;
+        let mut all_segments: ArrayVec<ArrayVec<&[u8], MAX_SEGMENTS>, 16> = ArrayVec::new();
+        let mut totals: ArrayVec<usize, 16> = ArrayVec::new();
+        for layout in layouts {
+            let mut segments = ArrayVec::new();
+            let mut offset = 0;
+            for &len in layout.iter() {
+                segments.push(&input[offset..][..len]);
+                offset += len;
+            }
+            all_segments.push(segments);
+            totals.push(offset);
+        }
+
+        for &implementation in iterate_implementations().iter() {
+            for &(key, last_node) in &[(&b""[..], false), (&b"foo"[..], false), (&b""[..], true)] {
+                let mut params = Params::new();
+                params.key(key).last_node(last_node);
+                params.implementation = implementation;
+                // Mix vectored and contiguous jobs, so that they're batched
+                // together. Repeat the layouts to fill more than one window.
+                let mut jobs: ArrayVec<HashManyJob, { 3 * 16 }> = ArrayVec::new();
+                for _ in 0..2 {
+                    for segments in &all_segments {
+                        jobs.push(HashManyJob::new_vectored(&params, segments));
+                    }
+                }
+                for &total in &totals {
+                    jobs.push(HashManyJob::new(&params, &input[..total]));
+                }
+                hash_many(jobs.iter_mut());
+                for (i, job) in jobs.iter().enumerate() {
+                    let total = totals[i % totals.len()];
+                    assert_eq!(params.hash(&input[..total]), job.to_hash(), "job {}", i);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_hash_many_iter() {
+        // Enough inputs to refill the window several times, with lengths from
+        // empty to several rounds long, so that long inputs overlap short ones.
+        const LEN: usize = 3 * STREAM_WINDOW + 1;
+        let mut input = [0; 3 * STREAM_ROUND_BYTES + 5];
+        paint_test_input(&mut input);
+        let mut lengths: ArrayVec<usize, LEN> = ArrayVec::new();
+        for i in 0..LEN {
+            lengths.push(if i % 5 == 0 {
+                input.len() - i
+            } else {
+                (i * 37) % (2 * BLOCKBYTES + 1)
+            });
+        }
+
+        for &(key, last_node) in &[(&b""[..], false), (&b"foo"[..], false), (&b""[..], true)] {
+            let mut params = Params::new();
+            params.key(key).last_node(last_node);
+            let inputs = lengths
+                .iter()
+                .enumerate()
+                .map(|(i, &len)| (i, &input[..len]));
+            let mut seen = [false; LEN];
+            for (i, hash) in hash_many_iter(&params, inputs) {
+                assert!(!seen[i], "input {} twice", i);
+                seen[i] = true;
+                assert_eq!(params.hash(&input[..lengths[i]]), hash, "input {}", i);
+            }
+            assert!(seen.iter().all(|&s| s), "missing inputs");
+        }
+    }
+
+    fn iterate_implementations() -> ArrayVec<Implementation, 7> {
+        let mut implementations = ArrayVec::new();
+        implementations.push(Implementation::portable());
+        implementations.push(Implementation::portable2());
+        #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+        if let Some(imp) = Implementation::sse41_if_supported() {
+            implementations.push(imp);
+        }
+        #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+        if let Some(imp) = Implementation::avx2_if_supported() {
+            implementations.push(imp);
+        }
+        #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+        if let Some(imp) = Implementation::avx2_interleaved_if_supported() {
+            implementations.push(imp);
+        }
+        #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+        if let Some(imp) = Implementation::avx2_hybrid_if_supported() {
+            implementations.push(imp);
+        }
+        #[cfg(feature = "portable_simd")]
+        implementations.push(Implementation::portable_simd());
+        implementations
+    }
+
+    #[test]
+    fn test_iterate() {
+        // Enough chains to exercise every batch size plus a serial leftover.
+        const CHAINS: usize = 2 * JOBS_VEC_CAPACITY + 1;
+        let mut seeds = [0; CHAINS * OUTBYTES];
+        paint_test_input(&mut seeds);
+
+        for &hash_length in &[1, 7, 32, 33, 64] {
+            for &(key, last_node) in &[(&b""[..], false), (&b"foo"[..], false), (&b""[..], true)] {
+                let mut params = Params::new();
+                params
+                    .hash_length(hash_length)
+                    .key(key)
+                    .last_node(last_node);
+                let seeds = &seeds[..CHAINS * hash_length];
+                for iterations in 0..4 {
+                    let mut expected = [0; CHAINS * OUTBYTES];
+                    let expected = &mut expected[..CHAINS * hash_length];
+                    for (seed, out) in seeds
+                        .chunks(hash_length)
+                        .zip(expected.chunks_mut(hash_length))
+                    {
+                        out.copy_from_slice(seed);
+                        for _ in 0..iterations {
+                            let hash = params.hash(out);
+                            out.copy_from_slice(hash.as_bytes());
+                        }
+                    }
+
+                    for &implementation in iterate_implementations().iter() {
+                        params.implementation = implementation;
+                        for chains in 0..=CHAINS {
+                            let len = chains * hash_length;
+                            let mut out = [0; CHAINS * OUTBYTES];
+                            iterate(&params, &seeds[..len], iterations, &mut out[..len]);
+                            assert_eq!(&expected[..len], &out[..len]);
+                        }
+                        #[cfg(feature = "std")]
+                        {
+                            let mut out = [0; CHAINS * OUTBYTES];
+                            let out = &mut out[..CHAINS * hash_length];
+                            iterate_parallel(&params, seeds, iterations, out, 3);
+                            assert_eq!(&*expected, &*out);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    fn check_mac_key<const N: usize>(params: &Params, inputs: &[&[u8]]) {
+        let mac_key = MacKey::<N>::new(params);
+        let mut macs = [[0; N]; 3 * TRUNCATED_CHUNK];
+        let macs = &mut macs[..inputs.len()];
+        mac_key.mac_many(inputs, macs);
+        for (input, mac) in inputs.iter().zip(macs.iter()) {
+            assert_eq!(params.hash(input).as_bytes(), &mac[..]);
+        }
+
+        // Corrupt every third MAC and check that exactly those fail.
+        for mac in macs.iter_mut().step_by(3) {
+            mac[N - 1] ^= 1;
+        }
+        let mut results = [true; 3 * TRUNCATED_CHUNK];
+        let results = &mut results[..inputs.len()];
+        mac_key.verify_many(inputs, macs, results);
+        for (i, &result) in results.iter().enumerate() {
+            assert_eq!(i % 3 != 0, result);
+        }
+    }
+
+    #[test]
+    fn test_mac_key() {
+        // Short packets with 16-byte MACs under a 32-byte key, plus a range of
+        // other lengths including the empty input.
+        const LEN: usize = 2 * TRUNCATED_CHUNK + 3;
+        let mut input = [0; 3 * BLOCKBYTES];
+        paint_test_input(&mut input);
+        let mut inputs: ArrayVec<&[u8], LEN> = ArrayVec::new();
+        let mut mixed: ArrayVec<&[u8], LEN> = ArrayVec::new();
+        for i in 0..LEN {
+            inputs.push(&input[i % BLOCKBYTES..][..116]);
+            mixed.push(&input[..(i * 7) % input.len()]);
+        }
+
+        for &implementation in iterate_implementations().iter() {
+            for &(key, last_node) in &[(&[0x42; 32][..], false), (&b"foo"[..], true)] {
+                let mut params = Params::new();
+                params.key(key).last_node(last_node);
+                params.implementation = implementation;
+                check_mac_key::<16>(params.clone().hash_length(16), &inputs);
+                check_mac_key::<16>(params.clone().hash_length(16), &mixed);
+                check_mac_key::<1>(params.clone().hash_length(1), &mixed);
+                check_mac_key::<64>(params.clone().hash_length(64), &mixed);
+            }
+        }
+    }
+
+    fn check_truncated<const N: usize>(params: &Params, inputs: &[&[u8]]) {
+        let mut outputs = [[0; N]; 3 * TRUNCATED_CHUNK];
+        let outputs = &mut outputs[..inputs.len()];
+        hash_many_truncated(params, inputs, outputs);
+        for (input, output) in inputs.iter().zip(outputs.iter()) {
+            assert_eq!(params.hash(input).as_bytes(), &output[..]);
+        }
+    }
+
+    #[test]
+    fn test_hash_many_truncated() {
+        // Enough inputs to span several chunks, with a range of lengths
+        // including the empty input.
+        const LEN: usize = 2 * TRUNCATED_CHUNK + 3;
+        let mut input = [0; 3 * BLOCKBYTES];
+        paint_test_input(&mut input);
+        let mut inputs: ArrayVec<&[u8], LEN> = ArrayVec::new();
+        for i in 0..LEN {
+            inputs.push(&input[..(i * 7) % input.len()]);
+        }
+
+        for &implementation in iterate_implementations().iter() {
+            for &(key, last_node) in &[(&b""[..], false), (&b"foo"[..], false), (&b""[..], true)] {
+                let mut params = Params::new();
+                params.key(key).last_node(last_node);
+                params.implementation = implementation;
+                check_truncated::<1>(params.clone().hash_length(1), &inputs);
+                check_truncated::<8>(params.clone().hash_length(8), &inputs);
+                check_truncated::<16>(params.clone().hash_length(16), &inputs);
+                check_truncated::<33>(params.clone().hash_length(33), &inputs);
+                check_truncated::<64>(params.clone().hash_length(64), &inputs);
+
+                params.hash_length(8);
+                let mut outputs = [0u64; LEN];
+                hash_many_u64(&params, &inputs, &mut outputs);
+                for (input, &output) in inputs.iter().zip(outputs.iter()) {
+                    assert_eq!(params.hash(input).as_bytes(), &output.to_le_bytes());
+                }
+            }
+        }
+    }
 }
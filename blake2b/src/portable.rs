@@ -2,9 +2,13 @@ use arrayref::{array_ref, array_refs};
 
 use super::*;
 use crate::guts::{
-    count_high, count_low, final_block, flag_word, input_debug_asserts, Finalize, LastNode, Stride,
+    count_high, count_low, final_block, flag_word, input_debug_asserts, ChainStep, Finalize, Job,
+    LastNode, Stride,
 };
 
+// The portable implementation interleaves two instances. See compress2_loop.
+pub const DEGREE: usize = 2;
+
 // G is the mixing function, called eight times per round in the compression
 // function. V is the 16-word state vector of the compression function, usually
 // described as a 4x4 matrix. A, B, C, and D are the mixing indices, set by the
@@ -43,6 +47,31 @@ fn round(r: usize, m: &[Word; 16], v: &mut [Word; 16]) {
     g(v, 3, 4, 9, 14, m[s[14] as usize], m[s[15] as usize]);
 }
 
+#[inline(always)]
+fn load_msg(block: &[u8; BLOCKBYTES]) -> [Word; 16] {
+    // Parse the message bytes as ints in little endian order.
+    const W: usize = size_of::<Word>();
+    let msg_refs = array_refs!(block, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W);
+    [
+        Word::from_le_bytes(*msg_refs.0),
+        Word::from_le_bytes(*msg_refs.1),
+        Word::from_le_bytes(*msg_refs.2),
+        Word::from_le_bytes(*msg_refs.3),
+        Word::from_le_bytes(*msg_refs.4),
+        Word::from_le_bytes(*msg_refs.5),
+        Word::from_le_bytes(*msg_refs.6),
+        Word::from_le_bytes(*msg_refs.7),
+        Word::from_le_bytes(*msg_refs.8),
+        Word::from_le_bytes(*msg_refs.9),
+        Word::from_le_bytes(*msg_refs.10),
+        Word::from_le_bytes(*msg_refs.11),
+        Word::from_le_bytes(*msg_refs.12),
+        Word::from_le_bytes(*msg_refs.13),
+        Word::from_le_bytes(*msg_refs.14),
+        Word::from_le_bytes(*msg_refs.15),
+    ]
+}
+
 #[inline(always)]
 fn compress_block(
     block: &[u8; BLOCKBYTES],
@@ -71,27 +100,7 @@ fn compress_block(
         IV[7] ^ last_node,
     ];
 
-    // Parse the message bytes as ints in little endian order.
-    const W: usize = size_of::<Word>();
-    let msg_refs = array_refs!(block, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W);
-    let m = [
-        Word::from_le_bytes(*msg_refs.0),
-        Word::from_le_bytes(*msg_refs.1),
-        Word::from_le_bytes(*msg_refs.2),
-        Word::from_le_bytes(*msg_refs.3),
-        Word::from_le_bytes(*msg_refs.4),
-        Word::from_le_bytes(*msg_refs.5),
-        Word::from_le_bytes(*msg_refs.6),
-        Word::from_le_bytes(*msg_refs.7),
-        Word::from_le_bytes(*msg_refs.8),
-        Word::from_le_bytes(*msg_refs.9),
-        Word::from_le_bytes(*msg_refs.10),
-        Word::from_le_bytes(*msg_refs.11),
-        Word::from_le_bytes(*msg_refs.12),
-        Word::from_le_bytes(*msg_refs.13),
-        Word::from_le_bytes(*msg_refs.14),
-        Word::from_le_bytes(*msg_refs.15),
-    ];
+    let m = load_msg(block);
 
     round(0, &m, &mut v);
     round(1, &m, &mut v);
@@ -166,3 +175,207 @@ pub fn compress1_loop(
 
     *words = local_words;
 }
+
+// The two-way kernel below runs two independent instances of the compression
+// function side by side. Each G step in one instance depends on the step
+// before it, so a single instance leaves most of a superscalar core's ALUs
+// idle. Issuing each step for both instances back to back gives the core two
+// independent chains to schedule.
+#[inline(always)]
+fn g2(
+    v0: &mut [Word; 16],
+    v1: &mut [Word; 16],
+    (a, b, c, d): (usize, usize, usize, usize),
+    (x0, y0): (Word, Word),
+    (x1, y1): (Word, Word),
+) {
+    v0[a] = v0[a].wrapping_add(v0[b]).wrapping_add(x0);
+    v1[a] = v1[a].wrapping_add(v1[b]).wrapping_add(x1);
+    v0[d] = (v0[d] ^ v0[a]).rotate_right(32);
+    v1[d] = (v1[d] ^ v1[a]).rotate_right(32);
+    v0[c] = v0[c].wrapping_add(v0[d]);
+    v1[c] = v1[c].wrapping_add(v1[d]);
+    v0[b] = (v0[b] ^ v0[c]).rotate_right(24);
+    v1[b] = (v1[b] ^ v1[c]).rotate_right(24);
+    v0[a] = v0[a].wrapping_add(v0[b]).wrapping_add(y0);
+    v1[a] = v1[a].wrapping_add(v1[b]).wrapping_add(y1);
+    v0[d] = (v0[d] ^ v0[a]).rotate_right(16);
+    v1[d] = (v1[d] ^ v1[a]).rotate_right(16);
+    v0[c] = v0[c].wrapping_add(v0[d]);
+    v1[c] = v1[c].wrapping_add(v1[d]);
+    v0[b] = (v0[b] ^ v0[c]).rotate_right(63);
+    v1[b] = (v1[b] ^ v1[c]).rotate_right(63);
+}
+
+#[cfg_attr(not(feature = "uninline_portable"), inline(always))]
+fn round2(r: usize, m0: &[Word; 16], m1: &[Word; 16], v0: &mut [Word; 16], v1: &mut [Word; 16]) {
+    // Select the message schedule based on the round.
+    let s = SIGMA[r];
+    let x = |i: usize| (m0[s[i] as usize], m0[s[i + 1] as usize]);
+    let y = |i: usize| (m1[s[i] as usize], m1[s[i + 1] as usize]);
+
+    // Mix the columns.
+    g2(v0, v1, (0, 4, 8, 12), x(0), y(0));
+    g2(v0, v1, (1, 5, 9, 13), x(2), y(2));
+    g2(v0, v1, (2, 6, 10, 14), x(4), y(4));
+    g2(v0, v1, (3, 7, 11, 15), x(6), y(6));
+
+    // Mix the rows.
+    g2(v0, v1, (0, 5, 10, 15), x(8), y(8));
+    g2(v0, v1, (1, 6, 11, 12), x(10), y(10));
+    g2(v0, v1, (2, 7, 8, 13), x(12), y(12));
+    g2(v0, v1, (3, 4, 9, 14), x(14), y(14));
+}
+
+#[inline(always)]
+fn init_v(words: &[Word; 8], count: Count, last_block: Word, last_node: Word) -> [Word; 16] {
+    [
+        words[0],
+        words[1],
+        words[2],
+        words[3],
+        words[4],
+        words[5],
+        words[6],
+        words[7],
+        IV[0],
+        IV[1],
+        IV[2],
+        IV[3],
+        IV[4] ^ count_low(count),
+        IV[5] ^ count_high(count),
+        IV[6] ^ last_block,
+        IV[7] ^ last_node,
+    ]
+}
+
+#[inline(always)]
+fn compress_block2(
+    blocks: [&[u8; BLOCKBYTES]; 2],
+    words: [&mut [Word; 8]; 2],
+    counts: [Count; 2],
+    last_block: [Word; 2],
+    last_node: [Word; 2],
+) {
+    let [words0, words1] = words;
+    let mut v0 = init_v(words0, counts[0], last_block[0], last_node[0]);
+    let mut v1 = init_v(words1, counts[1], last_block[1], last_node[1]);
+    let m0 = load_msg(blocks[0]);
+    let m1 = load_msg(blocks[1]);
+
+    round2(0, &m0, &m1, &mut v0, &mut v1);
+    round2(1, &m0, &m1, &mut v0, &mut v1);
+    round2(2, &m0, &m1, &mut v0, &mut v1);
+    round2(3, &m0, &m1, &mut v0, &mut v1);
+    round2(4, &m0, &m1, &mut v0, &mut v1);
+    round2(5, &m0, &m1, &mut v0, &mut v1);
+    round2(6, &m0, &m1, &mut v0, &mut v1);
+    round2(7, &m0, &m1, &mut v0, &mut v1);
+    round2(8, &m0, &m1, &mut v0, &mut v1);
+    round2(9, &m0, &m1, &mut v0, &mut v1);
+    round2(10, &m0, &m1, &mut v0, &mut v1);
+    round2(11, &m0, &m1, &mut v0, &mut v1);
+
+    for i in 0..8 {
+        words0[i] ^= v0[i] ^ v0[i + 8];
+        words1[i] ^= v1[i] ^ v1[i + 8];
+    }
+}
+
+pub fn compress2_loop(jobs: &mut [Job; 2], finalize: Finalize, stride: Stride) {
+    // If we're not finalizing, there can't be a partial block at the end.
+    for job in jobs.iter() {
+        input_debug_asserts(job.input, finalize);
+    }
+
+    let mut words = [*jobs[0].words, *jobs[1].words];
+    let mut counts = [jobs[0].count, jobs[1].count];
+
+    let min_len = jobs.iter().map(|job| job.input.len()).min().unwrap();
+    let mut fin_offset = min_len.saturating_sub(1);
+    fin_offset -= fin_offset % stride.padded_blockbytes();
+    let mut buf0: [u8; BLOCKBYTES] = [0; BLOCKBYTES];
+    let mut buf1: [u8; BLOCKBYTES] = [0; BLOCKBYTES];
+    let (block0, len0, finalize0) = final_block(jobs[0].input, fin_offset, &mut buf0, stride);
+    let (block1, len1, finalize1) = final_block(jobs[1].input, fin_offset, &mut buf1, stride);
+    let fin_blocks = [block0, block1];
+    let fin_counts_delta = [len0 as Count, len1 as Count];
+    let fin_last_block = [
+        flag_word(finalize.yes() && finalize0),
+        flag_word(finalize.yes() && finalize1),
+    ];
+    let fin_last_node = [
+        flag_word(finalize.yes() && finalize0 && jobs[0].last_node.yes()),
+        flag_word(finalize.yes() && finalize1 && jobs[1].last_node.yes()),
+    ];
+
+    let mut offset = 0;
+    loop {
+        let blocks;
+        let counts_delta;
+        let last_block;
+        let last_node;
+        if offset == fin_offset {
+            blocks = fin_blocks;
+            counts_delta = fin_counts_delta;
+            last_block = fin_last_block;
+            last_node = fin_last_node;
+        } else {
+            blocks = [
+                array_ref!(jobs[0].input, offset, BLOCKBYTES),
+                array_ref!(jobs[1].input, offset, BLOCKBYTES),
+            ];
+            counts_delta = [BLOCKBYTES as Count; 2];
+            last_block = [flag_word(false); 2];
+            last_node = [flag_word(false); 2];
+        }
+
+        counts[0] = counts[0].wrapping_add(counts_delta[0]);
+        counts[1] = counts[1].wrapping_add(counts_delta[1]);
+        let [words0, words1] = &mut words;
+        compress_block2(blocks, [words0, words1], counts, last_block, last_node);
+
+        // Check for termination before bumping the offset, to avoid overflow.
+        if offset == fin_offset {
+            break;
+        }
+
+        offset += stride.padded_blockbytes();
+    }
+
+    let max_consumed = offset.saturating_add(stride.padded_blockbytes());
+    for ((job, words), &count) in jobs.iter_mut().zip(words.iter()).zip(counts.iter()) {
+        *job.words = *words;
+        job.count = count;
+        let consumed = cmp::min(max_consumed, job.input.len());
+        job.input = &job.input[consumed..];
+    }
+}
+
+// Like the SIMD iterateN kernels, but all that two-way gets us here is the
+// interleaving in compress2_loop, so this just runs each step through that.
+pub fn iterate2(chains: &mut [[Word; 8]; DEGREE], step: &ChainStep, iterations: u64) {
+    let count = step.count - step.hash_length as Count;
+    for _ in 0..iterations {
+        let digest0 = state_words_to_bytes(&chains[0]);
+        let digest1 = state_words_to_bytes(&chains[1]);
+        let [chain0, chain1] = chains;
+        *chain0 = step.words;
+        *chain1 = step.words;
+        let mut jobs = [
+            Job {
+                input: &digest0[..step.hash_length],
+                words: chain0,
+                count,
+                last_node: step.last_node,
+            },
+            Job {
+                input: &digest1[..step.hash_length],
+                words: chain1,
+                count,
+                last_node: step.last_node,
+            },
+        ];
+        compress2_loop(&mut jobs, Finalize::Yes, Stride::Serial);
+    }
+}
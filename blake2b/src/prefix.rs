@@ -0,0 +1,641 @@
+//! An index of checkpoints into an append-only input, like a log file, that
+//! makes the hash of any prefix cheap to compute.
+//!
+//! As input is appended, the index records the compressed state words every
+//! `interval` bytes. To hash the first `n` bytes, it resumes from the nearest
+//! checkpoint below `n` and hashes only the bytes after it, which is at most
+//! `interval` bytes for BLAKE2b. BLAKE2bp can't resume from a checkpoint unless
+//! every leaf has more input after it, so there it can take up to
+//! `interval + 3 * BLOCKBYTES` bytes. Each checkpoint costs 64 bytes for
+//! BLAKE2b and 256 bytes for BLAKE2bp.
+//!
+//! The checkpoints can be saved to a sidecar file with [`write_to`] and loaded
+//! again with [`read_from`]. The format is a short header followed by one
+//! fixed-size record per checkpoint, so as the log grows, the records from
+//! [`write_checkpoints`] can be appended to an existing sidecar file. A
+//! partial record at the end, like one left behind by a crash, is ignored.
+//! The header includes a fingerprint of the parameter block, and loading with
+//! different `Params` is an error.
+//!
+//! Only the checkpoints of unkeyed hashes can be saved. The words of a keyed
+//! checkpoint are as good as the key for any input that extends its prefix:
+//! anyone holding them can compute the MAC of that prefix plus whatever they
+//! like. So `write_to` and `write_checkpoints` return an error for keyed
+//! `Params`, and a keyed index has to be rebuilt from the input instead.
+//!
+//! This module is only available with the `std` feature.
+//!
+//! # Example
+//!
+//! ```
+//! use blake2b_simd::{blake2b, prefix::Index, Params};
+//!
+//! let log = vec![0xab; 100_000];
+//! let mut index = Index::new(&Params::new(), 4096);
+//! index.append(&log[..60_000]);
+//! index.append(&log[60_000..]);
+//!
+//! // Hashing a prefix only needs the bytes after the nearest checkpoint.
+//! let n = 54_321;
+//! let start = index.resume_offset(n) as usize;
+//! let hash = index.prefix_hash(n, &log[start..n as usize]);
+//! assert_eq!(blake2b(&log[..n as usize]), hash);
+//!
+//! // Save the checkpoints, and load them again later.
+//! let mut sidecar = Vec::new();
+//! index.write_to(&mut sidecar).unwrap();
+//! let mut loaded = Index::new(&Params::new(), 4096);
+//! loaded.read_from(&sidecar[..]).unwrap();
+//! assert_eq!(hash, loaded.prefix_hash(n, &log[start..n as usize]));
+//!
+//! // The loaded index picks up from its last checkpoint.
+//! loaded.append(&log[loaded.len() as usize..]);
+//! assert_eq!(index.len(), loaded.len());
+//! ```
+//!
+//! [`write_to`]: struct.Index.html#method.write_to
+//! [`read_from`]: struct.Index.html#method.read_from
+//! [`write_checkpoints`]: struct.Index.html#method.write_checkpoints
+
+use crate::blake2bp;
+use crate::Count;
+use crate::Hash;
+use crate::Word;
+use crate::BLOCKBYTES;
+use arrayref::array_ref;
+use core::cmp;
+use core::fmt;
+use core::mem::size_of;
+use std::io;
+use std::io::prelude::*;
+use std::vec::Vec;
+
+const MAGIC: &[u8; 8] = b"b2prefix";
+const HEADER_LEN: usize = 8 + 1 + 8 + FINGERPRINT_LEN;
+const FINGERPRINT_LEN: usize = 8;
+const STATE_BYTES: usize = 8 * size_of::<Word>();
+
+#[derive(Clone)]
+enum Hasher {
+    Blake2b(crate::Params, crate::State),
+    Blake2bp(blake2bp::Params, blake2bp::State),
+}
+
+impl Hasher {
+    // The format byte in the sidecar header.
+    fn tag(&self) -> u8 {
+        match self {
+            Hasher::Blake2b(..) => 0,
+            Hasher::Blake2bp(..) => 1,
+        }
+    }
+
+    fn is_keyed(&self) -> bool {
+        match self {
+            Hasher::Blake2b(params, _) => params.key_length > 0,
+            Hasher::Blake2bp(params, _) => params.is_keyed(),
+        }
+    }
+
+    // A short hash of the parameter block, which the sidecar header records
+    // so that a sidecar can't be loaded with different Params. The
+    // last_node flag isn't part of the block, so it's added separately.
+    fn fingerprint(&self) -> [u8; FINGERPRINT_LEN] {
+        let mut state = crate::Params::new().hash_length(FINGERPRINT_LEN).to_state();
+        let mut add_words = |words: &[Word; 8]| {
+            for word in words {
+                state.update(&word.to_le_bytes());
+            }
+        };
+        match self {
+            Hasher::Blake2b(params, _) => {
+                add_words(&params.to_words());
+                state.update(&[params.last_node.yes() as u8]);
+            }
+            Hasher::Blake2bp(params, _) => {
+                let (leaf_words, root_words) = params.to_words();
+                for words in &leaf_words {
+                    add_words(words);
+                }
+                add_words(&root_words);
+            }
+        }
+        let hash = state.finalize();
+        *array_ref!(hash.as_bytes(), 0, FINGERPRINT_LEN)
+    }
+
+    // The number of [Word; 8] arrays in each checkpoint.
+    fn lanes(&self) -> usize {
+        match self {
+            Hasher::Blake2b(..) => 1,
+            Hasher::Blake2bp(..) => blake2bp::DEGREE,
+        }
+    }
+
+    // Checkpoints have to land on a compression boundary.
+    fn step(&self) -> u64 {
+        (self.lanes() * BLOCKBYTES) as u64
+    }
+
+    // A checkpoint at offset c is only usable for prefixes at least c + slack
+    // long, because none of the leaves it covers can have been finalized.
+    fn slack(&self) -> u64 {
+        match self {
+            Hasher::Blake2b(..) => 1,
+            Hasher::Blake2bp(..) => ((blake2bp::DEGREE - 1) * BLOCKBYTES + 1) as u64,
+        }
+    }
+
+    fn update(&mut self, input: &[u8]) {
+        match self {
+            Hasher::Blake2b(_, state) => {
+                state.update(input);
+            }
+            Hasher::Blake2bp(_, state) => {
+                state.update(input);
+            }
+        }
+    }
+
+    fn push_midstate(&self, checkpoints: &mut Vec<[Word; 8]>) {
+        match self {
+            Hasher::Blake2b(_, state) => checkpoints.push(state.midstate()),
+            Hasher::Blake2bp(_, state) => checkpoints.extend_from_slice(&state.midstate()),
+        }
+    }
+
+    // Replace the running state with one that resumes from `words` at
+    // `offset`, or with a fresh state if `words` is empty.
+    fn reset(&mut self, words: &[[Word; 8]], offset: u64) {
+        match self {
+            Hasher::Blake2b(params, state) => {
+                *state = if words.is_empty() {
+                    params.to_state()
+                } else {
+                    crate::State::from_midstate(params, &words[0], offset as Count)
+                };
+            }
+            Hasher::Blake2bp(params, state) => {
+                *state = if words.is_empty() {
+                    params.to_state()
+                } else {
+                    let leaf_words = array_ref!(words, 0, blake2bp::DEGREE);
+                    blake2bp::State::from_midstate(params, leaf_words, offset as Count)
+                };
+            }
+        }
+    }
+
+    fn finalize(&self) -> Hash {
+        match self {
+            Hasher::Blake2b(_, state) => state.finalize(),
+            Hasher::Blake2bp(_, state) => state.finalize(),
+        }
+    }
+}
+
+/// A prefix-hash index over an append-only input. See the
+/// [module level docs](index.html).
+#[derive(Clone)]
+pub struct Index {
+    hasher: Hasher,
+    interval: u64,
+    len: u64,
+    // Checkpoint i is at offset (i + 1) * interval, and it's stored as
+    // hasher.lanes() consecutive arrays of words.
+    checkpoints: Vec<[Word; 8]>,
+}
+
+impl Index {
+    /// Create an empty BLAKE2b index that checkpoints every `interval` bytes.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `interval` isn't a nonzero multiple of `BLOCKBYTES`.
+    pub fn new(params: &crate::Params, interval: u64) -> Self {
+        Self::with_hasher(Hasher::Blake2b(params.clone(), params.to_state()), interval)
+    }
+
+    /// Create an empty BLAKE2bp index that checkpoints every `interval` bytes.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `interval` isn't a nonzero multiple of `blake2bp::DEGREE *
+    /// BLOCKBYTES`.
+    pub fn new_blake2bp(params: &blake2bp::Params, interval: u64) -> Self {
+        Self::with_hasher(
+            Hasher::Blake2bp(params.clone(), params.to_state()),
+            interval,
+        )
+    }
+
+    fn with_hasher(hasher: Hasher, interval: u64) -> Self {
+        assert!(
+            interval > 0 && interval % hasher.step() == 0,
+            "interval must be a nonzero multiple of {}",
+            hasher.step(),
+        );
+        Self {
+            hasher,
+            interval,
+            len: 0,
+            checkpoints: Vec::new(),
+        }
+    }
+
+    /// The checkpoint interval in bytes.
+    pub fn interval(&self) -> u64 {
+        self.interval
+    }
+
+    /// The total number of bytes appended so far. After
+    /// [`read_from`](#method.read_from), this is the offset of the last
+    /// checkpoint, and appending should resume from there.
+    pub fn len(&self) -> u64 {
+        self.len
+    }
+
+    /// Return true if nothing has been appended yet.
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// The number of checkpoints recorded so far.
+    pub fn num_checkpoints(&self) -> usize {
+        self.checkpoints.len() / self.hasher.lanes()
+    }
+
+    /// Add `input` to the end of the indexed data, and record a checkpoint at
+    /// every interval boundary it crosses.
+    pub fn append(&mut self, mut input: &[u8]) {
+        while !input.is_empty() {
+            let to_boundary = self.interval - self.len % self.interval;
+            let take = cmp::min(to_boundary, input.len() as u64) as usize;
+            self.hasher.update(&input[..take]);
+            self.len += take as u64;
+            input = &input[take..];
+            if self.len % self.interval == 0 {
+                self.hasher.push_midstate(&mut self.checkpoints);
+            }
+        }
+    }
+
+    /// The offset of the checkpoint that [`prefix_hash`](#method.prefix_hash)
+    /// resumes from for a prefix of `len` bytes. The caller has to supply the
+    /// input from this offset up to `len`. This is 0 if no checkpoint applies.
+    pub fn resume_offset(&self, len: u64) -> u64 {
+        let usable = len.saturating_sub(self.hasher.slack()) / self.interval;
+        cmp::min(usable, self.num_checkpoints() as u64) * self.interval
+    }
+
+    /// Return the hash of the first `len` bytes of the input, where `tail` is
+    /// the input from [`resume_offset(len)`](#method.resume_offset) up to
+    /// `len`.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `tail` is the wrong length.
+    pub fn prefix_hash(&self, len: u64, tail: &[u8]) -> Hash {
+        let start = self.resume_offset(len);
+        assert_eq!(len - start, tail.len() as u64, "tail is the wrong length");
+        let lanes = self.hasher.lanes();
+        let checkpoint = (start / self.interval) as usize;
+        let words = if checkpoint == 0 {
+            &[]
+        } else {
+            &self.checkpoints[(checkpoint - 1) * lanes..][..lanes]
+        };
+        let mut hasher = self.hasher.clone();
+        hasher.reset(words, start);
+        hasher.update(tail);
+        hasher.finalize()
+    }
+
+    /// Write the header and all the checkpoints to `writer`, in the sidecar
+    /// format that [`read_from`](#method.read_from) loads.
+    ///
+    /// This is an `InvalidInput` error for an index with a key. See the
+    /// [module level docs](index.html).
+    pub fn write_to(&self, mut writer: impl Write) -> io::Result<()> {
+        self.check_unkeyed()?;
+        let mut header = [0; HEADER_LEN];
+        header[..8].copy_from_slice(MAGIC);
+        header[8] = self.hasher.tag();
+        header[9..17].copy_from_slice(&self.interval.to_le_bytes());
+        header[17..].copy_from_slice(&self.hasher.fingerprint());
+        writer.write_all(&header)?;
+        self.write_checkpoints(0, writer)
+    }
+
+    /// Write the checkpoints from number `first` onwards to `writer`, without
+    /// a header. This is for appending to a sidecar file that already holds
+    /// the first `first` checkpoints. Like [`write_to`](#method.write_to),
+    /// this is an error for an index with a key.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `first` is greater than the number of checkpoints.
+    pub fn write_checkpoints(&self, first: usize, mut writer: impl Write) -> io::Result<()> {
+        self.check_unkeyed()?;
+        let lanes = self.hasher.lanes();
+        let mut record = Vec::with_capacity(lanes * STATE_BYTES);
+        for checkpoint in self.checkpoints[first * lanes..].chunks(lanes) {
+            record.clear();
+            for words in checkpoint {
+                for word in words {
+                    record.extend_from_slice(&word.to_le_bytes());
+                }
+            }
+            writer.write_all(&record)?;
+        }
+        Ok(())
+    }
+
+    fn check_unkeyed(&self) -> io::Result<()> {
+        if self.hasher.is_keyed() {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "keyed checkpoints can't be saved",
+            ));
+        }
+        Ok(())
+    }
+
+    /// Load the checkpoints written by [`write_to`](#method.write_to), and
+    /// resume from the last of them. The index has to have been created with
+    /// the same kind of hash, `Params`, and interval as the one that wrote
+    /// them, and a mismatch in any of those is an error. A partial record at
+    /// the end is ignored.
+    ///
+    /// # Panics
+    ///
+    /// Panics if anything has already been appended to this index.
+    pub fn read_from(&mut self, mut reader: impl Read) -> io::Result<()> {
+        assert!(self.is_empty(), "read_from requires an empty index");
+        let mut header = [0; HEADER_LEN];
+        if read_full(&mut reader, &mut header)? < HEADER_LEN || &header[..8] != MAGIC {
+            return Err(invalid_data("not a prefix index"));
+        }
+        if header[8] != self.hasher.tag() {
+            return Err(invalid_data("prefix index is for a different hash"));
+        }
+        if *array_ref!(header, 9, 8) != self.interval.to_le_bytes() {
+            return Err(invalid_data("prefix index has a different interval"));
+        }
+        if *array_ref!(header, 17, FINGERPRINT_LEN) != self.hasher.fingerprint() {
+            return Err(invalid_data("prefix index has different parameters"));
+        }
+
+        let lanes = self.hasher.lanes();
+        let mut record = vec![0; lanes * STATE_BYTES];
+        let mut checkpoints = Vec::new();
+        while read_full(&mut reader, &mut record)? == record.len() {
+            for bytes in record.chunks(STATE_BYTES) {
+                let mut words = [0; 8];
+                for (word, word_bytes) in words.iter_mut().zip(bytes.chunks(size_of::<Word>())) {
+                    *word = Word::from_le_bytes(*array_ref!(word_bytes, 0, size_of::<Word>()));
+                }
+                checkpoints.push(words);
+            }
+        }
+
+        self.checkpoints = checkpoints;
+        self.len = self.num_checkpoints() as u64 * self.interval;
+        let last = self.checkpoints.len().saturating_sub(lanes);
+        self.hasher.reset(&self.checkpoints[last..], self.len);
+        Ok(())
+    }
+}
+
+impl fmt::Debug for Index {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        // NB: Don't print the params. Debug shouldn't leak the key.
+        write!(
+            f,
+            "Index {{ interval: {}, len: {}, num_checkpoints: {} }}",
+            self.interval,
+            self.len,
+            self.num_checkpoints(),
+        )
+    }
+}
+
+fn invalid_data(message: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, message)
+}
+
+// Like read_exact, but a short read at EOF returns the count instead of an
+// error.
+fn read_full(reader: &mut impl Read, buf: &mut [u8]) -> io::Result<usize> {
+    let mut filled = 0;
+    while filled < buf.len() {
+        match reader.read(&mut buf[filled..]) {
+            Ok(0) => break,
+            Ok(n) => filled += n,
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+            Err(e) => return Err(e),
+        }
+    }
+    Ok(filled)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn input(len: usize) -> Vec<u8> {
+        (0..len).map(|i| (i % 251) as u8).collect()
+    }
+
+    fn lens(max: u64) -> impl Iterator<Item = u64> {
+        (0..=max).filter(move |&n| n < 1200 || n % 97 == 0 || n > max - 1200)
+    }
+
+    fn blake2b_params() -> crate::Params {
+        let mut params = crate::Params::new();
+        params.key(b"prefix key").hash_length(48);
+        params
+    }
+
+    fn blake2bp_params() -> blake2bp::Params {
+        let mut params = blake2bp::Params::new();
+        params.key(b"prefix key").hash_length(48);
+        params
+    }
+
+    // Sidecars can only hold unkeyed checkpoints.
+    fn unkeyed_params() -> crate::Params {
+        let mut params = crate::Params::new();
+        params.salt(b"prefix salt").hash_length(48);
+        params
+    }
+
+    fn check_blake2b(index: &Index, params: &crate::Params, data: &[u8]) {
+        for n in lens(data.len() as u64) {
+            let start = index.resume_offset(n);
+            let tail = &data[start as usize..n as usize];
+            assert_eq!(params.hash(&data[..n as usize]), index.prefix_hash(n, tail));
+        }
+    }
+
+    fn check_blake2bp(index: &Index, params: &blake2bp::Params, data: &[u8]) {
+        for n in lens(data.len() as u64) {
+            let start = index.resume_offset(n);
+            let tail = &data[start as usize..n as usize];
+            assert_eq!(params.hash(&data[..n as usize]), index.prefix_hash(n, tail));
+        }
+    }
+
+    #[test]
+    fn test_blake2b_prefixes() {
+        let data = input(10_000);
+        for &params in &[&crate::Params::new(), &blake2b_params()] {
+            let mut index = Index::new(params, 1024);
+            // Append in uneven pieces, to cross boundaries in different ways.
+            for piece in data.chunks(333) {
+                index.append(piece);
+            }
+            assert_eq!(data.len() as u64, index.len());
+            assert_eq!(9, index.num_checkpoints());
+            assert_eq!(0, index.resume_offset(1024));
+            assert_eq!(1024, index.resume_offset(1025));
+            check_blake2b(&index, params, &data);
+        }
+    }
+
+    #[test]
+    fn test_blake2bp_prefixes() {
+        let data = input(10_000);
+        for &params in &[&blake2bp::Params::new(), &blake2bp_params()] {
+            let mut index = Index::new_blake2bp(params, 1024);
+            for piece in data.chunks(333) {
+                index.append(piece);
+            }
+            assert_eq!(9, index.num_checkpoints());
+            let slack = (blake2bp::DEGREE - 1) * BLOCKBYTES;
+            assert_eq!(0, index.resume_offset((1024 + slack) as u64));
+            assert_eq!(1024, index.resume_offset((1024 + slack + 1) as u64));
+            check_blake2bp(&index, params, &data);
+        }
+    }
+
+    #[test]
+    fn test_sidecar_round_trip() {
+        let data = input(10_000);
+        let params = unkeyed_params();
+        let mut index = Index::new(&params, 1024);
+        index.append(&data[..5000]);
+
+        // Write a sidecar, then append the later checkpoints to it, plus a
+        // torn record at the end.
+        let mut sidecar = Vec::new();
+        index.write_to(&mut sidecar).unwrap();
+        let first = index.num_checkpoints();
+        index.append(&data[5000..]);
+        index.write_checkpoints(first, &mut sidecar).unwrap();
+        sidecar.extend_from_slice(&[0xff; 10]);
+
+        let mut loaded = Index::new(&params, 1024);
+        loaded.read_from(&sidecar[..]).unwrap();
+        assert_eq!(index.num_checkpoints(), loaded.num_checkpoints());
+        assert_eq!(9 * 1024, loaded.len());
+        loaded.append(&data[loaded.len() as usize..]);
+        loaded.append(&data);
+        let mut doubled = data.clone();
+        doubled.extend_from_slice(&data);
+        check_blake2b(&loaded, &params, &doubled);
+
+        // An empty sidecar loads with no checkpoints.
+        let mut empty = Vec::new();
+        Index::new(&params, 1024).write_to(&mut empty).unwrap();
+        let mut loaded = Index::new(&params, 1024);
+        loaded.read_from(&empty[..]).unwrap();
+        assert!(loaded.is_empty());
+        loaded.append(&data);
+        check_blake2b(&loaded, &params, &data);
+    }
+
+    #[test]
+    fn test_blake2bp_sidecar_round_trip() {
+        let data = input(10_000);
+        let mut params = blake2bp::Params::new();
+        params.hash_length(48);
+        let mut index = Index::new_blake2bp(&params, 1024);
+        index.append(&data[..6000]);
+        let mut sidecar = Vec::new();
+        index.write_to(&mut sidecar).unwrap();
+
+        let mut loaded = Index::new_blake2bp(&params, 1024);
+        loaded.read_from(&sidecar[..]).unwrap();
+        assert_eq!(5 * 1024, loaded.len());
+        loaded.append(&data[loaded.len() as usize..]);
+        check_blake2bp(&loaded, &params, &data);
+    }
+
+    #[test]
+    fn test_sidecar_mismatch() {
+        let mut sidecar = Vec::new();
+        Index::new(&crate::Params::new(), 1024)
+            .write_to(&mut sidecar)
+            .unwrap();
+        let err = Index::new(&crate::Params::new(), 2048)
+            .read_from(&sidecar[..])
+            .unwrap_err();
+        assert_eq!(io::ErrorKind::InvalidData, err.kind());
+        let err = Index::new_blake2bp(&blake2bp::Params::new(), 1024)
+            .read_from(&sidecar[..])
+            .unwrap_err();
+        assert_eq!(io::ErrorKind::InvalidData, err.kind());
+        let err = Index::new(&crate::Params::new(), 1024)
+            .read_from(&b"not a sidecar file"[..])
+            .unwrap_err();
+        assert_eq!(io::ErrorKind::InvalidData, err.kind());
+
+        // Any difference in the parameter block is caught too.
+        let mut different = Vec::new();
+        different.push(unkeyed_params().hash_length(32).clone());
+        different.push(unkeyed_params().salt(b"other salt").clone());
+        different.push(unkeyed_params().personal(b"personal").clone());
+        different.push(unkeyed_params().last_node(true).clone());
+        let mut sidecar = Vec::new();
+        Index::new(&unkeyed_params(), 1024)
+            .write_to(&mut sidecar)
+            .unwrap();
+        for params in &different {
+            let err = Index::new(params, 1024)
+                .read_from(&sidecar[..])
+                .unwrap_err();
+            assert_eq!(io::ErrorKind::InvalidData, err.kind());
+        }
+        let mut sidecar = Vec::new();
+        Index::new_blake2bp(&blake2bp::Params::new(), 1024)
+            .write_to(&mut sidecar)
+            .unwrap();
+        let err = Index::new_blake2bp(blake2bp::Params::new().hash_length(32), 1024)
+            .read_from(&sidecar[..])
+            .unwrap_err();
+        assert_eq!(io::ErrorKind::InvalidData, err.kind());
+    }
+
+    #[test]
+    fn test_keyed_sidecar_refused() {
+        let mut index = Index::new(&blake2b_params(), 1024);
+        index.append(&input(5000));
+        let mut sidecar = Vec::new();
+        let err = index.write_to(&mut sidecar).unwrap_err();
+        assert_eq!(io::ErrorKind::InvalidInput, err.kind());
+        let err = index.write_checkpoints(0, &mut sidecar).unwrap_err();
+        assert_eq!(io::ErrorKind::InvalidInput, err.kind());
+        assert!(sidecar.is_empty());
+
+        let index = Index::new_blake2bp(&blake2bp_params(), 1024);
+        let err = index.write_to(&mut sidecar).unwrap_err();
+        assert_eq!(io::ErrorKind::InvalidInput, err.kind());
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_blake2bp_interval_panics() {
+        Index::new_blake2bp(&blake2bp::Params::new(), BLOCKBYTES as u64);
+    }
+}
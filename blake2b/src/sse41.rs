@@ -4,10 +4,10 @@ use core::arch::x86::*;
 use core::arch::x86_64::*;
 
 use crate::guts::{
-    assemble_count, count_high, count_low, final_block, flag_word, input_debug_asserts, Finalize,
-    Job, Stride,
+    assemble_count, count_high, count_low, final_block, flag_word, input_debug_asserts, ChainStep,
+    Finalize, Job, LastNode, Stride,
 };
-use crate::{Word, BLOCKBYTES, IV, SIGMA};
+use crate::{Count, Word, BLOCKBYTES, IV, SIGMA};
 use arrayref::{array_refs, mut_array_refs};
 use core::cmp;
 use core::mem;
@@ -99,6 +99,204 @@ unsafe fn rot63(x: __m128i) -> __m128i {
     _mm_or_si128(_mm_srli_epi64(x, 63), _mm_slli_epi64(x, 64 - 63))
 }
 
+// The single-input compression below is a port of the SSE4.1 code in the
+// official C implementation, which keeps the state in rows like the AVX2
+// version, with each 256-bit row split into low and high halves.
+
+#[inline(always)]
+unsafe fn g1(
+    row1: &mut [__m128i; 2],
+    row2: &mut [__m128i; 2],
+    row3: &mut [__m128i; 2],
+    row4: &mut [__m128i; 2],
+    m: [__m128i; 2],
+) {
+    for i in 0..2 {
+        row1[i] = add(add(row1[i], m[i]), row2[i]);
+        row4[i] = xor(row4[i], row1[i]);
+        row4[i] = rot32(row4[i]);
+        row3[i] = add(row3[i], row4[i]);
+        row2[i] = xor(row2[i], row3[i]);
+        row2[i] = rot24(row2[i]);
+    }
+}
+
+#[inline(always)]
+unsafe fn g2(
+    row1: &mut [__m128i; 2],
+    row2: &mut [__m128i; 2],
+    row3: &mut [__m128i; 2],
+    row4: &mut [__m128i; 2],
+    m: [__m128i; 2],
+) {
+    for i in 0..2 {
+        row1[i] = add(add(row1[i], m[i]), row2[i]);
+        row4[i] = xor(row4[i], row1[i]);
+        row4[i] = rot16(row4[i]);
+        row3[i] = add(row3[i], row4[i]);
+        row2[i] = xor(row2[i], row3[i]);
+        row2[i] = rot63(row2[i]);
+    }
+}
+
+#[inline(always)]
+unsafe fn diagonalize(row2: &mut [__m128i; 2], row3: &mut [__m128i; 2], row4: &mut [__m128i; 2]) {
+    let [l, h] = *row2;
+    *row2 = [_mm_alignr_epi8(h, l, 8), _mm_alignr_epi8(l, h, 8)];
+    row3.swap(0, 1);
+    let [l, h] = *row4;
+    *row4 = [_mm_alignr_epi8(l, h, 8), _mm_alignr_epi8(h, l, 8)];
+}
+
+#[inline(always)]
+unsafe fn undiagonalize(row2: &mut [__m128i; 2], row3: &mut [__m128i; 2], row4: &mut [__m128i; 2]) {
+    let [l, h] = *row2;
+    *row2 = [_mm_alignr_epi8(l, h, 8), _mm_alignr_epi8(h, l, 8)];
+    row3.swap(0, 1);
+    let [l, h] = *row4;
+    *row4 = [_mm_alignr_epi8(h, l, 8), _mm_alignr_epi8(l, h, 8)];
+}
+
+// Gather message words i and j into one vector, where m holds the block as
+// pairs of words. The C implementation spells out these loads for every
+// round. Here they're derived from SIGMA instead, and because the round
+// number is a const parameter of row_round, each one still compiles to a
+// single unpack, blend, or alignr.
+#[inline(always)]
+unsafe fn msg_pair(m: &[__m128i; 8], i: u8, j: u8) -> __m128i {
+    let a = m[i as usize / 2];
+    let b = m[j as usize / 2];
+    match (i % 2, j % 2) {
+        (0, 0) => _mm_unpacklo_epi64(a, b),
+        (1, 1) => _mm_unpackhi_epi64(a, b),
+        (0, _) => _mm_blend_epi16(a, b, 0xF0),
+        _ => _mm_alignr_epi8(b, a, 8),
+    }
+}
+
+// The message words for one G step, where the low half of each row takes
+// SIGMA entries i and i + 2, and the high half takes i + 4 and i + 6.
+#[inline(always)]
+unsafe fn msg_vecs(m: &[__m128i; 8], s: &[u8; 16], i: usize) -> [__m128i; 2] {
+    [msg_pair(m, s[i], s[i + 2]), msg_pair(m, s[i + 4], s[i + 6])]
+}
+
+#[inline(always)]
+unsafe fn row_round<const R: usize>(
+    row1: &mut [__m128i; 2],
+    row2: &mut [__m128i; 2],
+    row3: &mut [__m128i; 2],
+    row4: &mut [__m128i; 2],
+    m: &[__m128i; 8],
+) {
+    let s = &SIGMA[R];
+    g1(row1, row2, row3, row4, msg_vecs(m, s, 0));
+    g2(row1, row2, row3, row4, msg_vecs(m, s, 1));
+    diagonalize(row2, row3, row4);
+    g1(row1, row2, row3, row4, msg_vecs(m, s, 8));
+    g2(row1, row2, row3, row4, msg_vecs(m, s, 9));
+    undiagonalize(row2, row3, row4);
+}
+
+#[inline(always)]
+unsafe fn compress_block(
+    block: &[u8; BLOCKBYTES],
+    words: &mut [Word; 8],
+    count: Count,
+    last_block: Word,
+    last_node: Word,
+) {
+    let (w0, w1, w2, w3) = mut_array_refs!(words, DEGREE, DEGREE, DEGREE, DEGREE);
+    let (iv0, iv1, iv2, iv3) = array_refs!(&IV, DEGREE, DEGREE, DEGREE, DEGREE);
+    let mut row1 = [loadu(w0), loadu(w1)];
+    let mut row2 = [loadu(w2), loadu(w3)];
+    let mut row3 = [loadu(iv0), loadu(iv1)];
+    let mut row4 = [
+        xor(loadu(iv2), set2(count_low(count), count_high(count))),
+        xor(loadu(iv3), set2(last_block, last_node)),
+    ];
+
+    let msg_ptr = block.as_ptr() as *const [Word; DEGREE];
+    let mut m = [set1(0); 8];
+    for i in 0..8 {
+        m[i] = loadu(msg_ptr.add(i));
+    }
+
+    // A loop here doesn't get unrolled, and then the message loads turn into
+    // table lookups and branches.
+    row_round::<0>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<1>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<2>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<3>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<4>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<5>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<6>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<7>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<8>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<9>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<10>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+    row_round::<11>(&mut row1, &mut row2, &mut row3, &mut row4, &m);
+
+    storeu(xor(loadu(w0), xor(row1[0], row3[0])), w0);
+    storeu(xor(loadu(w1), xor(row1[1], row3[1])), w1);
+    storeu(xor(loadu(w2), xor(row2[0], row4[0])), w2);
+    storeu(xor(loadu(w3), xor(row2[1], row4[1])), w3);
+}
+
+#[target_feature(enable = "sse4.1")]
+pub unsafe fn compress1_loop(
+    input: &[u8],
+    words: &mut [Word; 8],
+    mut count: Count,
+    last_node: LastNode,
+    finalize: Finalize,
+    stride: Stride,
+) {
+    input_debug_asserts(input, finalize);
+
+    let mut local_words = *words;
+
+    let mut fin_offset = input.len().saturating_sub(1);
+    fin_offset -= fin_offset % stride.padded_blockbytes();
+    let mut buf = [0; BLOCKBYTES];
+    let (fin_block, fin_len, _) = final_block(input, fin_offset, &mut buf, stride);
+    let fin_last_block = flag_word(finalize.yes());
+    let fin_last_node = flag_word(finalize.yes() && last_node.yes());
+
+    let mut offset = 0;
+    loop {
+        let block;
+        let count_delta;
+        let last_block;
+        let last_node;
+        if offset == fin_offset {
+            block = fin_block;
+            count_delta = fin_len;
+            last_block = fin_last_block;
+            last_node = fin_last_node;
+        } else {
+            // This unsafe cast avoids bounds checks. There's guaranteed to be
+            // enough input because `offset < fin_offset`.
+            block = &*(input.as_ptr().add(offset) as *const [u8; BLOCKBYTES]);
+            count_delta = BLOCKBYTES;
+            last_block = flag_word(false);
+            last_node = flag_word(false);
+        };
+
+        count = count.wrapping_add(count_delta as Count);
+        compress_block(block, &mut local_words, count, last_block, last_node);
+
+        // Check for termination before bumping the offset, to avoid overflow.
+        if offset == fin_offset {
+            break;
+        }
+
+        offset += stride.padded_blockbytes();
+    }
+
+    *words = local_words;
+}
+
 #[inline(always)]
 unsafe fn round(v: &mut [__m128i; 16], m: &[__m128i; 16], r: usize) {
     v[0] = add(v[0], m[SIGMA[r][0] as usize]);
@@ -459,3 +657,70 @@ pub unsafe fn compress2_loop(jobs: &mut [Job; DEGREE], finalize: Finalize, strid
         job.input = &job.input[consumed..];
     }
 }
+
+#[inline(always)]
+unsafe fn transpose_chains(chains: &[[Word; 8]; DEGREE]) -> [__m128i; 8] {
+    let words0 = array_refs!(&chains[0], DEGREE, DEGREE, DEGREE, DEGREE);
+    let words1 = array_refs!(&chains[1], DEGREE, DEGREE, DEGREE, DEGREE);
+    let [h0, h1] = transpose_vecs(loadu(words0.0), loadu(words1.0));
+    let [h2, h3] = transpose_vecs(loadu(words0.1), loadu(words1.1));
+    let [h4, h5] = transpose_vecs(loadu(words0.2), loadu(words1.2));
+    let [h6, h7] = transpose_vecs(loadu(words0.3), loadu(words1.3));
+    [h0, h1, h2, h3, h4, h5, h6, h7]
+}
+
+#[inline(always)]
+unsafe fn untranspose_chains(h_vecs: &[__m128i; 8], chains: &mut [[Word; 8]; DEGREE]) {
+    let [chain0, chain1] = chains;
+    let words0 = mut_array_refs!(chain0, DEGREE, DEGREE, DEGREE, DEGREE);
+    let words1 = mut_array_refs!(chain1, DEGREE, DEGREE, DEGREE, DEGREE);
+    let out = transpose_vecs(h_vecs[0], h_vecs[1]);
+    storeu(out[0], words0.0);
+    storeu(out[1], words1.0);
+    let out = transpose_vecs(h_vecs[2], h_vecs[3]);
+    storeu(out[0], words0.1);
+    storeu(out[1], words1.1);
+    let out = transpose_vecs(h_vecs[4], h_vecs[5]);
+    storeu(out[0], words0.2);
+    storeu(out[1], words1.2);
+    let out = transpose_vecs(h_vecs[6], h_vecs[7]);
+    storeu(out[0], words0.3);
+    storeu(out[1], words1.3);
+}
+
+// Run `iterations` steps of 2 independent hash chains. Each chain starts as
+// the little-endian words of its seed, zero-padded, and ends as the state
+// words of its final digest. In between, the digests stay in transposed
+// vectors, and each one becomes the message of the next step after masking.
+#[target_feature(enable = "sse4.1")]
+pub unsafe fn iterate2(chains: &mut [[Word; 8]; DEGREE], step: &ChainStep, iterations: u64) {
+    let masks = step.digest_masks();
+    let mut mask_vecs = [set1(0); 8];
+    let mut init_vecs = [set1(0); 8];
+    for i in 0..8 {
+        mask_vecs[i] = set1(masks[i]);
+        init_vecs[i] = set1(step.words[i]);
+    }
+    let count_lo = set1(count_low(step.count));
+    let count_hi = set1(count_high(step.count));
+    let last_block = set1(flag_word(true));
+    let last_node = set1(flag_word(step.last_node.yes()));
+
+    let mut h_vecs = transpose_chains(chains);
+    for _ in 0..iterations {
+        let mut m_vecs = [set1(0); 16];
+        for i in 0..8 {
+            m_vecs[i] = and(h_vecs[i], mask_vecs[i]);
+        }
+        h_vecs = init_vecs;
+        compress2_transposed!(
+            &mut h_vecs,
+            &m_vecs,
+            count_lo,
+            count_hi,
+            last_block,
+            last_node,
+        );
+    }
+    untranspose_chains(&h_vecs, chains);
+}
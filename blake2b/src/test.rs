@@ -206,3 +206,47 @@ fn test_hash_from() {
     assert_eq!(h, Hash::from(h.as_array()));
     assert_eq!(h, Hash::from(*h.as_array()));
 }
+
+#[test]
+fn test_update_copy() {
+    let mut input = [0; 3 * COPY_CHUNK + 5];
+    paint_test_input(&mut input);
+    for &len in &[
+        0,
+        1,
+        COPY_CHUNK - 1,
+        COPY_CHUNK,
+        COPY_CHUNK + 1,
+        input.len(),
+    ] {
+        let src = &input[..len];
+        let mut dst = [0xff; 3 * COPY_CHUNK + 5];
+
+        // Start with a partial block in the buffer, so that the chunks don't
+        // line up with blocks.
+        let mut state = State::new();
+        state.update(b"abc");
+        state.update_copy(&mut dst[..len], src);
+        assert_eq!(src, &dst[..len]);
+        assert_eq!(
+            State::new().update(b"abc").update(src).finalize(),
+            state.finalize()
+        );
+
+        let mut dst = [0xff; 3 * COPY_CHUNK + 5];
+        let mut state = blake2bp::State::new();
+        state.update(b"abc");
+        state.update_copy(&mut dst[..len], src);
+        assert_eq!(src, &dst[..len]);
+        assert_eq!(
+            blake2bp::State::new().update(b"abc").update(src).finalize(),
+            state.finalize()
+        );
+    }
+}
+
+#[test]
+#[should_panic]
+fn test_update_copy_length_mismatch_panics() {
+    State::new().update_copy(&mut [0; 2], &[0; 3]);
+}
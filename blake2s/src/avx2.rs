@@ -3,13 +3,16 @@ use core::arch::x86::*;
 #[cfg(target_arch = "x86_64")]
 use core::arch::x86_64::*;
 
+use arrayref::mut_array_refs;
+
 use crate::guts::{
-    assemble_count, count_high, count_low, final_block, flag_word, input_debug_asserts, Finalize,
-    Job, Stride,
+    assemble_count, count_high, count_low, final_block, flag_word, input_debug_asserts, ChainStep,
+    Finalize, Job, Stride,
 };
 use crate::{Word, BLOCKBYTES, IV, SIGMA};
 use core::cmp;
 use core::mem;
+use core::ptr;
 
 pub const DEGREE: usize = 8;
 
@@ -590,3 +593,498 @@ pub unsafe fn compress8_loop(jobs: &mut [Job; DEGREE], finalize: Finalize, strid
         job.input = &job.input[consumed..];
     }
 }
+
+// Two independent groups of DEGREE jobs, for compress16_loop. A single group's
+// rounds are one long chain of dependent adds, xors, and rotations, and wide
+// cores have execution ports to spare while they wait on it. Each step here
+// is done for group A and then for group B, so that the two chains can fill
+// in each other's gaps. This has twice the live state of round(), and it
+// spills more, so whether it's faster depends on the core.
+#[inline(always)]
+unsafe fn round_x2(
+    va: &mut [__m256i; 16],
+    vb: &mut [__m256i; 16],
+    ma: &[__m256i; 16],
+    mb: &[__m256i; 16],
+    r: usize,
+) {
+    va[0] = add(va[0], ma[SIGMA[r][0] as usize]);
+    va[1] = add(va[1], ma[SIGMA[r][2] as usize]);
+    va[2] = add(va[2], ma[SIGMA[r][4] as usize]);
+    va[3] = add(va[3], ma[SIGMA[r][6] as usize]);
+    vb[0] = add(vb[0], mb[SIGMA[r][0] as usize]);
+    vb[1] = add(vb[1], mb[SIGMA[r][2] as usize]);
+    vb[2] = add(vb[2], mb[SIGMA[r][4] as usize]);
+    vb[3] = add(vb[3], mb[SIGMA[r][6] as usize]);
+    va[0] = add(va[0], va[4]);
+    va[1] = add(va[1], va[5]);
+    va[2] = add(va[2], va[6]);
+    va[3] = add(va[3], va[7]);
+    vb[0] = add(vb[0], vb[4]);
+    vb[1] = add(vb[1], vb[5]);
+    vb[2] = add(vb[2], vb[6]);
+    vb[3] = add(vb[3], vb[7]);
+    va[12] = xor(va[12], va[0]);
+    va[13] = xor(va[13], va[1]);
+    va[14] = xor(va[14], va[2]);
+    va[15] = xor(va[15], va[3]);
+    vb[12] = xor(vb[12], vb[0]);
+    vb[13] = xor(vb[13], vb[1]);
+    vb[14] = xor(vb[14], vb[2]);
+    vb[15] = xor(vb[15], vb[3]);
+    va[12] = rot16(va[12]);
+    va[13] = rot16(va[13]);
+    va[14] = rot16(va[14]);
+    va[15] = rot16(va[15]);
+    vb[12] = rot16(vb[12]);
+    vb[13] = rot16(vb[13]);
+    vb[14] = rot16(vb[14]);
+    vb[15] = rot16(vb[15]);
+    va[8] = add(va[8], va[12]);
+    va[9] = add(va[9], va[13]);
+    va[10] = add(va[10], va[14]);
+    va[11] = add(va[11], va[15]);
+    vb[8] = add(vb[8], vb[12]);
+    vb[9] = add(vb[9], vb[13]);
+    vb[10] = add(vb[10], vb[14]);
+    vb[11] = add(vb[11], vb[15]);
+    va[4] = xor(va[4], va[8]);
+    va[5] = xor(va[5], va[9]);
+    va[6] = xor(va[6], va[10]);
+    va[7] = xor(va[7], va[11]);
+    vb[4] = xor(vb[4], vb[8]);
+    vb[5] = xor(vb[5], vb[9]);
+    vb[6] = xor(vb[6], vb[10]);
+    vb[7] = xor(vb[7], vb[11]);
+    va[4] = rot12(va[4]);
+    va[5] = rot12(va[5]);
+    va[6] = rot12(va[6]);
+    va[7] = rot12(va[7]);
+    vb[4] = rot12(vb[4]);
+    vb[5] = rot12(vb[5]);
+    vb[6] = rot12(vb[6]);
+    vb[7] = rot12(vb[7]);
+    va[0] = add(va[0], ma[SIGMA[r][1] as usize]);
+    va[1] = add(va[1], ma[SIGMA[r][3] as usize]);
+    va[2] = add(va[2], ma[SIGMA[r][5] as usize]);
+    va[3] = add(va[3], ma[SIGMA[r][7] as usize]);
+    vb[0] = add(vb[0], mb[SIGMA[r][1] as usize]);
+    vb[1] = add(vb[1], mb[SIGMA[r][3] as usize]);
+    vb[2] = add(vb[2], mb[SIGMA[r][5] as usize]);
+    vb[3] = add(vb[3], mb[SIGMA[r][7] as usize]);
+    va[0] = add(va[0], va[4]);
+    va[1] = add(va[1], va[5]);
+    va[2] = add(va[2], va[6]);
+    va[3] = add(va[3], va[7]);
+    vb[0] = add(vb[0], vb[4]);
+    vb[1] = add(vb[1], vb[5]);
+    vb[2] = add(vb[2], vb[6]);
+    vb[3] = add(vb[3], vb[7]);
+    va[12] = xor(va[12], va[0]);
+    va[13] = xor(va[13], va[1]);
+    va[14] = xor(va[14], va[2]);
+    va[15] = xor(va[15], va[3]);
+    vb[12] = xor(vb[12], vb[0]);
+    vb[13] = xor(vb[13], vb[1]);
+    vb[14] = xor(vb[14], vb[2]);
+    vb[15] = xor(vb[15], vb[3]);
+    va[12] = rot8(va[12]);
+    va[13] = rot8(va[13]);
+    va[14] = rot8(va[14]);
+    va[15] = rot8(va[15]);
+    vb[12] = rot8(vb[12]);
+    vb[13] = rot8(vb[13]);
+    vb[14] = rot8(vb[14]);
+    vb[15] = rot8(vb[15]);
+    va[8] = add(va[8], va[12]);
+    va[9] = add(va[9], va[13]);
+    va[10] = add(va[10], va[14]);
+    va[11] = add(va[11], va[15]);
+    vb[8] = add(vb[8], vb[12]);
+    vb[9] = add(vb[9], vb[13]);
+    vb[10] = add(vb[10], vb[14]);
+    vb[11] = add(vb[11], vb[15]);
+    va[4] = xor(va[4], va[8]);
+    va[5] = xor(va[5], va[9]);
+    va[6] = xor(va[6], va[10]);
+    va[7] = xor(va[7], va[11]);
+    vb[4] = xor(vb[4], vb[8]);
+    vb[5] = xor(vb[5], vb[9]);
+    vb[6] = xor(vb[6], vb[10]);
+    vb[7] = xor(vb[7], vb[11]);
+    va[4] = rot7(va[4]);
+    va[5] = rot7(va[5]);
+    va[6] = rot7(va[6]);
+    va[7] = rot7(va[7]);
+    vb[4] = rot7(vb[4]);
+    vb[5] = rot7(vb[5]);
+    vb[6] = rot7(vb[6]);
+    vb[7] = rot7(vb[7]);
+
+    va[0] = add(va[0], ma[SIGMA[r][8] as usize]);
+    va[1] = add(va[1], ma[SIGMA[r][10] as usize]);
+    va[2] = add(va[2], ma[SIGMA[r][12] as usize]);
+    va[3] = add(va[3], ma[SIGMA[r][14] as usize]);
+    vb[0] = add(vb[0], mb[SIGMA[r][8] as usize]);
+    vb[1] = add(vb[1], mb[SIGMA[r][10] as usize]);
+    vb[2] = add(vb[2], mb[SIGMA[r][12] as usize]);
+    vb[3] = add(vb[3], mb[SIGMA[r][14] as usize]);
+    va[0] = add(va[0], va[5]);
+    va[1] = add(va[1], va[6]);
+    va[2] = add(va[2], va[7]);
+    va[3] = add(va[3], va[4]);
+    vb[0] = add(vb[0], vb[5]);
+    vb[1] = add(vb[1], vb[6]);
+    vb[2] = add(vb[2], vb[7]);
+    vb[3] = add(vb[3], vb[4]);
+    va[15] = xor(va[15], va[0]);
+    va[12] = xor(va[12], va[1]);
+    va[13] = xor(va[13], va[2]);
+    va[14] = xor(va[14], va[3]);
+    vb[15] = xor(vb[15], vb[0]);
+    vb[12] = xor(vb[12], vb[1]);
+    vb[13] = xor(vb[13], vb[2]);
+    vb[14] = xor(vb[14], vb[3]);
+    va[15] = rot16(va[15]);
+    va[12] = rot16(va[12]);
+    va[13] = rot16(va[13]);
+    va[14] = rot16(va[14]);
+    vb[15] = rot16(vb[15]);
+    vb[12] = rot16(vb[12]);
+    vb[13] = rot16(vb[13]);
+    vb[14] = rot16(vb[14]);
+    va[10] = add(va[10], va[15]);
+    va[11] = add(va[11], va[12]);
+    va[8] = add(va[8], va[13]);
+    va[9] = add(va[9], va[14]);
+    vb[10] = add(vb[10], vb[15]);
+    vb[11] = add(vb[11], vb[12]);
+    vb[8] = add(vb[8], vb[13]);
+    vb[9] = add(vb[9], vb[14]);
+    va[5] = xor(va[5], va[10]);
+    va[6] = xor(va[6], va[11]);
+    va[7] = xor(va[7], va[8]);
+    va[4] = xor(va[4], va[9]);
+    vb[5] = xor(vb[5], vb[10]);
+    vb[6] = xor(vb[6], vb[11]);
+    vb[7] = xor(vb[7], vb[8]);
+    vb[4] = xor(vb[4], vb[9]);
+    va[5] = rot12(va[5]);
+    va[6] = rot12(va[6]);
+    va[7] = rot12(va[7]);
+    va[4] = rot12(va[4]);
+    vb[5] = rot12(vb[5]);
+    vb[6] = rot12(vb[6]);
+    vb[7] = rot12(vb[7]);
+    vb[4] = rot12(vb[4]);
+    va[0] = add(va[0], ma[SIGMA[r][9] as usize]);
+    va[1] = add(va[1], ma[SIGMA[r][11] as usize]);
+    va[2] = add(va[2], ma[SIGMA[r][13] as usize]);
+    va[3] = add(va[3], ma[SIGMA[r][15] as usize]);
+    vb[0] = add(vb[0], mb[SIGMA[r][9] as usize]);
+    vb[1] = add(vb[1], mb[SIGMA[r][11] as usize]);
+    vb[2] = add(vb[2], mb[SIGMA[r][13] as usize]);
+    vb[3] = add(vb[3], mb[SIGMA[r][15] as usize]);
+    va[0] = add(va[0], va[5]);
+    va[1] = add(va[1], va[6]);
+    va[2] = add(va[2], va[7]);
+    va[3] = add(va[3], va[4]);
+    vb[0] = add(vb[0], vb[5]);
+    vb[1] = add(vb[1], vb[6]);
+    vb[2] = add(vb[2], vb[7]);
+    vb[3] = add(vb[3], vb[4]);
+    va[15] = xor(va[15], va[0]);
+    va[12] = xor(va[12], va[1]);
+    va[13] = xor(va[13], va[2]);
+    va[14] = xor(va[14], va[3]);
+    vb[15] = xor(vb[15], vb[0]);
+    vb[12] = xor(vb[12], vb[1]);
+    vb[13] = xor(vb[13], vb[2]);
+    vb[14] = xor(vb[14], vb[3]);
+    va[15] = rot8(va[15]);
+    va[12] = rot8(va[12]);
+    va[13] = rot8(va[13]);
+    va[14] = rot8(va[14]);
+    vb[15] = rot8(vb[15]);
+    vb[12] = rot8(vb[12]);
+    vb[13] = rot8(vb[13]);
+    vb[14] = rot8(vb[14]);
+    va[10] = add(va[10], va[15]);
+    va[11] = add(va[11], va[12]);
+    va[8] = add(va[8], va[13]);
+    va[9] = add(va[9], va[14]);
+    vb[10] = add(vb[10], vb[15]);
+    vb[11] = add(vb[11], vb[12]);
+    vb[8] = add(vb[8], vb[13]);
+    vb[9] = add(vb[9], vb[14]);
+    va[5] = xor(va[5], va[10]);
+    va[6] = xor(va[6], va[11]);
+    va[7] = xor(va[7], va[8]);
+    va[4] = xor(va[4], va[9]);
+    vb[5] = xor(vb[5], vb[10]);
+    vb[6] = xor(vb[6], vb[11]);
+    vb[7] = xor(vb[7], vb[8]);
+    vb[4] = xor(vb[4], vb[9]);
+    va[5] = rot7(va[5]);
+    va[6] = rot7(va[6]);
+    va[7] = rot7(va[7]);
+    va[4] = rot7(va[4]);
+    vb[5] = rot7(vb[5]);
+    vb[6] = rot7(vb[6]);
+    vb[7] = rot7(vb[7]);
+    vb[4] = rot7(vb[4]);
+}
+
+// Like compress8_transposed, but for two groups at once. Each argument is
+// an array with one entry per group.
+macro_rules! compress8x2_transposed {
+    (
+        $h_vecs:expr,
+        $msg_vecs:expr,
+        $count_low:expr,
+        $count_high:expr,
+        $lastblock:expr,
+        $lastnode:expr,
+    ) => {
+        let h_vecs: &mut [[__m256i; 8]; 2] = $h_vecs;
+        let msg_vecs: &[[__m256i; 16]; 2] = $msg_vecs;
+        let count_low: [__m256i; 2] = $count_low;
+        let count_high: [__m256i; 2] = $count_high;
+        let lastblock: [__m256i; 2] = $lastblock;
+        let lastnode: [__m256i; 2] = $lastnode;
+
+        let mut va = [
+            h_vecs[0][0],
+            h_vecs[0][1],
+            h_vecs[0][2],
+            h_vecs[0][3],
+            h_vecs[0][4],
+            h_vecs[0][5],
+            h_vecs[0][6],
+            h_vecs[0][7],
+            set1(IV[0]),
+            set1(IV[1]),
+            set1(IV[2]),
+            set1(IV[3]),
+            xor(set1(IV[4]), count_low[0]),
+            xor(set1(IV[5]), count_high[0]),
+            xor(set1(IV[6]), lastblock[0]),
+            xor(set1(IV[7]), lastnode[0]),
+        ];
+        let mut vb = [
+            h_vecs[1][0],
+            h_vecs[1][1],
+            h_vecs[1][2],
+            h_vecs[1][3],
+            h_vecs[1][4],
+            h_vecs[1][5],
+            h_vecs[1][6],
+            h_vecs[1][7],
+            set1(IV[0]),
+            set1(IV[1]),
+            set1(IV[2]),
+            set1(IV[3]),
+            xor(set1(IV[4]), count_low[1]),
+            xor(set1(IV[5]), count_high[1]),
+            xor(set1(IV[6]), lastblock[1]),
+            xor(set1(IV[7]), lastnode[1]),
+        ];
+
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 0);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 1);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 2);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 3);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 4);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 5);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 6);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 7);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 8);
+        round_x2(&mut va, &mut vb, &msg_vecs[0], &msg_vecs[1], 9);
+
+        for i in 0..8 {
+            h_vecs[0][i] = xor(xor(h_vecs[0][i], va[i]), va[i + 8]);
+            h_vecs[1][i] = xor(xor(h_vecs[1][i], vb[i]), vb[i + 8]);
+        }
+    };
+}
+
+// The final blocks of one group of jobs, with their count deltas and flags,
+// as compress8_loop prepares them.
+#[inline(always)]
+unsafe fn fin_vecs(
+    jobs: &[Job; DEGREE],
+    fin_offset: usize,
+    bufs: &mut [[u8; BLOCKBYTES]; DEGREE],
+    finalize: Finalize,
+    stride: Stride,
+) -> ([*const [u8; BLOCKBYTES]; DEGREE], __m256i, __m256i, __m256i) {
+    let mut blocks = [ptr::null(); DEGREE];
+    let mut lens = [0; DEGREE];
+    let mut last_block = [false; DEGREE];
+    let mut last_node = [false; DEGREE];
+    for (i, buf) in bufs.iter_mut().enumerate() {
+        let (block, len, should_finalize) = final_block(jobs[i].input, fin_offset, buf, stride);
+        blocks[i] = block;
+        lens[i] = len as Word;
+        last_block[i] = finalize.yes() && should_finalize;
+        last_node[i] = finalize.yes() && should_finalize && jobs[i].last_node.yes();
+    }
+    (
+        blocks,
+        loadu(&lens),
+        flags_vec(last_block),
+        flags_vec(last_node),
+    )
+}
+
+#[inline(always)]
+unsafe fn msg_blocks(jobs: &[Job; DEGREE], offset: usize) -> [*const [u8; BLOCKBYTES]; DEGREE] {
+    let mut blocks = [ptr::null(); DEGREE];
+    for i in 0..DEGREE {
+        blocks[i] = jobs[i].input.as_ptr().add(offset) as *const [u8; BLOCKBYTES];
+    }
+    blocks
+}
+
+// Like compress8_loop, but for 16 jobs in two interleaved groups. See round_x2.
+#[target_feature(enable = "avx2")]
+pub unsafe fn compress16_loop(jobs: &mut [Job; 2 * DEGREE], finalize: Finalize, stride: Stride) {
+    // If we're not finalizing, there can't be a partial block at the end.
+    for job in jobs.iter() {
+        input_debug_asserts(job.input, finalize);
+    }
+
+    let min_len = jobs.iter().map(|job| job.input.len()).min().unwrap();
+    let mut fin_offset = min_len.saturating_sub(1);
+    fin_offset -= fin_offset % stride.padded_blockbytes();
+
+    let (jobs_a, jobs_b) = mut_array_refs!(&mut *jobs, DEGREE, DEGREE);
+    let groups: [&mut [Job; DEGREE]; 2] = [jobs_a, jobs_b];
+    let mut h_vecs = [
+        transpose_state_vecs(groups[0]),
+        transpose_state_vecs(groups[1]),
+    ];
+    let (counts_lo_a, counts_hi_a) = load_counts(groups[0]);
+    let (counts_lo_b, counts_hi_b) = load_counts(groups[1]);
+    let mut counts_lo = [counts_lo_a, counts_lo_b];
+    let mut counts_hi = [counts_hi_a, counts_hi_b];
+
+    // Performance note, making these buffers mem::uninitialized() seems to
+    // cause problems in the optimizer.
+    let mut bufs_a = [[0; BLOCKBYTES]; DEGREE];
+    let mut bufs_b = [[0; BLOCKBYTES]; DEGREE];
+    let fin_a = fin_vecs(groups[0], fin_offset, &mut bufs_a, finalize, stride);
+    let fin_b = fin_vecs(groups[1], fin_offset, &mut bufs_b, finalize, stride);
+
+    // The main loop.
+    let mut offset = 0;
+    loop {
+        let blocks;
+        let counts_delta;
+        let last_block;
+        let last_node;
+        if offset == fin_offset {
+            blocks = [fin_a.0, fin_b.0];
+            counts_delta = [fin_a.1, fin_b.1];
+            last_block = [fin_a.2, fin_b.2];
+            last_node = [fin_a.3, fin_b.3];
+        } else {
+            blocks = [msg_blocks(groups[0], offset), msg_blocks(groups[1], offset)];
+            counts_delta = [set1(BLOCKBYTES as Word); 2];
+            last_block = [set1(0); 2];
+            last_node = [set1(0); 2];
+        }
+
+        let m_vecs = [transpose_msg_vecs(blocks[0]), transpose_msg_vecs(blocks[1])];
+        add_to_counts(&mut counts_lo[0], &mut counts_hi[0], counts_delta[0]);
+        add_to_counts(&mut counts_lo[1], &mut counts_hi[1], counts_delta[1]);
+        compress8x2_transposed!(
+            &mut h_vecs,
+            &m_vecs,
+            counts_lo,
+            counts_hi,
+            last_block,
+            last_node,
+        );
+
+        // Check for termination before bumping the offset, to avoid overflow.
+        if offset == fin_offset {
+            break;
+        }
+
+        offset += stride.padded_blockbytes();
+    }
+
+    // Write out the results.
+    let [jobs_a, jobs_b] = groups;
+    untranspose_state_vecs(&h_vecs[0], jobs_a);
+    untranspose_state_vecs(&h_vecs[1], jobs_b);
+    store_counts(jobs_a, counts_lo[0], counts_hi[0]);
+    store_counts(jobs_b, counts_lo[1], counts_hi[1]);
+    let max_consumed = offset.saturating_add(stride.padded_blockbytes());
+    for job in jobs.iter_mut() {
+        let consumed = cmp::min(max_consumed, job.input.len());
+        job.input = &job.input[consumed..];
+    }
+}
+
+#[inline(always)]
+unsafe fn transpose_chains(chains: &[[Word; 8]; DEGREE]) -> [__m256i; 8] {
+    transpose_vecs(
+        loadu(&chains[0]),
+        loadu(&chains[1]),
+        loadu(&chains[2]),
+        loadu(&chains[3]),
+        loadu(&chains[4]),
+        loadu(&chains[5]),
+        loadu(&chains[6]),
+        loadu(&chains[7]),
+    )
+}
+
+#[inline(always)]
+unsafe fn untranspose_chains(h_vecs: &[__m256i; 8], chains: &mut [[Word; 8]; DEGREE]) {
+    let out = transpose_vecs(
+        h_vecs[0], h_vecs[1], h_vecs[2], h_vecs[3], h_vecs[4], h_vecs[5], h_vecs[6], h_vecs[7],
+    );
+    for i in 0..DEGREE {
+        storeu(out[i], &mut chains[i]);
+    }
+}
+
+// Run `iterations` steps of 8 independent hash chains. Each chain starts as
+// the little-endian words of its seed, zero-padded, and ends as the state
+// words of its final digest. In between, the digests stay in transposed
+// vectors, and each one becomes the message of the next step after masking.
+#[target_feature(enable = "avx2")]
+pub unsafe fn iterate8(chains: &mut [[Word; 8]; DEGREE], step: &ChainStep, iterations: u64) {
+    let masks = step.digest_masks();
+    let mut mask_vecs = [set1(0); 8];
+    let mut init_vecs = [set1(0); 8];
+    for i in 0..8 {
+        mask_vecs[i] = set1(masks[i]);
+        init_vecs[i] = set1(step.words[i]);
+    }
+    let count_lo = set1(count_low(step.count));
+    let count_hi = set1(count_high(step.count));
+    let last_block = set1(flag_word(true));
+    let last_node = set1(flag_word(step.last_node.yes()));
+
+    let mut h_vecs = transpose_chains(chains);
+    for _ in 0..iterations {
+        let mut m_vecs = [set1(0); 16];
+        for i in 0..8 {
+            m_vecs[i] = and(h_vecs[i], mask_vecs[i]);
+        }
+        h_vecs = init_vecs;
+        compress8_transposed!(
+            &mut h_vecs,
+            &m_vecs,
+            count_lo,
+            count_hi,
+            last_block,
+            last_node,
+        );
+    }
+    untranspose_chains(&h_vecs, chains);
+}
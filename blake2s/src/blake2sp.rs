@@ -367,6 +367,34 @@ impl State {
         self
     }
 
+    /// Copy `src` into `dst` and add it to the hash, in one pass over memory. See
+    /// [`State::update_copy`](../struct.State.html#method.update_copy).
+    ///
+    /// # Panics
+    ///
+    /// Panics if `dst` and `src` have different lengths.
+    pub fn update_copy(&mut self, dst: &mut [u8], src: &[u8]) -> &mut Self {
+        assert_eq!(dst.len(), src.len(), "dst and src must be the same length");
+        for (dst, src) in dst
+            .chunks_mut(crate::COPY_CHUNK)
+            .zip(src.chunks(crate::COPY_CHUNK))
+        {
+            dst.copy_from_slice(src);
+            self.update(src);
+        }
+        self
+    }
+
+    /// Add at most `max_bytes` of `input` to the hash, and return the number of bytes consumed.
+    /// The budget is rounded down to a whole number of leaf compression rounds (`DEGREE` blocks),
+    /// but at least one round is consumed when there's input available, so that repeated calls
+    /// always make progress. See the [`cooperative`](../cooperative/index.html) module.
+    pub fn update_budgeted(&mut self, input: &[u8], max_bytes: usize) -> usize {
+        let take = crate::cooperative::budget_len(input.len(), max_bytes, DEGREE * BLOCKBYTES);
+        self.update(&input[..take]);
+        take
+    }
+
     /// Finalize the state and return a `Hash`. This method is idempotent, and calling it multiple
     /// times will give the same result. It's also possible to `update` with more input in between.
     pub fn finalize(&self) -> Hash {
@@ -486,6 +514,20 @@ pub(crate) fn force_portable(params: &mut Params) {
     params.implementation = Implementation::portable();
 }
 
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+pub(crate) fn force_sse41(params: &mut Params) {
+    if let Some(imp) = Implementation::sse41_if_supported() {
+        params.implementation = imp;
+    }
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+pub(crate) fn force_avx2(params: &mut Params) {
+    if let Some(imp) = Implementation::avx2_if_supported() {
+        params.implementation = imp;
+    }
+}
+
 #[cfg(test)]
 pub(crate) mod test {
     use super::*;
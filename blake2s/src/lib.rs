@@ -9,7 +9,9 @@
 //! - SIMD implementations based on Samuel Neves' [`blake2-avx2`](https://github.com/sneves/blake2-avx2).
 //!   These are very fast. For benchmarks, see [the Performance section of the
 //!   README](https://github.com/oconnor663/blake2_simd#performance).
-//! - Portable, safe implementations for other platforms.
+//! - Portable, safe implementations for other platforms. With the nightly-only `portable_simd`
+//!   Cargo feature, non-x86 platforms (POWER, s390x, etc.) get SIMD implementations built on
+//!   `core::simd` instead.
 //! - Dynamic CPU feature detection. Binaries include multiple implementations by default and
 //!   choose the fastest one the processor supports at runtime.
 //! - All the features from the [the BLAKE2 spec](https://blake2.net/blake2.pdf), like adjustable
@@ -41,6 +43,7 @@
 //! ```
 
 #![cfg_attr(not(feature = "std"), no_std)]
+#![cfg_attr(feature = "portable_simd", feature(portable_simd))]
 
 use arrayref::{array_refs, mut_array_refs};
 use core::cmp;
@@ -50,10 +53,15 @@ use core::mem::size_of;
 #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
 mod avx2;
 mod portable;
+#[cfg(feature = "portable_simd")]
+mod portable_simd;
 #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
 mod sse41;
+#[cfg(target_pointer_width = "64")]
+mod swar;
 
 pub mod blake2sp;
+pub mod cooperative;
 mod guts;
 pub mod many;
 
@@ -92,6 +100,11 @@ const SIGMA: [[u8; 16]; 10] = [
     [10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0],
 ];
 
+// update_copy works in chunks of this size. That's small enough for a chunk of
+// the source and of the destination to stay in L1 together, and it's a whole
+// number of compression rounds for both the serial and the parallel modes.
+const COPY_CHUNK: usize = 4096;
+
 /// Compute the BLAKE2s hash of a slice of bytes all at once, using default
 /// parameters.
 ///
@@ -469,6 +482,34 @@ impl State {
         self
     }
 
+    /// Copy `src` into `dst` and add it to the hash. This gives the same result as
+    /// `dst.copy_from_slice(src)` followed by `update(src)`, but it works through the input in
+    /// small chunks, hashing each one right after it's copied, while it's still in cache. For
+    /// inputs larger than the cache, that saves reading all of `src` from memory a second time.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `dst` and `src` have different lengths.
+    pub fn update_copy(&mut self, dst: &mut [u8], src: &[u8]) -> &mut Self {
+        assert_eq!(dst.len(), src.len(), "dst and src must be the same length");
+        for (dst, src) in dst.chunks_mut(COPY_CHUNK).zip(src.chunks(COPY_CHUNK)) {
+            dst.copy_from_slice(src);
+            self.update(src);
+        }
+        self
+    }
+
+    /// Add at most `max_bytes` of `input` to the hash, and return the number of bytes consumed.
+    /// The budget is rounded down to a whole number of blocks, but at least one block is consumed
+    /// when there's input available, so that repeated calls always make progress. This is useful
+    /// for hashing a long input in bounded slices, for example to yield to an async executor in
+    /// between them. See the [`cooperative`](cooperative/index.html) module.
+    pub fn update_budgeted(&mut self, input: &[u8], max_bytes: usize) -> usize {
+        let take = cooperative::budget_len(input.len(), max_bytes, BLOCKBYTES);
+        self.update(&input[..take]);
+        take
+    }
+
     /// Finalize the state and return a `Hash`. This method is idempotent, and calling it multiple
     /// times will give the same result. It's also possible to `update` with more input in between.
     pub fn finalize(&self) -> Hash {
@@ -675,7 +716,48 @@ pub mod benchmarks {
         params.implementation = guts::Implementation::portable();
     }
 
+    // Without SSE4.1 this leaves the detected implementation in place.
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    pub fn force_sse41(params: &mut Params) {
+        if let Some(imp) = guts::Implementation::sse41_if_supported() {
+            params.implementation = imp;
+        }
+    }
+
+    // Likewise without AVX2.
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    pub fn force_avx2(params: &mut Params) {
+        if let Some(imp) = guts::Implementation::avx2_if_supported() {
+            params.implementation = imp;
+        }
+    }
+
+    // Interleaved AVX2 is never detected, so benchmarks have to ask for it.
+    // Without AVX2 this leaves the detected implementation in place.
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    pub fn force_avx2_interleaved(params: &mut Params) {
+        if let Some(imp) = guts::Implementation::avx2_interleaved_if_supported() {
+            params.implementation = imp;
+        }
+    }
+
+    // SWAR is never detected, so benchmarks have to ask for it.
+    #[cfg(target_pointer_width = "64")]
+    pub fn force_swar(params: &mut Params) {
+        params.implementation = guts::Implementation::swar();
+    }
+
     pub fn force_portable_blake2sp(params: &mut blake2sp::Params) {
         blake2sp::force_portable(params);
     }
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    pub fn force_sse41_blake2sp(params: &mut blake2sp::Params) {
+        blake2sp::force_sse41(params);
+    }
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    pub fn force_avx2_blake2sp(params: &mut blake2sp::Params) {
+        blake2sp::force_avx2(params);
+    }
 }
@@ -0,0 +1,394 @@
+// This is an implementation on top of core::simd (portable SIMD), which is
+// still nightly-only. It's meant for targets where we don't have a dedicated
+// kernel, like POWER, s390x, or LoongArch. LLVM lowers these vectors to
+// whatever the target supports (VSX, z/Vector, LSX, ...), or to scalar code if
+// it supports nothing.
+
+use core::ptr;
+use core::simd::{simd_swizzle, LaneCount, Simd, SupportedLaneCount};
+
+use crate::guts::{
+    count_high, count_low, final_block, flag_word, input_debug_asserts, ChainStep, Finalize, Job,
+    LastNode, Stride,
+};
+use crate::{Count, Word, BLOCKBYTES, IV, SIGMA};
+use core::cmp;
+use core::convert::TryInto;
+use core::mem::size_of;
+
+// The widest transposed kernel. Narrower groups (4 lanes) are also supported.
+pub const DEGREE: usize = 8;
+
+type Row = Simd<Word, 4>;
+
+#[inline(always)]
+fn rot<const N: usize>(x: Simd<Word, N>, n: Word) -> Simd<Word, N>
+where
+    LaneCount<N>: SupportedLaneCount,
+{
+    (x >> Simd::splat(n)) | (x << Simd::splat(32 - n))
+}
+
+#[inline(always)]
+fn g(a: &mut Row, b: &mut Row, c: &mut Row, d: &mut Row, x: Row, y: Row) {
+    *a = *a + *b + x;
+    *d = rot(*d ^ *a, 16);
+    *c = *c + *d;
+    *b = rot(*b ^ *c, 12);
+    *a = *a + *b + y;
+    *d = rot(*d ^ *a, 8);
+    *c = *c + *d;
+    *b = rot(*b ^ *c, 7);
+}
+
+// Rotate the rows so that the diagonals of the state matrix line up as
+// columns, and back.
+#[inline(always)]
+fn diagonalize(b: &mut Row, c: &mut Row, d: &mut Row) {
+    *b = simd_swizzle!(*b, [1, 2, 3, 0]);
+    *c = simd_swizzle!(*c, [2, 3, 0, 1]);
+    *d = simd_swizzle!(*d, [3, 0, 1, 2]);
+}
+
+#[inline(always)]
+fn undiagonalize(b: &mut Row, c: &mut Row, d: &mut Row) {
+    *b = simd_swizzle!(*b, [3, 0, 1, 2]);
+    *c = simd_swizzle!(*c, [2, 3, 0, 1]);
+    *d = simd_swizzle!(*d, [1, 2, 3, 0]);
+}
+
+#[inline(always)]
+fn gather(m: &[Word; 16], s: &[u8; 16], i: usize, j: usize, k: usize, l: usize) -> Row {
+    Row::from_array([
+        m[s[i] as usize],
+        m[s[j] as usize],
+        m[s[k] as usize],
+        m[s[l] as usize],
+    ])
+}
+
+#[inline(always)]
+fn compress_block(
+    block: &[u8; BLOCKBYTES],
+    words: &mut [Word; 8],
+    count: Count,
+    last_block: Word,
+    last_node: Word,
+) {
+    let mut m = [0; 16];
+    for (word, bytes) in m.iter_mut().zip(block.chunks_exact(size_of::<Word>())) {
+        *word = Word::from_le_bytes(bytes.try_into().unwrap());
+    }
+
+    let h_low = Row::from_array([words[0], words[1], words[2], words[3]]);
+    let h_high = Row::from_array([words[4], words[5], words[6], words[7]]);
+    let mut a = h_low;
+    let mut b = h_high;
+    let mut c = Row::from_array([IV[0], IV[1], IV[2], IV[3]]);
+    let mut d = Row::from_array([IV[4], IV[5], IV[6], IV[7]])
+        ^ Row::from_array([count_low(count), count_high(count), last_block, last_node]);
+
+    for s in &SIGMA {
+        g(
+            &mut a,
+            &mut b,
+            &mut c,
+            &mut d,
+            gather(&m, s, 0, 2, 4, 6),
+            gather(&m, s, 1, 3, 5, 7),
+        );
+        diagonalize(&mut b, &mut c, &mut d);
+        g(
+            &mut a,
+            &mut b,
+            &mut c,
+            &mut d,
+            gather(&m, s, 8, 10, 12, 14),
+            gather(&m, s, 9, 11, 13, 15),
+        );
+        undiagonalize(&mut b, &mut c, &mut d);
+    }
+
+    let low = (h_low ^ a ^ c).to_array();
+    let high = (h_high ^ b ^ d).to_array();
+    words[..4].copy_from_slice(&low);
+    words[4..].copy_from_slice(&high);
+}
+
+pub fn compress1_loop(
+    input: &[u8],
+    words: &mut [Word; 8],
+    mut count: Count,
+    last_node: LastNode,
+    finalize: Finalize,
+    stride: Stride,
+) {
+    input_debug_asserts(input, finalize);
+
+    let mut local_words = *words;
+
+    let mut fin_offset = input.len().saturating_sub(1);
+    fin_offset -= fin_offset % stride.padded_blockbytes();
+    let mut buf = [0; BLOCKBYTES];
+    let (fin_block, fin_len, _) = final_block(input, fin_offset, &mut buf, stride);
+    let fin_last_block = flag_word(finalize.yes());
+    let fin_last_node = flag_word(finalize.yes() && last_node.yes());
+
+    let mut offset = 0;
+    loop {
+        let block;
+        let count_delta;
+        let last_block;
+        let last_node;
+        if offset == fin_offset {
+            block = fin_block;
+            count_delta = fin_len;
+            last_block = fin_last_block;
+            last_node = fin_last_node;
+        } else {
+            block = arrayref::array_ref!(input, offset, BLOCKBYTES);
+            count_delta = BLOCKBYTES;
+            last_block = flag_word(false);
+            last_node = flag_word(false);
+        };
+
+        count = count.wrapping_add(count_delta as Count);
+        compress_block(block, &mut local_words, count, last_block, last_node);
+
+        // Check for termination before bumping the offset, to avoid overflow.
+        if offset == fin_offset {
+            break;
+        }
+
+        offset += stride.padded_blockbytes();
+    }
+
+    *words = local_words;
+}
+
+#[inline(always)]
+fn round<const N: usize>(v: &mut [Simd<Word, N>; 16], m: &[Simd<Word, N>; 16], r: usize)
+where
+    LaneCount<N>: SupportedLaneCount,
+{
+    let s = &SIGMA[r];
+    // Mix the columns.
+    for i in 0..4 {
+        v[i] = v[i] + v[i + 4] + m[s[2 * i] as usize];
+        v[i + 12] = rot(v[i + 12] ^ v[i], 16);
+        v[i + 8] = v[i + 8] + v[i + 12];
+        v[i + 4] = rot(v[i + 4] ^ v[i + 8], 12);
+        v[i] = v[i] + v[i + 4] + m[s[2 * i + 1] as usize];
+        v[i + 12] = rot(v[i + 12] ^ v[i], 8);
+        v[i + 8] = v[i + 8] + v[i + 12];
+        v[i + 4] = rot(v[i + 4] ^ v[i + 8], 7);
+    }
+    // Mix the diagonals.
+    for i in 0..4 {
+        let a = i;
+        let b = 4 + (i + 1) % 4;
+        let c = 8 + (i + 2) % 4;
+        let d = 12 + (i + 3) % 4;
+        v[a] = v[a] + v[b] + m[s[8 + 2 * i] as usize];
+        v[d] = rot(v[d] ^ v[a], 16);
+        v[c] = v[c] + v[d];
+        v[b] = rot(v[b] ^ v[c], 12);
+        v[a] = v[a] + v[b] + m[s[8 + 2 * i + 1] as usize];
+        v[d] = rot(v[d] ^ v[a], 8);
+        v[c] = v[c] + v[d];
+        v[b] = rot(v[b] ^ v[c], 7);
+    }
+}
+
+// Load the Nth message word from each of the blocks into a vector.
+#[inline(always)]
+unsafe fn transpose_msg_vecs<const N: usize>(
+    blocks: &[*const [u8; BLOCKBYTES]; N],
+) -> [Simd<Word, N>; 16]
+where
+    LaneCount<N>: SupportedLaneCount,
+{
+    let mut m = [Simd::splat(0); 16];
+    for (w, vec) in m.iter_mut().enumerate() {
+        let mut lanes = [0; N];
+        for (lane, &block) in lanes.iter_mut().zip(blocks.iter()) {
+            let block: &[u8; BLOCKBYTES] = &*block;
+            let bytes = &block[w * size_of::<Word>()..][..size_of::<Word>()];
+            *lane = Word::from_le_bytes(bytes.try_into().unwrap());
+        }
+        *vec = Simd::from_array(lanes);
+    }
+    m
+}
+
+// A transposed kernel for any supported number of lanes, with the same
+// contract as the x86 compressN_loop functions.
+pub unsafe fn compress_n_loop<const N: usize>(
+    jobs: &mut [Job; N],
+    finalize: Finalize,
+    stride: Stride,
+) where
+    LaneCount<N>: SupportedLaneCount,
+{
+    // If we're not finalizing, there can't be a partial block at the end.
+    for job in jobs.iter() {
+        input_debug_asserts(job.input, finalize);
+    }
+
+    let mut h_vecs = [Simd::splat(0); 8];
+    for (w, vec) in h_vecs.iter_mut().enumerate() {
+        let mut lanes = [0; N];
+        for (lane, job) in lanes.iter_mut().zip(jobs.iter()) {
+            *lane = job.words[w];
+        }
+        *vec = Simd::from_array(lanes);
+    }
+    let mut counts = [0; N];
+    for (count, job) in counts.iter_mut().zip(jobs.iter()) {
+        *count = job.count;
+    }
+
+    // Prepare the final blocks (note, which could be empty if the input is
+    // empty). Do all this before entering the main loop.
+    let min_len = jobs.iter().map(|job| job.input.len()).min().unwrap();
+    let mut fin_offset = min_len.saturating_sub(1);
+    fin_offset -= fin_offset % stride.padded_blockbytes();
+    let mut bufs = [[0; BLOCKBYTES]; N];
+    let mut fin_blocks: [*const [u8; BLOCKBYTES]; N] = [ptr::null(); N];
+    let mut fin_lens = [0; N];
+    let mut fin_last_block = [0; N];
+    let mut fin_last_node = [0; N];
+    for (i, buf) in bufs.iter_mut().enumerate() {
+        let (block, len, finalize_i) = final_block(jobs[i].input, fin_offset, buf, stride);
+        fin_blocks[i] = block;
+        fin_lens[i] = len;
+        fin_last_block[i] = flag_word(finalize.yes() && finalize_i);
+        fin_last_node[i] = flag_word(finalize.yes() && finalize_i && jobs[i].last_node.yes());
+    }
+
+    // The main loop.
+    let mut offset = 0;
+    loop {
+        let mut blocks = fin_blocks;
+        let mut last_block = [0; N];
+        let mut last_node = [0; N];
+        if offset == fin_offset {
+            for i in 0..N {
+                counts[i] = counts[i].wrapping_add(fin_lens[i] as Count);
+            }
+            last_block = fin_last_block;
+            last_node = fin_last_node;
+        } else {
+            for i in 0..N {
+                blocks[i] = jobs[i].input.as_ptr().add(offset) as *const [u8; BLOCKBYTES];
+                counts[i] = counts[i].wrapping_add(BLOCKBYTES as Count);
+            }
+        }
+
+        let m_vecs = transpose_msg_vecs(&blocks);
+        let mut counts_low = [0; N];
+        let mut counts_high = [0; N];
+        for i in 0..N {
+            counts_low[i] = count_low(counts[i]);
+            counts_high[i] = count_high(counts[i]);
+        }
+        let mut v = [
+            h_vecs[0],
+            h_vecs[1],
+            h_vecs[2],
+            h_vecs[3],
+            h_vecs[4],
+            h_vecs[5],
+            h_vecs[6],
+            h_vecs[7],
+            Simd::splat(IV[0]),
+            Simd::splat(IV[1]),
+            Simd::splat(IV[2]),
+            Simd::splat(IV[3]),
+            Simd::splat(IV[4]) ^ Simd::from_array(counts_low),
+            Simd::splat(IV[5]) ^ Simd::from_array(counts_high),
+            Simd::splat(IV[6]) ^ Simd::from_array(last_block),
+            Simd::splat(IV[7]) ^ Simd::from_array(last_node),
+        ];
+        for r in 0..SIGMA.len() {
+            round(&mut v, &m_vecs, r);
+        }
+        for i in 0..8 {
+            h_vecs[i] = h_vecs[i] ^ v[i] ^ v[i + 8];
+        }
+
+        // Check for termination before bumping the offset, to avoid overflow.
+        if offset == fin_offset {
+            break;
+        }
+
+        offset += stride.padded_blockbytes();
+    }
+
+    // Write out the results.
+    for (w, vec) in h_vecs.iter().enumerate() {
+        for (job, &lane) in jobs.iter_mut().zip(vec.as_array().iter()) {
+            job.words[w] = lane;
+        }
+    }
+    let max_consumed = offset.saturating_add(stride.padded_blockbytes());
+    for (job, &count) in jobs.iter_mut().zip(counts.iter()) {
+        job.count = count;
+        let consumed = cmp::min(max_consumed, job.input.len());
+        job.input = &job.input[consumed..];
+    }
+}
+
+// The hash chain kernel, with the same contract as the x86 iterateN functions.
+pub unsafe fn iterate_n<const N: usize>(
+    chains: &mut [[Word; 8]; N],
+    step: &ChainStep,
+    iterations: u64,
+) where
+    LaneCount<N>: SupportedLaneCount,
+{
+    let masks = step.digest_masks();
+    let mut h_vecs = [Simd::splat(0); 8];
+    for (w, vec) in h_vecs.iter_mut().enumerate() {
+        let mut lanes = [0; N];
+        for (lane, chain) in lanes.iter_mut().zip(chains.iter()) {
+            *lane = chain[w];
+        }
+        *vec = Simd::from_array(lanes);
+    }
+    for _ in 0..iterations {
+        let mut m_vecs = [Simd::splat(0); 16];
+        for i in 0..8 {
+            m_vecs[i] = h_vecs[i] & Simd::splat(masks[i]);
+        }
+        let mut v = [
+            Simd::splat(step.words[0]),
+            Simd::splat(step.words[1]),
+            Simd::splat(step.words[2]),
+            Simd::splat(step.words[3]),
+            Simd::splat(step.words[4]),
+            Simd::splat(step.words[5]),
+            Simd::splat(step.words[6]),
+            Simd::splat(step.words[7]),
+            Simd::splat(IV[0]),
+            Simd::splat(IV[1]),
+            Simd::splat(IV[2]),
+            Simd::splat(IV[3]),
+            Simd::splat(IV[4] ^ count_low(step.count)),
+            Simd::splat(IV[5] ^ count_high(step.count)),
+            Simd::splat(IV[6] ^ flag_word(true)),
+            Simd::splat(IV[7] ^ flag_word(step.last_node.yes())),
+        ];
+        for r in 0..SIGMA.len() {
+            round(&mut v, &m_vecs, r);
+        }
+        for i in 0..8 {
+            h_vecs[i] = Simd::splat(step.words[i]) ^ v[i] ^ v[i + 8];
+        }
+    }
+    for (w, vec) in h_vecs.iter().enumerate() {
+        for (chain, &lane) in chains.iter_mut().zip(vec.as_array().iter()) {
+            chain[w] = lane;
+        }
+    }
+}
@@ -4,8 +4,8 @@ use core::arch::x86::*;
 use core::arch::x86_64::*;
 
 use crate::guts::{
-    assemble_count, count_high, count_low, final_block, flag_word, input_debug_asserts, Finalize,
-    Job, LastNode, Stride,
+    assemble_count, count_high, count_low, final_block, flag_word, input_debug_asserts, ChainStep,
+    Finalize, Job, LastNode, Stride,
 };
 use crate::{Count, Word, BLOCKBYTES, IV, SIGMA};
 use arrayref::{array_refs, mut_array_refs};
@@ -886,3 +886,80 @@ pub unsafe fn compress4_loop(jobs: &mut [Job; DEGREE], finalize: Finalize, strid
         job.input = &job.input[consumed..];
     }
 }
+
+#[inline(always)]
+unsafe fn transpose_chains(chains: &[[Word; 8]; DEGREE]) -> [__m128i; 8] {
+    let words0 = array_refs!(&chains[0], DEGREE, DEGREE);
+    let words1 = array_refs!(&chains[1], DEGREE, DEGREE);
+    let words2 = array_refs!(&chains[2], DEGREE, DEGREE);
+    let words3 = array_refs!(&chains[3], DEGREE, DEGREE);
+    let [h0, h1, h2, h3] = transpose_vecs(
+        loadu(words0.0),
+        loadu(words1.0),
+        loadu(words2.0),
+        loadu(words3.0),
+    );
+    let [h4, h5, h6, h7] = transpose_vecs(
+        loadu(words0.1),
+        loadu(words1.1),
+        loadu(words2.1),
+        loadu(words3.1),
+    );
+    [h0, h1, h2, h3, h4, h5, h6, h7]
+}
+
+#[inline(always)]
+unsafe fn untranspose_chains(h_vecs: &[__m128i; 8], chains: &mut [[Word; 8]; DEGREE]) {
+    let [chain0, chain1, chain2, chain3] = chains;
+    let words0 = mut_array_refs!(chain0, DEGREE, DEGREE);
+    let words1 = mut_array_refs!(chain1, DEGREE, DEGREE);
+    let words2 = mut_array_refs!(chain2, DEGREE, DEGREE);
+    let words3 = mut_array_refs!(chain3, DEGREE, DEGREE);
+    let out = transpose_vecs(h_vecs[0], h_vecs[1], h_vecs[2], h_vecs[3]);
+    storeu(out[0], words0.0);
+    storeu(out[1], words1.0);
+    storeu(out[2], words2.0);
+    storeu(out[3], words3.0);
+    let out = transpose_vecs(h_vecs[4], h_vecs[5], h_vecs[6], h_vecs[7]);
+    storeu(out[0], words0.1);
+    storeu(out[1], words1.1);
+    storeu(out[2], words2.1);
+    storeu(out[3], words3.1);
+}
+
+// Run `iterations` steps of 4 independent hash chains. Each chain starts as
+// the little-endian words of its seed, zero-padded, and ends as the state
+// words of its final digest. In between, the digests stay in transposed
+// vectors, and each one becomes the message of the next step after masking.
+#[target_feature(enable = "sse4.1")]
+pub unsafe fn iterate4(chains: &mut [[Word; 8]; DEGREE], step: &ChainStep, iterations: u64) {
+    let masks = step.digest_masks();
+    let mut mask_vecs = [set1(0); 8];
+    let mut init_vecs = [set1(0); 8];
+    for i in 0..8 {
+        mask_vecs[i] = set1(masks[i]);
+        init_vecs[i] = set1(step.words[i]);
+    }
+    let count_lo = set1(count_low(step.count));
+    let count_hi = set1(count_high(step.count));
+    let last_block = set1(flag_word(true));
+    let last_node = set1(flag_word(step.last_node.yes()));
+
+    let mut h_vecs = transpose_chains(chains);
+    for _ in 0..iterations {
+        let mut m_vecs = [set1(0); 16];
+        for i in 0..8 {
+            m_vecs[i] = and(h_vecs[i], mask_vecs[i]);
+        }
+        h_vecs = init_vecs;
+        compress4_transposed!(
+            &mut h_vecs,
+            &m_vecs,
+            count_lo,
+            count_hi,
+            last_block,
+            last_node,
+        );
+    }
+    untranspose_chains(&h_vecs, chains);
+}
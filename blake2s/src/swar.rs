@@ -0,0 +1,237 @@
+//! A two-way BLAKE2s implementation for 64-bit targets without SIMD. Each
+//! `u64` holds the same state word from two different instances, the first
+//! job in the low half and the second job in the high half ("SIMD within a
+//! register"). Additions mask off the top bit of each half so that carries
+//! can't cross between lanes, and rotations shift both halves at once.
+//!
+//! Each lane-wise add or rotate costs about five instructions, so this only
+//! pays off on cores where 32-bit arithmetic is itself expensive. On x86_64
+//! it runs at less than half the speed of the portable implementation, which
+//! is why Implementation::detect() never picks it. See the
+//! bench_*_blake2s_many_2x_* benchmarks.
+
+use arrayref::array_ref;
+
+use super::*;
+use crate::guts::{
+    count_high, count_low, final_block, flag_word, input_debug_asserts, Finalize, Job, Stride,
+};
+
+pub const DEGREE: usize = 2;
+
+type Lanes = u64;
+
+// The top bit of each lane.
+const HIGH_BITS: Lanes = 0x8000_0000_8000_0000;
+
+#[inline(always)]
+fn splat(x: Word) -> Lanes {
+    x as Lanes | (x as Lanes) << 32
+}
+
+#[inline(always)]
+fn pack(lo: Word, hi: Word) -> Lanes {
+    lo as Lanes | (hi as Lanes) << 32
+}
+
+#[inline(always)]
+fn unpack(x: Lanes) -> (Word, Word) {
+    (x as Word, (x >> 32) as Word)
+}
+
+// Add the low 31 bits of each lane, and then fix up the top bit of each lane
+// with XOR. The carry out of the top bit is discarded, like wrapping_add.
+#[inline(always)]
+fn add(a: Lanes, b: Lanes) -> Lanes {
+    ((a & !HIGH_BITS) + (b & !HIGH_BITS)) ^ ((a ^ b) & HIGH_BITS)
+}
+
+// Rotate each lane right by N bits. The mask keeps the bits shifted out of
+// the high lane from landing in the low lane, and vice versa.
+#[inline(always)]
+fn rot<const N: u32>(x: Lanes) -> Lanes {
+    let low_mask = splat(!0 >> N);
+    ((x >> N) & low_mask) | ((x << (32 - N)) & !low_mask)
+}
+
+#[inline(always)]
+fn g(v: &mut [Lanes; 16], a: usize, b: usize, c: usize, d: usize, x: Lanes, y: Lanes) {
+    v[a] = add(add(v[a], v[b]), x);
+    v[d] = rot::<16>(v[d] ^ v[a]);
+    v[c] = add(v[c], v[d]);
+    v[b] = rot::<12>(v[b] ^ v[c]);
+    v[a] = add(add(v[a], v[b]), y);
+    v[d] = rot::<8>(v[d] ^ v[a]);
+    v[c] = add(v[c], v[d]);
+    v[b] = rot::<7>(v[b] ^ v[c]);
+}
+
+#[inline(always)]
+fn round(r: usize, m: &[Lanes; 16], v: &mut [Lanes; 16]) {
+    // Select the message schedule based on the round.
+    let s = SIGMA[r];
+
+    // Mix the columns.
+    g(v, 0, 4, 8, 12, m[s[0] as usize], m[s[1] as usize]);
+    g(v, 1, 5, 9, 13, m[s[2] as usize], m[s[3] as usize]);
+    g(v, 2, 6, 10, 14, m[s[4] as usize], m[s[5] as usize]);
+    g(v, 3, 7, 11, 15, m[s[6] as usize], m[s[7] as usize]);
+
+    // Mix the rows.
+    g(v, 0, 5, 10, 15, m[s[8] as usize], m[s[9] as usize]);
+    g(v, 1, 6, 11, 12, m[s[10] as usize], m[s[11] as usize]);
+    g(v, 2, 7, 8, 13, m[s[12] as usize], m[s[13] as usize]);
+    g(v, 3, 4, 9, 14, m[s[14] as usize], m[s[15] as usize]);
+}
+
+#[inline(always)]
+fn load_msg(block0: &[u8; BLOCKBYTES], block1: &[u8; BLOCKBYTES]) -> [Lanes; 16] {
+    const W: usize = size_of::<Word>();
+    let mut m = [0; 16];
+    for i in 0..16 {
+        m[i] = pack(
+            Word::from_le_bytes(*array_ref!(block0, i * W, W)),
+            Word::from_le_bytes(*array_ref!(block1, i * W, W)),
+        );
+    }
+    m
+}
+
+#[inline(always)]
+fn compress_block(
+    block0: &[u8; BLOCKBYTES],
+    block1: &[u8; BLOCKBYTES],
+    h: &mut [Lanes; 8],
+    count_low: Lanes,
+    count_high: Lanes,
+    last_block: Lanes,
+    last_node: Lanes,
+) {
+    // Initialize the compression state.
+    let mut v = [
+        h[0],
+        h[1],
+        h[2],
+        h[3],
+        h[4],
+        h[5],
+        h[6],
+        h[7],
+        splat(IV[0]),
+        splat(IV[1]),
+        splat(IV[2]),
+        splat(IV[3]),
+        splat(IV[4]) ^ count_low,
+        splat(IV[5]) ^ count_high,
+        splat(IV[6]) ^ last_block,
+        splat(IV[7]) ^ last_node,
+    ];
+
+    let m = load_msg(block0, block1);
+
+    round(0, &m, &mut v);
+    round(1, &m, &mut v);
+    round(2, &m, &mut v);
+    round(3, &m, &mut v);
+    round(4, &m, &mut v);
+    round(5, &m, &mut v);
+    round(6, &m, &mut v);
+    round(7, &m, &mut v);
+    round(8, &m, &mut v);
+    round(9, &m, &mut v);
+
+    h[0] ^= v[0] ^ v[8];
+    h[1] ^= v[1] ^ v[9];
+    h[2] ^= v[2] ^ v[10];
+    h[3] ^= v[3] ^ v[11];
+    h[4] ^= v[4] ^ v[12];
+    h[5] ^= v[5] ^ v[13];
+    h[6] ^= v[6] ^ v[14];
+    h[7] ^= v[7] ^ v[15];
+}
+
+pub fn compress2_loop(jobs: &mut [Job; DEGREE], finalize: Finalize, stride: Stride) {
+    // If we're not finalizing, there can't be a partial block at the end.
+    for job in jobs.iter() {
+        input_debug_asserts(job.input, finalize);
+    }
+
+    let mut h = [0; 8];
+    for i in 0..8 {
+        h[i] = pack(jobs[0].words[i], jobs[1].words[i]);
+    }
+    let mut counts = [jobs[0].count, jobs[1].count];
+
+    let min_len = jobs.iter().map(|job| job.input.len()).min().unwrap();
+    let mut fin_offset = min_len.saturating_sub(1);
+    fin_offset -= fin_offset % stride.padded_blockbytes();
+    // Performance note, making these buffers mem::uninitialized() seems to
+    // cause problems in the optimizer.
+    let mut buf0: [u8; BLOCKBYTES] = [0; BLOCKBYTES];
+    let mut buf1: [u8; BLOCKBYTES] = [0; BLOCKBYTES];
+    let (block0, len0, finalize0) = final_block(jobs[0].input, fin_offset, &mut buf0, stride);
+    let (block1, len1, finalize1) = final_block(jobs[1].input, fin_offset, &mut buf1, stride);
+    let fin_blocks: [&[u8; BLOCKBYTES]; DEGREE] = [block0, block1];
+    let fin_counts_delta = [len0 as Count, len1 as Count];
+    let fin_last_block = pack(
+        flag_word(finalize.yes() && finalize0),
+        flag_word(finalize.yes() && finalize1),
+    );
+    let fin_last_node = pack(
+        flag_word(finalize.yes() && finalize0 && jobs[0].last_node.yes()),
+        flag_word(finalize.yes() && finalize1 && jobs[1].last_node.yes()),
+    );
+
+    let mut offset = 0;
+    loop {
+        let blocks;
+        let counts_delta;
+        let last_block;
+        let last_node;
+        if offset == fin_offset {
+            blocks = fin_blocks;
+            counts_delta = fin_counts_delta;
+            last_block = fin_last_block;
+            last_node = fin_last_node;
+        } else {
+            blocks = [
+                array_ref!(jobs[0].input, offset, BLOCKBYTES),
+                array_ref!(jobs[1].input, offset, BLOCKBYTES),
+            ];
+            counts_delta = [BLOCKBYTES as Count; DEGREE];
+            last_block = 0;
+            last_node = 0;
+        }
+
+        counts[0] = counts[0].wrapping_add(counts_delta[0]);
+        counts[1] = counts[1].wrapping_add(counts_delta[1]);
+        compress_block(
+            blocks[0],
+            blocks[1],
+            &mut h,
+            pack(count_low(counts[0]), count_low(counts[1])),
+            pack(count_high(counts[0]), count_high(counts[1])),
+            last_block,
+            last_node,
+        );
+
+        // Check for termination before bumping the offset, to avoid overflow.
+        if offset == fin_offset {
+            break;
+        }
+
+        offset += stride.padded_blockbytes();
+    }
+
+    for i in 0..8 {
+        let (word0, word1) = unpack(h[i]);
+        jobs[0].words[i] = word0;
+        jobs[1].words[i] = word1;
+    }
+    let max_consumed = offset.saturating_add(stride.padded_blockbytes());
+    for (job, &count) in jobs.iter_mut().zip(counts.iter()) {
+        job.count = count;
+        let consumed = cmp::min(max_consumed, job.input.len());
+        job.input = &job.input[consumed..];
+    }
+}